@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <rpc/pmap_clnt.h>
+#include <rpc/rpc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "blockcopy_random.h"
+#include "client_agent.h"
+
+/*
+ * Session agent: keeps RPC connections to one server open between client
+ * runs and lends them out over a Unix socket (protocol in client_agent.h).
+ * A short job then starts without the portmapper lookup and TCP handshake
+ * it would otherwise pay on every run.
+ */
+
+#define AGENT_MAX_JOBS 64
+#define AGENT_MAX_LENT 64
+#define DEFAULT_IDLE 16
+
+/* One client run and the sessions it holds */
+struct job {
+    int sock;
+    int lent[AGENT_MAX_LENT];
+    int nlent;
+    int gets;
+    int fresh;              /* of those, sessions opened for this job */
+};
+
+static struct sockaddr_in g_server;
+static int g_server_vers = 0;       /* highest version the server speaks, once known */
+static int *g_idle;                 /* sessions nobody holds, oldest first */
+static int g_nidle = 0;
+static int g_max_idle = DEFAULT_IDLE;
+
+/* Highest version the server speaks on the connected socket fd; 0 on error */
+static int probe_version(int fd) {
+    int s = fd;
+    CLIENT *clnt = clnttcp_create(&g_server, BLOCKCOPY_PROG, BLOCKCOPY_VERS2, &s, 0, 0);
+    if (!clnt) {
+        clnt_pcreateerror("agent probe");
+        return 0;
+    }
+    struct timeval tv = { 25, 0 };
+    enum clnt_stat st = clnt_call(clnt, NULLPROC, (xdrproc_t)xdr_void, NULL,
+                                  (xdrproc_t)xdr_void, NULL, tv);
+    int vers = 0;
+    if (st == RPC_SUCCESS) {
+        vers = BLOCKCOPY_VERS2;
+    } else if (st == RPC_PROGVERSMISMATCH) {
+        struct rpc_err err;
+        clnt_geterr(clnt, &err);
+        if (err.re_vers.high >= BLOCKCOPY_VERS) vers = BLOCKCOPY_VERS;
+    } else {
+        clnt_perror(clnt, "agent probe");
+    }
+    clnt_destroy(clnt);     /* the socket is ours and stays open */
+    return vers;
+}
+
+static int open_session(void) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&g_server, sizeof(g_server)) != 0) {
+        perror("agent connect");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (g_server_vers == 0 && (g_server_vers = probe_version(fd)) == 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* An idle session must have nothing to read: data or EOF means it is unusable */
+static int session_idle(int fd) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    return poll(&p, 1, 0) == 0;
+}
+
+/* A pooled session that is still idle, or a new one; -1 on error */
+static int take_session(struct job *j) {
+    while (g_nidle > 0) {
+        int fd = g_idle[--g_nidle];
+        if (session_idle(fd)) return fd;
+        close(fd);
+    }
+    int fd = open_session();
+    if (fd >= 0) j->fresh++;
+    return fd;
+}
+
+static void lend(struct job *j) {
+    int fd = j->nlent < AGENT_MAX_LENT ? take_session(j) : -1;
+    unsigned char vers = fd >= 0 ? g_server_vers : 0;
+    struct iovec iov = { &vers, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&u, 0, sizeof(u));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = u.buf;
+        msg.msg_controllen = sizeof(u.buf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(fd));
+        j->lent[j->nlent++] = fd;
+        j->gets++;
+    }
+    sendmsg(j->sock, &msg, MSG_NOSIGNAL);
+}
+
+/* AGENT_DONE: the job's sessions go back to the pool, newest on top */
+static void take_back(struct job *j) {
+    for (int k = 0; k < j->nlent; k++) {
+        if (g_nidle < g_max_idle && session_idle(j->lent[k]))
+            g_idle[g_nidle++] = j->lent[k];
+        else
+            close(j->lent[k]);
+    }
+    j->nlent = 0;
+}
+
+static void job_end(struct job *j) {
+    printf("job: %d sessions (%d new), %s, %d idle\n", j->gets, j->fresh,
+           j->nlent ? "dropped" : "returned", g_nidle);
+    fflush(stdout);
+    for (int k = 0; k < j->nlent; k++) close(j->lent[k]);
+    close(j->sock);
+}
+
+/* host or host:port; without a port the portmapper is asked once, here */
+static int resolve_server(const char *arg) {
+    char host[256];
+    const char *colon = strrchr(arg, ':');
+    size_t n = colon ? (size_t)(colon - arg) : strlen(arg);
+    if (n >= sizeof(host)) {
+        fprintf(stderr, "%s: host name too long\n", arg);
+        return -1;
+    }
+    memcpy(host, arg, n);
+    host[n] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+    memcpy(&g_server, res->ai_addr, sizeof(g_server));
+    freeaddrinfo(res);
+
+    int port = colon ? atoi(colon + 1) : 0;
+    if (colon && (port <= 0 || port > 65535)) {
+        fprintf(stderr, "%s: bad port\n", arg);
+        return -1;
+    }
+    if (!colon) {
+        port = pmap_getport(&g_server, BLOCKCOPY_PROG, BLOCKCOPY_VERS2, IPPROTO_TCP);
+        if (port == 0)
+            port = pmap_getport(&g_server, BLOCKCOPY_PROG, BLOCKCOPY_VERS, IPPROTO_TCP);
+        if (port == 0) {
+            fprintf(stderr, "%s: not registered with the portmapper\n", host);
+            return -1;
+        }
+    }
+    g_server.sin_port = htons(port);
+    printf("server %s port %d\n", host, port);
+    return 0;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "agent: socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(sock, 16) != 0) {
+        perror("agent listen");
+        if (sock >= 0) close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s <server_hostname[:port]> [options]\n"
+        "Options:\n"
+        "  -S path            Unix socket clients borrow sessions on (default: %s)\n"
+        "  -k sessions        Idle sessions kept open for the next run (default: %d)\n",
+        prog, AGENT_DEFAULT_PATH, DEFAULT_IDLE);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *server = argv[1];
+    const char *path = AGENT_DEFAULT_PATH;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "S:k:")) != -1) {
+        switch (opt) {
+        case 'S':
+            path = optarg;
+            break;
+        case 'k':
+            g_max_idle = atoi(optarg);
+            if (g_max_idle < 0) {
+                fprintf(stderr, "Idle sessions must not be negative.\n");
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if (resolve_server(server) != 0) return 1;
+    g_idle = calloc(g_max_idle + 1, sizeof(*g_idle));
+    int lsock = listen_unix(path);
+    if (!g_idle || lsock < 0) return 1;
+    printf("agent on %s, keeping up to %d idle sessions\n", path, g_max_idle);
+    fflush(stdout);
+
+    struct job jobs[AGENT_MAX_JOBS];
+    int njobs = 0;
+    struct pollfd p[AGENT_MAX_JOBS + 1];
+    for (;;) {
+        p[0] = (struct pollfd){ lsock, njobs < AGENT_MAX_JOBS ? POLLIN : 0, 0 };
+        for (int k = 0; k < njobs; k++) p[k + 1] = (struct pollfd){ jobs[k].sock, POLLIN, 0 };
+        if (poll(p, njobs + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return 1;
+        }
+
+        /* back to front, so ending a job moves only jobs already handled */
+        for (int k = njobs - 1; k >= 0; k--) {
+            if (!p[k + 1].revents) continue;
+            struct job *j = &jobs[k];
+            char req;
+            ssize_t r = recv(j->sock, &req, 1, 0);
+            if (r == 1 && req == AGENT_GET) {
+                lend(j);
+            } else if (r == 1 && req == AGENT_DONE) {
+                take_back(j);
+            } else if (r == 0 || (r < 0 && errno != EINTR && errno != EAGAIN) || r == 1) {
+                job_end(j);
+                *j = jobs[--njobs];
+            }
+        }
+        if (p[0].revents & POLLIN) {
+            int s = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+            if (s >= 0) {
+                memset(&jobs[njobs], 0, sizeof(jobs[njobs]));
+                jobs[njobs++].sock = s;
+            }
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#include "batch_pack.h"
+
+#define SHIFT_MAX 40
+
+uint32_t pack_runs(const int64_t *srcs, const int64_t *dsts, uint32_t n, copy_run *out) {
+    uint32_t nruns = 0;
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t j = i + 1;
+        int64_t stride = 0;
+        if (j < n && srcs[j] - srcs[i] == dsts[j] - dsts[i]) {
+            stride = srcs[j] - srcs[i];
+            while (j < n && srcs[j] - srcs[j - 1] == stride && dsts[j] - dsts[j - 1] == stride)
+                j++;
+        }
+        if (out) {
+            out[nruns].src = srcs[i];
+            out[nruns].dst = dsts[i];
+            out[nruns].count = j - i;
+            out[nruns].stride = stride;
+        }
+        nruns++;
+        i = j;
+    }
+    return nruns;
+}
+
+unsigned pack_shift(const int64_t *srcs, const int64_t *dsts, const uint32_t *lens, uint32_t n) {
+    uint64_t bits = 1ull << SHIFT_MAX;
+    for (uint32_t i = 0; i < n; i++) {
+        bits |= (uint64_t)srcs[i] | (uint64_t)dsts[i];
+        if (lens) bits |= lens[i];
+    }
+    return __builtin_ctzll(bits);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Zigzag: small differences of either sign become small unsigned values */
+static uint64_t zigzag(int64_t d) {
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+}
+
+size_t pack_deltas(const int64_t *srcs, const int64_t *dsts, const uint32_t *lens, uint32_t n,
+                   unsigned shift, uint8_t *out) {
+    uint8_t *p = out;
+    int64_t src = 0, dst = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        p = put_varint(p, zigzag((srcs[i] - src) >> shift));
+        p = put_varint(p, zigzag((dsts[i] - dst) >> shift));
+        if (lens) p = put_varint(p, lens[i] >> shift);
+        src = srcs[i];
+        dst = dsts[i];
+    }
+    return (size_t)(p - out);
+}
+
+int unpack_runs(const copy_run *runs, uint32_t nruns, uint32_t n, int64_t *srcs,
+                int64_t *dsts) {
+    uint32_t k = 0;
+    for (uint32_t r = 0; r < nruns; r++) {
+        if (runs[r].count == 0 || runs[r].count > n - k) return -1;
+        for (uint32_t c = 0; c < runs[r].count; c++, k++) {
+            uint64_t step = (uint64_t)c * (uint64_t)runs[r].stride;
+            srcs[k] = (int64_t)((uint64_t)runs[r].src + step);
+            dsts[k] = (int64_t)((uint64_t)runs[r].dst + step);
+        }
+    }
+    return k == n ? 0 : -1;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (unsigned s = 0; p < end && s < 64; s += 7) {
+        uint8_t b = *p++;
+        *v |= (uint64_t)(b & 0x7f) << s;
+        if (!(b & 0x80)) return p;
+    }
+    return NULL;
+}
+
+int unpack_deltas(const uint8_t *in, size_t len, uint32_t n, unsigned shift, int64_t *srcs,
+                  int64_t *dsts, uint32_t *lens) {
+    if (shift > SHIFT_MAX) return -1;
+    const uint8_t *p = in, *end = in + len;
+    int64_t src = 0, dst = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t ds, dd, l = 0;
+        if (!(p = get_varint(p, end, &ds)) || !(p = get_varint(p, end, &dd))) return -1;
+        if (lens && !(p = get_varint(p, end, &l))) return -1;
+        src = (int64_t)((uint64_t)src + ((ds >> 1 ^ -(ds & 1)) << shift));
+        dst = (int64_t)((uint64_t)dst + ((dd >> 1 ^ -(dd & 1)) << shift));
+        srcs[i] = src;
+        dsts[i] = dst;
+        if (lens) {
+            if (l == 0 || l > (UINT32_MAX >> shift)) return -1;
+            lens[i] = (uint32_t)(l << shift);
+        }
+    }
+    return p == end ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+#ifndef BATCH_PACK_H
+#define BATCH_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "blockcopy_random.h"
+
+/* PACK_COPY_MAX and MAX_DELTA_BYTES come from blockcopy_random.x */
+_Static_assert(MAX_DELTA_BYTES == MAX_BATCH2 * PACK_COPY_MAX,
+               "MAX_DELTA_BYTES must hold a full batch of deltas");
+
+/*
+ * Runs of WRITE_PBA_PACKED: copy i + 1 at the same distance from copy i on
+ * both sides continues the run. Writes the runs to out unless it is NULL;
+ * returns how many there are.
+ */
+uint32_t pack_runs(const int64_t *srcs, const int64_t *dsts, uint32_t n, copy_run *out);
+
+/* Largest shift (up to 40) such that every address and length is a multiple of 1 << shift */
+unsigned pack_shift(const int64_t *srcs, const int64_t *dsts, const uint32_t *lens, uint32_t n);
+
+/*
+ * ENC_DELTA stream of n copies into out, which holds n * PACK_COPY_MAX bytes.
+ * lens is NULL when all copies have the batch's block size. Returns the
+ * number of bytes written.
+ */
+size_t pack_deltas(const int64_t *srcs, const int64_t *dsts, const uint32_t *lens, uint32_t n,
+                   unsigned shift, uint8_t *out);
+
+/* Expand runs holding n copies in all; returns 0, or -1 if they do not add up to n */
+int unpack_runs(const copy_run *runs, uint32_t nruns, uint32_t n, int64_t *srcs,
+                int64_t *dsts);
+
+/* Decode n copies (lens when not NULL); returns 0, or -1 unless in is exactly n copies */
+int unpack_deltas(const uint8_t *in, size_t len, uint32_t n, unsigned shift, int64_t *srcs,
+                  int64_t *dsts, uint32_t *lens);
+
+#endif
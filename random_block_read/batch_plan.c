@@ -0,0 +1,303 @@
+#include "batch_plan.h"
+#include "server_target.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct plan_ival {
+    int64_t off;
+    int64_t end;
+    uint32_t group;
+    uint32_t is_write;
+};
+
+/* Room for n I/Os; the ivals also hold one key per group in plan_order_by_offset */
+static int reserve_ios(struct batch_plan *plan, uint32_t n) {
+    if (plan->io_cap >= n) return 0;
+    uint32_t cap = plan->io_cap ? plan->io_cap : 1024;
+    while (cap < n) cap *= 2;
+
+    struct plan_io *io = realloc(plan->ios, cap * sizeof(*io));
+    if (!io) return -1;
+    plan->ios = io;
+
+    struct plan_ival *iv = realloc(plan->ivals, cap * sizeof(*iv));
+    if (!iv) return -1;
+    plan->ivals = iv;
+
+    uint32_t *ac = realloc(plan->active, cap * sizeof(*ac));
+    if (!ac) return -1;
+    plan->active = ac;
+
+    plan->io_cap = cap;
+    return 0;
+}
+
+static int reserve(struct batch_plan *plan, uint32_t count) {
+    if (reserve_ios(plan, 2 * count) != 0) return -1;
+    if (plan->cap >= count) return 0;
+
+    struct plan_group *g = realloc(plan->groups, count * sizeof(*g));
+    if (!g) return -1;
+    plan->groups = g;
+
+    uint32_t *nd = realloc(plan->ndeps, count * sizeof(*nd));
+    if (!nd) return -1;
+    plan->ndeps = nd;
+
+    uint32_t *sf = realloc(plan->succ_first, (count + 1) * sizeof(*sf));
+    if (!sf) return -1;
+    plan->succ_first = sf;
+
+    plan->cap = count;
+    return 0;
+}
+
+static inline int overlaps(int64_t a, uint32_t alen, int64_t b, uint32_t blen) {
+    return a < b + (int64_t)blen && b < a + (int64_t)alen;
+}
+
+static inline uint32_t len_of(const uint32_t *lens, uint32_t i, uint32_t block_size) {
+    return lens ? lens[i] : block_size;
+}
+
+/* Bytes from off on that stay on one device (and stripe unit), up to len */
+static inline uint32_t piece_len(int64_t off, uint32_t len) {
+    int64_t rel;
+    uint64_t contig;
+    if (target_map(off, &rel, &contig) < 0 || contig >= len) return len;
+    return (uint32_t)contig;
+}
+
+/* Device pieces of [off, off + len): more than one if it crosses a boundary */
+static uint32_t count_pieces(int64_t off, uint32_t len) {
+    uint32_t n = 0;
+    for (uint32_t take; len > 0; off += take, len -= take, n++) take = piece_len(off, len);
+    return n;
+}
+
+/* Emit merged I/Os for copies [first, first + n) of one side (srcs or dsts) */
+static uint32_t emit_ios(struct plan_io *out, const int64_t *offs, const uint32_t *lens,
+                         uint32_t first, uint32_t n, uint32_t block_size) {
+    uint32_t nios = 0;
+    uint32_t buf_off = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        int64_t off = offs[first + k];
+        uint32_t len = len_of(lens, first + k, block_size);
+        while (len > 0) {
+            uint32_t take = piece_len(off, len);
+            /* adjacent blocks on different devices or stripe units stay separate I/Os */
+            if (nios > 0 && out[nios - 1].off + out[nios - 1].len == off &&
+                target_contiguous(out[nios - 1].off, out[nios - 1].len + take)) {
+                out[nios - 1].len += take;
+            } else {
+                out[nios].off = off;
+                out[nios].len = take;
+                out[nios].buf_off = buf_off;
+                nios++;
+            }
+            off += take;
+            len -= take;
+            buf_off += take;
+        }
+    }
+    return nios;
+}
+
+int plan_batch(struct batch_plan *plan, const int64_t *srcs, const int64_t *dsts,
+               const uint32_t *lens, uint32_t count, uint32_t block_size,
+               uint32_t max_group_bytes) {
+    if (reserve(plan, count) != 0) return -1;
+
+    plan->ngroups = 0;
+    plan->nios = 0;
+    plan->nedges = 0;
+
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t n = 1;
+        uint32_t first_len = len_of(lens, i, block_size);
+        uint64_t bytes = first_len;
+        /* I/Os the group needs at most, before merging */
+        uint32_t ios = count_pieces(srcs[i], first_len) + count_pieces(dsts[i], first_len);
+
+        while (i + n < count && n < PLAN_MAX_COPIES) {
+            uint32_t k = i + n;
+            uint32_t len = len_of(lens, k, block_size);
+            if (bytes + len > max_group_bytes) break;
+            uint32_t more = count_pieces(srcs[k], len) + count_pieces(dsts[k], len);
+            if (ios + more > PLAN_MAX_IOS) break;
+
+            uint32_t prev = len_of(lens, k - 1, block_size);
+            int adjacent = srcs[k] == srcs[k - 1] + prev ||
+                           dsts[k] == dsts[k - 1] + prev;
+            if (!adjacent) break;
+
+            /* reads go first, so copy k must not read what the group writes */
+            int hazard = 0;
+            for (uint32_t j = i; j < k && !hazard; j++)
+                hazard = overlaps(srcs[k], len, dsts[j], len_of(lens, j, block_size));
+            if (hazard) break;
+
+            bytes += len;
+            ios += more;
+            n++;
+        }
+        if (reserve_ios(plan, plan->nios + ios) != 0) return -1;
+
+        struct plan_group *g = &plan->groups[plan->ngroups++];
+        g->first = i;
+        g->count = n;
+        g->bytes = (uint32_t)bytes;
+
+        g->read_first = plan->nios;
+        g->nreads = emit_ios(&plan->ios[plan->nios], srcs, lens, i, n, block_size);
+        plan->nios += g->nreads;
+
+        g->write_first = plan->nios;
+        g->nwrites = emit_ios(&plan->ios[plan->nios], dsts, lens, i, n, block_size);
+        plan->nios += g->nwrites;
+
+        i += n;
+    }
+    return 0;
+}
+
+/* In-place quicksort by offset; qsort's indirect compares dominate plan_deps otherwise */
+static void sort_ivals(struct plan_ival *v, uint32_t n) {
+    while (n > 16) {
+        int64_t pivot = v[n / 2].off;
+        uint32_t i = 0, j = n - 1;
+        for (;;) {
+            while (v[i].off < pivot) i++;
+            while (v[j].off > pivot) j--;
+            if (i >= j) break;
+            struct plan_ival t = v[i];
+            v[i++] = v[j];
+            v[j--] = t;
+        }
+        /* recurse into the smaller half, loop on the larger */
+        if (j + 1 < n - j - 1) {
+            sort_ivals(v, j + 1);
+            v += j + 1;
+            n -= j + 1;
+        } else {
+            sort_ivals(v + j + 1, n - j - 1);
+            n = j + 1;
+        }
+    }
+    for (uint32_t i = 1; i < n; i++) {
+        struct plan_ival t = v[i];
+        uint32_t j = i;
+        while (j > 0 && v[j - 1].off > t.off) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = t;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int add_edge(struct batch_plan *plan, uint32_t from, uint32_t to) {
+    if (plan->nedges == plan->edge_cap) {
+        uint32_t cap = plan->edge_cap ? 2 * plan->edge_cap : 1024;
+        uint64_t *e = realloc(plan->edges, cap * sizeof(*e));
+        if (!e) return -1;
+        plan->edges = e;
+        uint32_t *sc = realloc(plan->succ, cap * sizeof(*sc));
+        if (!sc) return -1;
+        plan->succ = sc;
+        plan->edge_cap = cap;
+    }
+    plan->edges[plan->nedges++] = (uint64_t)from << 32 | to;
+    return 0;
+}
+
+int plan_deps(struct batch_plan *plan) {
+    uint32_t n = plan->ngroups;
+
+    /* every I/O as an interval tagged with its group, sorted by offset */
+    for (uint32_t g = 0; g < n; g++) {
+        const struct plan_group *gr = &plan->groups[g];
+        for (uint32_t k = 0; k < gr->nreads + gr->nwrites; k++) {
+            uint32_t idx = gr->read_first + k;     /* writes follow reads in ios */
+            struct plan_ival *iv = &plan->ivals[idx];
+            iv->off = plan->ios[idx].off;
+            iv->end = plan->ios[idx].off + plan->ios[idx].len;
+            iv->group = g;
+            iv->is_write = k >= gr->nreads;
+        }
+    }
+    sort_ivals(plan->ivals, plan->nios);
+
+    /*
+     * Sweep: intervals still open when the next one starts overlap it.
+     * Two overlapping I/Os of different groups order those groups unless
+     * both are reads.
+     */
+    plan->nedges = 0;
+    uint32_t nactive = 0;
+    for (uint32_t i = 0; i < plan->nios; i++) {
+        const struct plan_ival *x = &plan->ivals[i];
+
+        uint32_t keep = 0;
+        for (uint32_t a = 0; a < nactive; a++) {
+            const struct plan_ival *y = &plan->ivals[plan->active[a]];
+            if (y->end <= x->off) continue;
+            plan->active[keep++] = plan->active[a];
+
+            if (y->group == x->group || !(x->is_write || y->is_write)) continue;
+            uint32_t from = x->group < y->group ? x->group : y->group;
+            uint32_t to = x->group < y->group ? y->group : x->group;
+            if (add_edge(plan, from, to) != 0) return -1;
+        }
+        nactive = keep;
+        plan->active[nactive++] = i;
+    }
+
+    /* drop duplicate edges, then bucket by source (successors in order) */
+    qsort(plan->edges, plan->nedges, sizeof(*plan->edges), cmp_u64);
+    uint32_t m = 0;
+    for (uint32_t e = 0; e < plan->nedges; e++)
+        if (m == 0 || plan->edges[e] != plan->edges[m - 1]) plan->edges[m++] = plan->edges[e];
+    plan->nedges = m;
+
+    for (uint32_t g = 0; g < n; g++) {
+        plan->ndeps[g] = 0;
+        plan->succ_first[g] = 0;
+    }
+    plan->succ_first[n] = 0;
+    for (uint32_t e = 0; e < m; e++) {
+        plan->succ_first[(uint32_t)(plan->edges[e] >> 32) + 1]++;
+        plan->ndeps[(uint32_t)plan->edges[e]]++;
+        plan->succ[e] = (uint32_t)plan->edges[e];
+    }
+    for (uint32_t g = 0; g < n; g++) plan->succ_first[g + 1] += plan->succ_first[g];
+    return 0;
+}
+
+int plan_order_by_offset(const struct batch_plan *plan, uint32_t *order) {
+    /* ivals has room for every I/O, so also for one key per group */
+    for (uint32_t g = 0; g < plan->ngroups; g++) {
+        plan->ivals[g].off = plan->ios[plan->groups[g].read_first].off;
+        plan->ivals[g].group = g;
+    }
+    sort_ivals(plan->ivals, plan->ngroups);
+    for (uint32_t g = 0; g < plan->ngroups; g++) order[g] = plan->ivals[g].group;
+    return 0;
+}
+
+void plan_free(struct batch_plan *plan) {
+    free(plan->groups);
+    free(plan->ios);
+    free(plan->ndeps);
+    free(plan->succ_first);
+    free(plan->succ);
+    free(plan->ivals);
+    free(plan->active);
+    free(plan->edges);
+    memset(plan, 0, sizeof(*plan));
+}
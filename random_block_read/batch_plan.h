@@ -0,0 +1,98 @@
+#ifndef BATCH_PLAN_H
+#define BATCH_PLAN_H
+
+#include <stdint.h>
+
+/* Copies per group; keeps a group's I/O chain well inside one io_uring SQ */
+#define PLAN_MAX_COPIES 64
+
+/* Device I/Os per group; only a lone copy split into more pieces exceeds it */
+#define PLAN_MAX_IOS (2 * PLAN_MAX_COPIES)
+
+/* One device I/O of a group: `len` bytes at `off`, at `buf_off` in the group buffer */
+struct plan_io {
+    int64_t off;
+    uint32_t len;
+    uint32_t buf_off;
+};
+
+/*
+ * A run of consecutive copies executed as "all reads, then all writes"
+ * through one buffer laid out in copy order. Copies whose sources (or
+ * destinations) follow each other on the device collapse into a single
+ * read (or write); a copy crossing a device or stripe unit boundary is cut
+ * into one I/O per device piece, so every I/O lies on a single device.
+ */
+struct plan_group {
+    uint32_t first;         /* first copy of the batch in this group */
+    uint32_t count;         /* number of copies */
+    uint32_t bytes;         /* group buffer size */
+    uint32_t read_first;    /* reads are ios[read_first .. read_first + nreads) */
+    uint32_t nreads;
+    uint32_t write_first;   /* writes are ios[write_first .. write_first + nwrites) */
+    uint32_t nwrites;
+};
+
+struct plan_ival;
+
+struct batch_plan {
+    struct plan_group *groups;
+    uint32_t ngroups;
+    struct plan_io *ios;
+    uint32_t nios;
+    uint32_t cap;           /* allocated copies (per-group arrays) */
+    uint32_t io_cap;        /* allocated I/Os (ios, ivals, active) */
+
+    /* Dependency graph over groups, filled in by plan_deps() */
+    uint32_t *ndeps;        /* predecessors of each group */
+    uint32_t *succ_first;   /* successors of g: succ[succ_first[g] .. succ_first[g + 1]) */
+    uint32_t *succ;
+    uint32_t nedges;
+    uint32_t edge_cap;
+    struct plan_ival *ivals;    /* scratch for plan_deps: I/Os sorted by offset */
+    uint32_t *active;
+    uint64_t *edges;            /* scratch: from << 32 | to, before bucketing */
+};
+
+/*
+ * Split a batch into groups of at most max_group_bytes (and at most
+ * PLAN_MAX_COPIES copies and PLAN_MAX_IOS I/Os). A copy joins the
+ * current group only if its source or destination is adjacent to the
+ * previous copy's and it does not read anything an earlier copy of the
+ * group writes, so the result matches serial pread/pwrite order.
+ * Copy i moves lens[i] bytes, or block_size bytes for every copy when
+ * lens is NULL.
+ * max_group_bytes <= block_size disables merging (one group per copy).
+ * Returns 0, or -1 on allocation failure.
+ */
+int plan_batch(struct batch_plan *plan, const int64_t *srcs, const int64_t *dsts,
+               const uint32_t *lens, uint32_t count, uint32_t block_size,
+               uint32_t max_group_bytes);
+
+/*
+ * Build the dependency graph of a planned batch: group k depends on an
+ * earlier group j if k reads what j writes (RAW), writes what j reads
+ * (WAR) or writes what j writes (WAW). Issuing a group only once all its
+ * predecessors have finished gives the same bytes as the serial order,
+ * while independent groups may run concurrently.
+ * Returns 0, or -1 on allocation failure.
+ */
+int plan_deps(struct batch_plan *plan);
+
+/* Fill order[0 .. ngroups) with the groups sorted by the offset of their first read */
+int plan_order_by_offset(const struct batch_plan *plan, uint32_t *order);
+
+void plan_free(struct batch_plan *plan);
+
+/* Device reads / writes the plan issues */
+static inline uint32_t plan_reads(const struct batch_plan *plan) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < plan->ngroups; i++) n += plan->groups[i].nreads;
+    return n;
+}
+
+static inline uint32_t plan_writes(const struct batch_plan *plan) {
+    return plan->nios - plan_reads(plan);
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include "batch_sched.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum { WAITING, READY, AVAIL, ISSUED };
+
+static int reserve(struct batch_sched *s, uint32_t n) {
+    if (s->cap >= n) return 0;
+
+    uint32_t *o = realloc(s->order, n * sizeof(*o));
+    if (!o) return -1;
+    s->order = o;
+    uint32_t *r = realloc(s->rank, n * sizeof(*r));
+    if (!r) return -1;
+    s->rank = r;
+    uint32_t *w = realloc(s->waiting, n * sizeof(*w));
+    if (!w) return -1;
+    s->waiting = w;
+    uint8_t *st = realloc(s->state, n);
+    if (!st) return -1;
+    s->state = st;
+    uint64_t *av = realloc(s->avail, (n + 63) / 64 * sizeof(*av));
+    if (!av) return -1;
+    s->avail = av;
+
+    s->cap = n;
+    return 0;
+}
+
+static inline int in_window(const struct batch_sched *s, uint32_t g) {
+    return s->window == 0 || g < s->lo + s->window;
+}
+
+static void make_ready(struct batch_sched *s, uint32_t g) {
+    if (!in_window(s, g)) {
+        s->state[g] = READY;
+        return;
+    }
+    uint32_t r = s->rank[g];
+    s->avail[r / 64] |= 1ull << (r % 64);
+    s->state[g] = AVAIL;
+}
+
+int batch_sched_start(struct batch_sched *s, const struct batch_plan *plan, int policy,
+                      uint32_t window) {
+    uint32_t n = plan->ngroups;
+    if (reserve(s, n ? n : 1) != 0) return -1;
+
+    s->plan = plan;
+    s->policy = policy;
+    s->window = policy == ORDER_SORTED ? window : 0;
+    s->head = 0;
+    s->lo = 0;
+    s->last_end = -1;
+    s->seek_bytes = 0;
+
+    if (policy == ORDER_SORTED) {
+        if (plan_order_by_offset(plan, s->order) != 0) return -1;
+    } else {
+        for (uint32_t g = 0; g < n; g++) s->order[g] = g;
+    }
+    for (uint32_t r = 0; r < n; r++) s->rank[s->order[r]] = r;
+
+    memset(s->avail, 0, (n + 63) / 64 * sizeof(*s->avail));
+    for (uint32_t g = 0; g < n; g++) {
+        s->waiting[g] = plan->ndeps[g];
+        s->state[g] = WAITING;
+        if (s->waiting[g] == 0) make_ready(s, g);
+    }
+    return 0;
+}
+
+/* First set bit at rank >= from, or -1 */
+static int64_t next_avail(const struct batch_sched *s, uint32_t from) {
+    uint32_t nwords = (s->plan->ngroups + 63) / 64;
+    uint32_t w = from / 64;
+    if (w >= nwords) return -1;
+
+    uint64_t bits = s->avail[w] & (~0ull << (from % 64));
+    for (;;) {
+        if (bits) return (int64_t)w * 64 + __builtin_ctzll(bits);
+        if (++w == nwords) return -1;
+        bits = s->avail[w];
+    }
+}
+
+int64_t batch_sched_peek(const struct batch_sched *s) {
+    /* FIFO never moves its head, so it always takes the lowest ready group */
+    int64_t r = next_avail(s, s->head);
+    if (r < 0 && s->head > 0) r = next_avail(s, 0);    /* C-SCAN: wrap around */
+    return r < 0 ? -1 : (int64_t)s->order[r];
+}
+
+static inline uint64_t dist(int64_t a, int64_t b) {
+    return a > b ? (uint64_t)(a - b) : (uint64_t)(b - a);
+}
+
+/* Seeks of one group issued after last_end (reads, then writes) */
+static uint64_t group_seeks(const struct batch_plan *plan, uint32_t g, int64_t *last_end) {
+    const struct plan_group *gr = &plan->groups[g];
+    uint64_t sum = 0;
+    for (uint32_t k = 0; k < gr->nreads + gr->nwrites; k++) {
+        const struct plan_io *io = &plan->ios[gr->read_first + k];   /* writes follow reads */
+        if (*last_end >= 0) sum += dist(io->off, *last_end);
+        *last_end = io->off + io->len;
+    }
+    return sum;
+}
+
+void batch_sched_issue(struct batch_sched *s, uint32_t g) {
+    uint32_t r = s->rank[g];
+    s->avail[r / 64] &= ~(1ull << (r % 64));
+    s->state[g] = ISSUED;
+    if (s->policy == ORDER_SORTED) s->head = r + 1;
+
+    s->seek_bytes += group_seeks(s->plan, g, &s->last_end);
+
+    /* slide the window past issued groups and admit what it now covers */
+    uint32_t n = s->plan->ngroups;
+    uint32_t old_lo = s->lo;
+    while (s->lo < n && s->state[s->lo] == ISSUED) s->lo++;
+    if (s->window && s->lo != old_lo) {
+        uint32_t from = old_lo + s->window;
+        uint32_t to = s->lo + s->window < n ? s->lo + s->window : n;
+        for (uint32_t k = from; k < to; k++)
+            if (s->state[k] == READY) make_ready(s, k);
+    }
+}
+
+void batch_sched_done(struct batch_sched *s, uint32_t g) {
+    const struct batch_plan *plan = s->plan;
+    for (uint32_t e = plan->succ_first[g]; e < plan->succ_first[g + 1]; e++)
+        if (--s->waiting[plan->succ[e]] == 0) make_ready(s, plan->succ[e]);
+}
+
+uint64_t plan_seek_bytes(const struct batch_plan *plan) {
+    int64_t last_end = -1;
+    uint64_t sum = 0;
+    for (uint32_t g = 0; g < plan->ngroups; g++) sum += group_seeks(plan, g, &last_end);
+    return sum;
+}
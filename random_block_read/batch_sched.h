@@ -0,0 +1,51 @@
+#ifndef BATCH_SCHED_H
+#define BATCH_SCHED_H
+
+#include "batch_plan.h"
+#include <stdint.h>
+
+enum issue_order {
+    ORDER_FIFO,     /* lowest ready group of the batch first */
+    ORDER_SORTED,   /* elevator (C-SCAN) over the ready groups' device offsets */
+};
+
+/*
+ * Picks the order in which the ready groups of a planned batch are issued.
+ * A group is ready once plan_deps() says all its predecessors are done, so
+ * any policy keeps serial semantics. With ORDER_SORTED and a window of N,
+ * only the N oldest unissued groups compete, bounding how far a group can
+ * be overtaken.
+ */
+struct batch_sched {
+    const struct batch_plan *plan;
+    int policy;
+    uint32_t window;        /* 0: whole batch */
+    uint32_t *order;        /* rank -> group */
+    uint32_t *rank;         /* group -> rank */
+    uint32_t *waiting;      /* unfinished predecessors per group */
+    uint8_t *state;
+    uint64_t *avail;        /* bitmap over ranks: ready and inside the window */
+    uint32_t head;          /* rank the elevator resumes from */
+    uint32_t lo;            /* lowest group not yet issued */
+    uint32_t cap;
+    int64_t last_end;       /* end of the last issued I/O, -1 before the first */
+    uint64_t seek_bytes;    /* sum of |offset - previous end| in issue order */
+};
+
+/* Reset for a plan whose dependency graph is built; returns 0 or -1 (ENOMEM) */
+int batch_sched_start(struct batch_sched *s, const struct batch_plan *plan, int policy,
+                      uint32_t window);
+
+/* Next group to issue, or -1 if none is ready */
+int64_t batch_sched_peek(const struct batch_sched *s);
+
+/* Take group g (from batch_sched_peek) and account its seeks */
+void batch_sched_issue(struct batch_sched *s, uint32_t g);
+
+/* Group g finished; its successors may become ready */
+void batch_sched_done(struct batch_sched *s, uint32_t g);
+
+/* Seek distance of issuing the plan in batch order, for comparison */
+uint64_t plan_seek_bytes(const struct batch_plan *plan);
+
+#endif
@@ -0,0 +1,357 @@
+#include "block_cache.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NIL UINT32_MAX
+
+enum { FREE, FILLING, STALE, VALID };
+enum { NO_LIST, A1IN, AM };
+
+struct frame {
+    int64_t key;            /* page number (offset / BLOCK_CACHE_PAGE) */
+    uint64_t token;         /* fill that reserved the frame */
+    uint32_t hnext;         /* hash chain */
+    uint32_t prev, next;    /* position in A1in / Am, or the free list */
+    uint8_t state;
+    uint8_t list;
+};
+
+struct ghost {
+    int64_t key;
+    uint32_t hnext;
+    uint8_t used;
+};
+
+struct lru {
+    uint32_t head, tail, len;
+};
+
+/*
+ * 2Q: new pages enter A1in (FIFO). Pages evicted from A1in leave their key
+ * in the A1out ghost list; a page missed again while its ghost is there
+ * goes to Am (LRU). One-off scans therefore only churn A1in.
+ */
+struct shard {
+    pthread_mutex_t lock;
+    struct frame *frames;
+    char *data;
+    uint32_t nframes;
+    uint32_t *buckets;
+    uint32_t bucket_mask;
+    uint32_t free_head;
+    struct lru a1in, am;
+    uint32_t kin;           /* A1in target size */
+
+    struct ghost *ghosts;   /* A1out, a ring of kout keys */
+    uint32_t *gbuckets;
+    uint32_t kout;
+    uint32_t gpos;          /* next ring slot to (re)use */
+
+    uint64_t evictions, updates, stale_fills, resident;
+} __attribute__((aligned(64)));
+
+static int block_cache_on = 0;
+static struct shard shards[BLOCK_CACHE_SHARDS];
+static _Atomic uint64_t next_token = 0;
+static _Atomic uint64_t hits = 0;       /* counted per range, in pages */
+static _Atomic uint64_t misses = 0;
+
+static inline uint64_t mix(int64_t key) {
+    uint64_t x = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+    return x ^ (x >> 29);
+}
+
+static inline struct shard *shard_of(int64_t key) {
+    return &shards[mix(key) & (BLOCK_CACHE_SHARDS - 1)];
+}
+
+static inline uint32_t bucket_of(const struct shard *sh, int64_t key) {
+    return (uint32_t)(mix(key) >> 8) & sh->bucket_mask;
+}
+
+/* --- hash of resident frames --- */
+
+static uint32_t find(const struct shard *sh, int64_t key) {
+    for (uint32_t i = sh->buckets[bucket_of(sh, key)]; i != NIL; i = sh->frames[i].hnext)
+        if (sh->frames[i].key == key) return i;
+    return NIL;
+}
+
+static void hash_remove(struct shard *sh, uint32_t i) {
+    uint32_t *p = &sh->buckets[bucket_of(sh, sh->frames[i].key)];
+    while (*p != i) p = &sh->frames[*p].hnext;
+    *p = sh->frames[i].hnext;
+}
+
+/* --- A1in / Am lists --- */
+
+static struct lru *list_of(struct shard *sh, uint32_t i) {
+    return sh->frames[i].list == A1IN ? &sh->a1in : &sh->am;
+}
+
+static void unlink_frame(struct shard *sh, uint32_t i) {
+    struct frame *f = &sh->frames[i];
+    if (f->list == NO_LIST) return;
+    struct lru *l = list_of(sh, i);
+    if (f->prev != NIL) sh->frames[f->prev].next = f->next;
+    else l->head = f->next;
+    if (f->next != NIL) sh->frames[f->next].prev = f->prev;
+    else l->tail = f->prev;
+    l->len--;
+    f->list = NO_LIST;
+}
+
+static void push_front(struct shard *sh, int which, uint32_t i) {
+    struct lru *l = which == A1IN ? &sh->a1in : &sh->am;
+    struct frame *f = &sh->frames[i];
+    f->list = (uint8_t)which;
+    f->prev = NIL;
+    f->next = l->head;
+    if (l->head != NIL) sh->frames[l->head].prev = i;
+    else l->tail = i;
+    l->head = i;
+    l->len++;
+}
+
+/* --- A1out ghosts --- */
+
+static uint32_t ghost_find(const struct shard *sh, int64_t key) {
+    uint32_t b = (uint32_t)(mix(key) >> 8) & (sh->kout * 2 - 1);
+    for (uint32_t i = sh->gbuckets[b]; i != NIL; i = sh->ghosts[i].hnext)
+        if (sh->ghosts[i].key == key) return i;
+    return NIL;
+}
+
+static void ghost_remove(struct shard *sh, uint32_t g) {
+    uint32_t b = (uint32_t)(mix(sh->ghosts[g].key) >> 8) & (sh->kout * 2 - 1);
+    uint32_t *p = &sh->gbuckets[b];
+    while (*p != g) p = &sh->ghosts[*p].hnext;
+    *p = sh->ghosts[g].hnext;
+    sh->ghosts[g].used = 0;
+}
+
+static void ghost_add(struct shard *sh, int64_t key) {
+    uint32_t g = sh->gpos;
+    sh->gpos = (sh->gpos + 1) % sh->kout;
+    if (sh->ghosts[g].used) ghost_remove(sh, g);    /* oldest ghost falls off */
+
+    uint32_t b = (uint32_t)(mix(key) >> 8) & (sh->kout * 2 - 1);
+    sh->ghosts[g].key = key;
+    sh->ghosts[g].hnext = sh->gbuckets[b];
+    sh->ghosts[g].used = 1;
+    sh->gbuckets[b] = g;
+}
+
+/* --- frames --- */
+
+static void release(struct shard *sh, uint32_t i) {
+    unlink_frame(sh, i);
+    hash_remove(sh, i);
+    sh->frames[i].state = FREE;
+    sh->frames[i].next = sh->free_head;
+    sh->free_head = i;
+    sh->resident--;
+}
+
+static uint32_t alloc_frame(struct shard *sh) {
+    if (sh->free_head == NIL) {
+        /* reclaim from A1in while it is over target, else from the cold end of Am */
+        int from_a1in = sh->a1in.len > sh->kin || sh->am.len == 0;
+        uint32_t victim = from_a1in ? sh->a1in.tail : sh->am.tail;
+        if (from_a1in) ghost_add(sh, sh->frames[victim].key);
+        release(sh, victim);
+        sh->evictions++;
+    }
+
+    uint32_t i = sh->free_head;
+    sh->free_head = sh->frames[i].next;
+    sh->resident++;
+    return i;
+}
+
+static int shard_init(struct shard *sh, uint32_t nframes) {
+    pthread_mutex_init(&sh->lock, NULL);
+    sh->nframes = nframes;
+    sh->kin = nframes / 4 ? nframes / 4 : 1;
+    sh->kout = 1;
+    while (sh->kout < nframes / 2) sh->kout <<= 1;
+
+    uint32_t nbuckets = 1;
+    while (nbuckets < nframes) nbuckets <<= 1;
+    sh->bucket_mask = nbuckets - 1;
+
+    sh->frames = calloc(nframes, sizeof(*sh->frames));
+    sh->buckets = malloc(nbuckets * sizeof(*sh->buckets));
+    sh->ghosts = calloc(sh->kout, sizeof(*sh->ghosts));
+    sh->gbuckets = malloc(sh->kout * 2 * sizeof(*sh->gbuckets));
+    if (!sh->frames || !sh->buckets || !sh->ghosts || !sh->gbuckets) return -1;
+    if (posix_memalign((void **)&sh->data, BLOCK_CACHE_PAGE,
+                       (size_t)nframes * BLOCK_CACHE_PAGE) != 0)
+        return -1;
+
+    for (uint32_t i = 0; i < nbuckets; i++) sh->buckets[i] = NIL;
+    for (uint32_t i = 0; i < sh->kout * 2; i++) sh->gbuckets[i] = NIL;
+    for (uint32_t i = 0; i < nframes; i++) sh->frames[i].next = i + 1 < nframes ? i + 1 : NIL;
+    sh->free_head = 0;
+    sh->a1in = (struct lru){NIL, NIL, 0};
+    sh->am = (struct lru){NIL, NIL, 0};
+    return 0;
+}
+
+int block_cache_init(size_t bytes) {
+    if (bytes == 0) return 0;
+
+    size_t per_shard = bytes / BLOCK_CACHE_PAGE / BLOCK_CACHE_SHARDS;
+    if (per_shard < 4) {
+        fprintf(stderr, "block cache: budget below %d KiB\n",
+                4 * BLOCK_CACHE_SHARDS * BLOCK_CACHE_PAGE / 1024);
+        return -1;
+    }
+    for (int s = 0; s < BLOCK_CACHE_SHARDS; s++)
+        if (shard_init(&shards[s], (uint32_t)per_shard) != 0) {
+            perror("block cache");
+            return -1;
+        }
+    block_cache_on = 1;
+    return 0;
+}
+
+static inline int aligned(int64_t off, uint32_t len) {
+    return off % BLOCK_CACHE_PAGE == 0 && len % BLOCK_CACHE_PAGE == 0 && len > 0;
+}
+
+static inline char *page_data(struct shard *sh, uint32_t i) {
+    return sh->data + (size_t)i * BLOCK_CACHE_PAGE;
+}
+
+int block_cache_read(int64_t off, uint32_t len, void *dst) {
+    if (!block_cache_on || !aligned(off, len)) return 0;
+
+    int64_t first = off / BLOCK_CACHE_PAGE;
+    uint32_t npages = len / BLOCK_CACHE_PAGE;
+    for (uint32_t p = 0; p < npages; p++) {
+        struct shard *sh = shard_of(first + p);
+        pthread_mutex_lock(&sh->lock);
+        uint32_t i = find(sh, first + p);
+        if (i == NIL || sh->frames[i].state != VALID) {
+            pthread_mutex_unlock(&sh->lock);
+            atomic_fetch_add_explicit(&misses, npages, memory_order_relaxed);
+            return 0;
+        }
+        memcpy((char *)dst + (size_t)p * BLOCK_CACHE_PAGE, page_data(sh, i), BLOCK_CACHE_PAGE);
+        if (sh->frames[i].list == AM) {
+            unlink_frame(sh, i);
+            push_front(sh, AM, i);
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+    atomic_fetch_add_explicit(&hits, npages, memory_order_relaxed);
+    return 1;
+}
+
+uint64_t block_cache_fill_begin(int64_t off, uint32_t len) {
+    if (!block_cache_on || !aligned(off, len)) return 0;
+
+    uint64_t token = atomic_fetch_add_explicit(&next_token, 1, memory_order_relaxed) + 1;
+    int64_t first = off / BLOCK_CACHE_PAGE;
+    for (uint32_t p = 0; p < len / BLOCK_CACHE_PAGE; p++) {
+        int64_t key = first + p;
+        struct shard *sh = shard_of(key);
+        pthread_mutex_lock(&sh->lock);
+        if (find(sh, key) == NIL) {
+            /* drop the ghost first: alloc_frame may recycle its ring slot */
+            uint32_t g = ghost_find(sh, key);
+            if (g != NIL) ghost_remove(sh, g);
+            uint32_t i = alloc_frame(sh);
+            struct frame *f = &sh->frames[i];
+            f->key = key;
+            f->token = token;
+            f->state = FILLING;
+            f->hnext = sh->buckets[bucket_of(sh, key)];
+            sh->buckets[bucket_of(sh, key)] = i;
+            push_front(sh, g != NIL ? AM : A1IN, i);
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+    return token;
+}
+
+void block_cache_fill_end(int64_t off, uint32_t len, const void *src, int ok, uint64_t token) {
+    if (!block_cache_on || token == 0) return;
+
+    int64_t first = off / BLOCK_CACHE_PAGE;
+    for (uint32_t p = 0; p < len / BLOCK_CACHE_PAGE; p++) {
+        struct shard *sh = shard_of(first + p);
+        pthread_mutex_lock(&sh->lock);
+        uint32_t i = find(sh, first + p);
+        if (i != NIL && sh->frames[i].token == token) {
+            if (sh->frames[i].state == FILLING && ok) {
+                memcpy(page_data(sh, i), (const char *)src + (size_t)p * BLOCK_CACHE_PAGE,
+                       BLOCK_CACHE_PAGE);
+                sh->frames[i].state = VALID;
+            } else if (sh->frames[i].state != VALID) {
+                if (sh->frames[i].state == STALE) sh->stale_fills++;
+                release(sh, i);
+            }
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+void block_cache_write(int64_t off, uint32_t len, const void *src, int ok) {
+    if (!block_cache_on || len == 0) return;
+
+    /* unaligned writes still invalidate every page they touch */
+    int full = ok && aligned(off, len);
+    int64_t first = off / BLOCK_CACHE_PAGE;
+    int64_t last = (off + len - 1) / BLOCK_CACHE_PAGE;
+    for (int64_t key = first; key <= last; key++) {
+        struct shard *sh = shard_of(key);
+        pthread_mutex_lock(&sh->lock);
+        uint32_t i = find(sh, key);
+        if (i != NIL) {
+            struct frame *f = &sh->frames[i];
+            if (f->state == FILLING) {
+                f->state = STALE;
+            } else if (f->state == VALID && full) {
+                memcpy(page_data(sh, i), (const char *)src + (size_t)(key - first) * BLOCK_CACHE_PAGE,
+                       BLOCK_CACHE_PAGE);
+                sh->updates++;
+            } else if (f->state == VALID) {
+                release(sh, i);
+            }
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+void block_cache_get_stats(struct block_cache_stats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!block_cache_on) return;
+    out->hits = atomic_load_explicit(&hits, memory_order_relaxed);
+    out->misses = atomic_load_explicit(&misses, memory_order_relaxed);
+    for (int s = 0; s < BLOCK_CACHE_SHARDS; s++) {
+        struct shard *sh = &shards[s];
+        pthread_mutex_lock(&sh->lock);
+        out->evictions += sh->evictions;
+        out->updates += sh->updates;
+        out->stale_fills += sh->stale_fills;
+        out->resident += sh->resident;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+void block_cache_reset_stats(void) {
+    if (!block_cache_on) return;
+    atomic_store_explicit(&hits, 0, memory_order_relaxed);
+    atomic_store_explicit(&misses, 0, memory_order_relaxed);
+    for (int s = 0; s < BLOCK_CACHE_SHARDS; s++) {
+        struct shard *sh = &shards[s];
+        pthread_mutex_lock(&sh->lock);
+        sh->evictions = sh->updates = sh->stale_fills = 0;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
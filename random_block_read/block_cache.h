@@ -0,0 +1,48 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCK_CACHE_PAGE 4096
+#define BLOCK_CACHE_SHARDS 16
+
+struct block_cache_stats {
+    uint64_t hits;          /* pages served from memory */
+    uint64_t misses;        /* pages read from the device */
+    uint64_t evictions;     /* pages dropped to stay within budget */
+    uint64_t updates;       /* cached pages rewritten by a copy's write */
+    uint64_t stale_fills;   /* device reads discarded because a write raced them */
+    uint64_t resident;      /* pages currently cached */
+};
+
+/*
+ * Scan-resistant (2Q) cache of source pages keyed by device offset, split
+ * into BLOCK_CACHE_SHARDS independently locked shards. `bytes` is the
+ * memory budget; 0 leaves the cache off and every call below a no-op.
+ */
+int block_cache_init(size_t bytes);
+
+/*
+ * Copy [off, off + len) into dst if every page is cached. Returns 1 on a
+ * hit, 0 otherwise (dst may then be partly written). Ranges that are not
+ * page-aligned always miss.
+ */
+int block_cache_read(int64_t off, uint32_t len, void *dst);
+
+/*
+ * Around a device read after a miss: fill_begin reserves the missing pages
+ * and returns a token; fill_end installs the data read (if ok) into the
+ * pages still reserved under that token. A write in between marks them
+ * stale, so a read that raced a write never installs old data.
+ */
+uint64_t block_cache_fill_begin(int64_t off, uint32_t len);
+void block_cache_fill_end(int64_t off, uint32_t len, const void *src, int ok, uint64_t token);
+
+/* After a device write: update cached pages with src, or drop them if !ok */
+void block_cache_write(int64_t off, uint32_t len, const void *src, int ok);
+
+void block_cache_get_stats(struct block_cache_stats *out);
+void block_cache_reset_stats(void);
+
+#endif
@@ -6,102 +6,375 @@
 #ifndef _BLOCKCOPY_RANDOM_H_RPCGEN
 #define _BLOCKCOPY_RANDOM_H_RPCGEN
 
-#define RPCGEN_VERSION	199506
-
 #include <rpc/rpc.h>
 
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define MAX_BATCH 1024
+#define MAX_BATCH2 65536
+#define EXTENT_UPLOAD_CHUNK 16384
+#define PACK_COPY_MAX 30
+#define MAX_DELTA_BYTES 1966080
 
 struct pba_write_params {
-	int64_t pba_src;
-	int64_t pba_dst;
+	quad_t pba_src;
+	quad_t pba_dst;
 	int nbytes;
 };
 typedef struct pba_write_params pba_write_params;
-#ifdef __cplusplus
-extern "C" bool_t xdr_pba_write_params(XDR *, pba_write_params*);
-#elif __STDC__
-extern  bool_t xdr_pba_write_params(XDR *, pba_write_params*);
-#else /* Old Style C */
-bool_t xdr_pba_write_params();
-#endif /* Old Style C */
-
 
 struct pba_batch_params {
-	int64_t pba_srcs[MAX_BATCH];
-	int64_t pba_dsts[MAX_BATCH];
-	uint32 count;
-	uint32 block_size;
+	quad_t pba_srcs[MAX_BATCH];
+	quad_t pba_dsts[MAX_BATCH];
+	u_int count;
+	u_int block_size;
 };
 typedef struct pba_batch_params pba_batch_params;
-#ifdef __cplusplus
-extern "C" bool_t xdr_pba_batch_params(XDR *, pba_batch_params*);
-#elif __STDC__
-extern  bool_t xdr_pba_batch_params(XDR *, pba_batch_params*);
-#else /* Old Style C */
-bool_t xdr_pba_batch_params();
-#endif /* Old Style C */
 
+struct pba_seg_batch_params {
+	quad_t pba_srcs[MAX_BATCH];
+	quad_t pba_dsts[MAX_BATCH];
+	u_int lens[MAX_BATCH];
+	u_int count;
+};
+typedef struct pba_seg_batch_params pba_seg_batch_params;
+
+struct extent_rec {
+	quad_t logical;
+	quad_t physical;
+	quad_t len;
+};
+typedef struct extent_rec extent_rec;
+
+struct extent_upload {
+	u_int handle;
+	struct {
+		u_int extents_len;
+		extent_rec *extents_val;
+	} extents;
+};
+typedef struct extent_upload extent_upload;
+
+struct logical_batch_params {
+	u_int handle;
+	struct {
+		u_int srcs_len;
+		quad_t *srcs_val;
+	} srcs;
+	struct {
+		u_int dsts_len;
+		quad_t *dsts_val;
+	} dsts;
+	u_int block_size;
+};
+typedef struct logical_batch_params logical_batch_params;
+
+struct pba_batch2_params {
+	struct {
+		u_int pba_srcs_len;
+		quad_t *pba_srcs_val;
+	} pba_srcs;
+	struct {
+		u_int pba_dsts_len;
+		quad_t *pba_dsts_val;
+	} pba_dsts;
+	u_int block_size;
+};
+typedef struct pba_batch2_params pba_batch2_params;
+
+struct pba_seg_batch2_params {
+	struct {
+		u_int pba_srcs_len;
+		quad_t *pba_srcs_val;
+	} pba_srcs;
+	struct {
+		u_int pba_dsts_len;
+		quad_t *pba_dsts_val;
+	} pba_dsts;
+	struct {
+		u_int lens_len;
+		u_int *lens_val;
+	} lens;
+};
+typedef struct pba_seg_batch2_params pba_seg_batch2_params;
+
+struct logical_batch2_params {
+	u_int handle;
+	struct {
+		u_int srcs_len;
+		quad_t *srcs_val;
+	} srcs;
+	struct {
+		u_int dsts_len;
+		quad_t *dsts_val;
+	} dsts;
+	u_int block_size;
+};
+typedef struct logical_batch2_params logical_batch2_params;
+
+enum batch_encoding {
+	ENC_RUNS = 1,
+	ENC_DELTA = 2,
+};
+typedef enum batch_encoding batch_encoding;
+
+struct copy_run {
+	quad_t src;
+	quad_t dst;
+	u_int count;
+	quad_t stride;
+};
+typedef struct copy_run copy_run;
+
+struct delta_list {
+	u_int shift;
+	struct {
+		u_int bytes_len;
+		char *bytes_val;
+	} bytes;
+};
+typedef struct delta_list delta_list;
+
+struct packed_batch {
+	batch_encoding enc;
+	union {
+		struct {
+			u_int runs_len;
+			copy_run *runs_val;
+		} runs;
+		delta_list deltas;
+	} packed_batch_u;
+};
+typedef struct packed_batch packed_batch;
+
+struct pba_packed_params {
+	u_int count;
+	u_int block_size;
+	packed_batch batch;
+};
+typedef struct pba_packed_params pba_packed_params;
+
+struct async_batch_params {
+	u_quad_t seq;
+	struct {
+		u_int pba_srcs_len;
+		quad_t *pba_srcs_val;
+	} pba_srcs;
+	struct {
+		u_int pba_dsts_len;
+		quad_t *pba_dsts_val;
+	} pba_dsts;
+	struct {
+		u_int lens_len;
+		u_int *lens_val;
+	} lens;
+	u_int block_size;
+};
+typedef struct async_batch_params async_batch_params;
+
+struct barrier_reply {
+	int result;
+	u_quad_t batches;
+	u_quad_t failed_seq;
+};
+typedef struct barrier_reply barrier_reply;
 
 struct get_server_ios {
-	u_int64_t server_read_time;
-	u_int64_t server_write_time;
-	u_int64_t server_other_time;
+	u_quad_t server_read_time;
+	u_quad_t server_write_time;
+	u_quad_t server_other_time;
 };
 typedef struct get_server_ios get_server_ios;
-#ifdef __cplusplus
-extern "C" bool_t xdr_get_server_ios(XDR *, get_server_ios*);
-#elif __STDC__
-extern  bool_t xdr_get_server_ios(XDR *, get_server_ios*);
-#else /* Old Style C */
-bool_t xdr_get_server_ios();
-#endif /* Old Style C */
 
+struct stat_entry {
+	char *name;
+	u_quad_t value;
+};
+typedef struct stat_entry stat_entry;
+
+typedef struct {
+	u_int stat_list_len;
+	stat_entry *stat_list_val;
+} stat_list;
+
+#define BLOCKCOPY_PROG 0x34567890
+#define BLOCKCOPY_VERS 1
+
+#if defined(__STDC__) || defined(__cplusplus)
+#define WRITE_PBA 1
+extern  enum clnt_stat write_pba_1(pba_write_params *, int *, CLIENT *);
+extern  bool_t write_pba_1_svc(pba_write_params *, int *, struct svc_req *);
+#define GET_TIME 2
+extern  enum clnt_stat get_time_1(void *, get_server_ios *, CLIENT *);
+extern  bool_t get_time_1_svc(void *, get_server_ios *, struct svc_req *);
+#define RESET_TIME 3
+extern  enum clnt_stat reset_time_1(void *, void *, CLIENT *);
+extern  bool_t reset_time_1_svc(void *, void *, struct svc_req *);
+#define WRITE_PBA_BATCH 4
+extern  enum clnt_stat write_pba_batch_1(pba_batch_params *, int *, CLIENT *);
+extern  bool_t write_pba_batch_1_svc(pba_batch_params *, int *, struct svc_req *);
+#define GET_STATS 5
+extern  enum clnt_stat get_stats_1(void *, stat_list *, CLIENT *);
+extern  bool_t get_stats_1_svc(void *, stat_list *, struct svc_req *);
+#define WRITE_PBA_SEGS 6
+extern  enum clnt_stat write_pba_segs_1(pba_seg_batch_params *, int *, CLIENT *);
+extern  bool_t write_pba_segs_1_svc(pba_seg_batch_params *, int *, struct svc_req *);
+#define REGISTER_EXTENTS 7
+extern  enum clnt_stat register_extents_1(extent_upload *, u_int *, CLIENT *);
+extern  bool_t register_extents_1_svc(extent_upload *, u_int *, struct svc_req *);
+#define WRITE_LOGICAL_BATCH 8
+extern  enum clnt_stat write_logical_batch_1(logical_batch_params *, int *, CLIENT *);
+extern  bool_t write_logical_batch_1_svc(logical_batch_params *, int *, struct svc_req *);
+#define UNREGISTER_EXTENTS 12
+extern  enum clnt_stat unregister_extents_1(u_int *, int *, CLIENT *);
+extern  bool_t unregister_extents_1_svc(u_int *, int *, struct svc_req *);
+extern int blockcopy_prog_1_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
+
+#else /* K&R C */
+#define WRITE_PBA 1
+extern  enum clnt_stat write_pba_1();
+extern  bool_t write_pba_1_svc();
+#define GET_TIME 2
+extern  enum clnt_stat get_time_1();
+extern  bool_t get_time_1_svc();
+#define RESET_TIME 3
+extern  enum clnt_stat reset_time_1();
+extern  bool_t reset_time_1_svc();
+#define WRITE_PBA_BATCH 4
+extern  enum clnt_stat write_pba_batch_1();
+extern  bool_t write_pba_batch_1_svc();
+#define GET_STATS 5
+extern  enum clnt_stat get_stats_1();
+extern  bool_t get_stats_1_svc();
+#define WRITE_PBA_SEGS 6
+extern  enum clnt_stat write_pba_segs_1();
+extern  bool_t write_pba_segs_1_svc();
+#define REGISTER_EXTENTS 7
+extern  enum clnt_stat register_extents_1();
+extern  bool_t register_extents_1_svc();
+#define WRITE_LOGICAL_BATCH 8
+extern  enum clnt_stat write_logical_batch_1();
+extern  bool_t write_logical_batch_1_svc();
+#define UNREGISTER_EXTENTS 12
+extern  enum clnt_stat unregister_extents_1();
+extern  bool_t unregister_extents_1_svc();
+extern int blockcopy_prog_1_freeresult ();
+#endif /* K&R C */
+#define BLOCKCOPY_VERS2 2
+
+#if defined(__STDC__) || defined(__cplusplus)
+extern  enum clnt_stat write_pba_2(pba_write_params *, int *, CLIENT *);
+extern  bool_t write_pba_2_svc(pba_write_params *, int *, struct svc_req *);
+extern  enum clnt_stat get_time_2(void *, get_server_ios *, CLIENT *);
+extern  bool_t get_time_2_svc(void *, get_server_ios *, struct svc_req *);
+extern  enum clnt_stat reset_time_2(void *, void *, CLIENT *);
+extern  bool_t reset_time_2_svc(void *, void *, struct svc_req *);
+extern  enum clnt_stat write_pba_batch_2(pba_batch2_params *, int *, CLIENT *);
+extern  bool_t write_pba_batch_2_svc(pba_batch2_params *, int *, struct svc_req *);
+extern  enum clnt_stat get_stats_2(void *, stat_list *, CLIENT *);
+extern  bool_t get_stats_2_svc(void *, stat_list *, struct svc_req *);
+extern  enum clnt_stat write_pba_segs_2(pba_seg_batch2_params *, int *, CLIENT *);
+extern  bool_t write_pba_segs_2_svc(pba_seg_batch2_params *, int *, struct svc_req *);
+extern  enum clnt_stat register_extents_2(extent_upload *, u_int *, CLIENT *);
+extern  bool_t register_extents_2_svc(extent_upload *, u_int *, struct svc_req *);
+extern  enum clnt_stat write_logical_batch_2(logical_batch2_params *, int *, CLIENT *);
+extern  bool_t write_logical_batch_2_svc(logical_batch2_params *, int *, struct svc_req *);
+#define WRITE_PBA_PACKED 9
+extern  enum clnt_stat write_pba_packed_2(pba_packed_params *, int *, CLIENT *);
+extern  bool_t write_pba_packed_2_svc(pba_packed_params *, int *, struct svc_req *);
+#define WRITE_PBA_ASYNC 10
+extern  enum clnt_stat write_pba_async_2(async_batch_params *, void *, CLIENT *);
+extern  bool_t write_pba_async_2_svc(async_batch_params *, void *, struct svc_req *);
+#define BARRIER 11
+extern  enum clnt_stat barrier_2(void *, barrier_reply *, CLIENT *);
+extern  bool_t barrier_2_svc(void *, barrier_reply *, struct svc_req *);
+extern  enum clnt_stat unregister_extents_2(u_int *, int *, CLIENT *);
+extern  bool_t unregister_extents_2_svc(u_int *, int *, struct svc_req *);
+extern int blockcopy_prog_2_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
+
+#else /* K&R C */
+extern  enum clnt_stat write_pba_2();
+extern  bool_t write_pba_2_svc();
+extern  enum clnt_stat get_time_2();
+extern  bool_t get_time_2_svc();
+extern  enum clnt_stat reset_time_2();
+extern  bool_t reset_time_2_svc();
+extern  enum clnt_stat write_pba_batch_2();
+extern  bool_t write_pba_batch_2_svc();
+extern  enum clnt_stat get_stats_2();
+extern  bool_t get_stats_2_svc();
+extern  enum clnt_stat write_pba_segs_2();
+extern  bool_t write_pba_segs_2_svc();
+extern  enum clnt_stat register_extents_2();
+extern  bool_t register_extents_2_svc();
+extern  enum clnt_stat write_logical_batch_2();
+extern  bool_t write_logical_batch_2_svc();
+#define WRITE_PBA_PACKED 9
+extern  enum clnt_stat write_pba_packed_2();
+extern  bool_t write_pba_packed_2_svc();
+#define WRITE_PBA_ASYNC 10
+extern  enum clnt_stat write_pba_async_2();
+extern  bool_t write_pba_async_2_svc();
+#define BARRIER 11
+extern  enum clnt_stat barrier_2();
+extern  bool_t barrier_2_svc();
+extern  enum clnt_stat unregister_extents_2();
+extern  bool_t unregister_extents_2_svc();
+extern int blockcopy_prog_2_freeresult ();
+#endif /* K&R C */
+
+/* the xdr functions */
+
+#if defined(__STDC__) || defined(__cplusplus)
+extern  bool_t xdr_pba_write_params (XDR *, pba_write_params*);
+extern  bool_t xdr_pba_batch_params (XDR *, pba_batch_params*);
+extern  bool_t xdr_pba_seg_batch_params (XDR *, pba_seg_batch_params*);
+extern  bool_t xdr_extent_rec (XDR *, extent_rec*);
+extern  bool_t xdr_extent_upload (XDR *, extent_upload*);
+extern  bool_t xdr_logical_batch_params (XDR *, logical_batch_params*);
+extern  bool_t xdr_pba_batch2_params (XDR *, pba_batch2_params*);
+extern  bool_t xdr_pba_seg_batch2_params (XDR *, pba_seg_batch2_params*);
+extern  bool_t xdr_logical_batch2_params (XDR *, logical_batch2_params*);
+extern  bool_t xdr_batch_encoding (XDR *, batch_encoding*);
+extern  bool_t xdr_copy_run (XDR *, copy_run*);
+extern  bool_t xdr_delta_list (XDR *, delta_list*);
+extern  bool_t xdr_packed_batch (XDR *, packed_batch*);
+extern  bool_t xdr_pba_packed_params (XDR *, pba_packed_params*);
+extern  bool_t xdr_async_batch_params (XDR *, async_batch_params*);
+extern  bool_t xdr_barrier_reply (XDR *, barrier_reply*);
+extern  bool_t xdr_get_server_ios (XDR *, get_server_ios*);
+extern  bool_t xdr_stat_entry (XDR *, stat_entry*);
+extern  bool_t xdr_stat_list (XDR *, stat_list*);
+
+#else /* K&R C */
+extern bool_t xdr_pba_write_params ();
+extern bool_t xdr_pba_batch_params ();
+extern bool_t xdr_pba_seg_batch_params ();
+extern bool_t xdr_extent_rec ();
+extern bool_t xdr_extent_upload ();
+extern bool_t xdr_logical_batch_params ();
+extern bool_t xdr_pba_batch2_params ();
+extern bool_t xdr_pba_seg_batch2_params ();
+extern bool_t xdr_logical_batch2_params ();
+extern bool_t xdr_batch_encoding ();
+extern bool_t xdr_copy_run ();
+extern bool_t xdr_delta_list ();
+extern bool_t xdr_packed_batch ();
+extern bool_t xdr_pba_packed_params ();
+extern bool_t xdr_async_batch_params ();
+extern bool_t xdr_barrier_reply ();
+extern bool_t xdr_get_server_ios ();
+extern bool_t xdr_stat_entry ();
+extern bool_t xdr_stat_list ();
 
-#define BLOCKCOPY_PROG ((rpc_uint)0x34567890)
-#define BLOCKCOPY_VERS ((rpc_uint)1)
+#endif /* K&R C */
 
 #ifdef __cplusplus
-#define WRITE_PBA ((rpc_uint)1)
-extern "C" int * write_pba_1(pba_write_params *, CLIENT *);
-extern "C" int * write_pba_1_svc(pba_write_params *, struct svc_req *);
-#define GET_TIME ((rpc_uint)2)
-extern "C" get_server_ios * get_time_1(void *, CLIENT *);
-extern "C" get_server_ios * get_time_1_svc(void *, struct svc_req *);
-#define RESET_TIME ((rpc_uint)3)
-extern "C" void * reset_time_1(void *, CLIENT *);
-extern "C" void * reset_time_1_svc(void *, struct svc_req *);
-#define WRITE_PBA_BATCH ((rpc_uint)4)
-extern "C" int * write_pba_batch_1(pba_batch_params *, CLIENT *);
-extern "C" int * write_pba_batch_1_svc(pba_batch_params *, struct svc_req *);
-
-#elif __STDC__
-#define WRITE_PBA ((rpc_uint)1)
-extern  int * write_pba_1(pba_write_params *, CLIENT *);
-extern  int * write_pba_1_svc(pba_write_params *, struct svc_req *);
-#define GET_TIME ((rpc_uint)2)
-extern  get_server_ios * get_time_1(void *, CLIENT *);
-extern  get_server_ios * get_time_1_svc(void *, struct svc_req *);
-#define RESET_TIME ((rpc_uint)3)
-extern  void * reset_time_1(void *, CLIENT *);
-extern  void * reset_time_1_svc(void *, struct svc_req *);
-#define WRITE_PBA_BATCH ((rpc_uint)4)
-extern  int * write_pba_batch_1(pba_batch_params *, CLIENT *);
-extern  int * write_pba_batch_1_svc(pba_batch_params *, struct svc_req *);
-
-#else /* Old Style C */
-#define WRITE_PBA ((rpc_uint)1)
-extern  int * write_pba_1();
-extern  int * write_pba_1_svc();
-#define GET_TIME ((rpc_uint)2)
-extern  get_server_ios * get_time_1();
-extern  get_server_ios * get_time_1_svc();
-#define RESET_TIME ((rpc_uint)3)
-extern  void * reset_time_1();
-extern  void * reset_time_1_svc();
-#define WRITE_PBA_BATCH ((rpc_uint)4)
-extern  int * write_pba_batch_1();
-extern  int * write_pba_batch_1_svc();
-#endif /* Old Style C */
+}
+#endif
 
 #endif /* !_BLOCKCOPY_RANDOM_H_RPCGEN */
@@ -1,6 +1,10 @@
 /* blockcopy_random.x - RPC protocol for block copying with physical block addresses */
 
 const MAX_BATCH = 1024;
+const MAX_BATCH2 = 65536;     /* copies per batch in version 2 */
+const EXTENT_UPLOAD_CHUNK = 16384;  /* extents per REGISTER_EXTENTS call */
+const PACK_COPY_MAX = 30;     /* bytes of one copy in ENC_DELTA at most: three 64-bit varints */
+const MAX_DELTA_BYTES = 1966080;  /* MAX_BATCH2 * PACK_COPY_MAX; rpcgen takes no expressions */
 
 /* Single-block copy parameters (old version — KEEP THIS!) */
 struct pba_write_params {
@@ -17,6 +21,120 @@ struct pba_batch_params {
     unsigned int block_size;      /* size of each block */
 };
 
+/* Batched copies of varying length (copies split at extent boundaries) */
+struct pba_seg_batch_params {
+    hyper pba_srcs[MAX_BATCH];   /* array of PBAs */
+    hyper pba_dsts[MAX_BATCH];   /* array of PBAs */
+    unsigned int lens[MAX_BATCH]; /* bytes of each copy */
+    unsigned int count;           /* how many elements are valid */
+};
+
+/* One extent of a file: len bytes at logical offset map to physical */
+struct extent_rec {
+    hyper logical;
+    hyper physical;
+    hyper len;
+};
+
+/*
+ * A chunk of a file's extent map, in logical order. handle 0 starts a new
+ * map; a handle REGISTER_EXTENTS returned appends to that map. The server
+ * holds a few maps at once and refuses new ones while they are all in use:
+ * UNREGISTER_EXTENTS frees a map its client is done with.
+ */
+struct extent_upload {
+    unsigned int handle;
+    extent_rec extents<EXTENT_UPLOAD_CHUNK>;
+};
+
+/* Batched copies by logical offset within a registered file */
+struct logical_batch_params {
+    unsigned int handle;          /* from REGISTER_EXTENTS */
+    hyper srcs<MAX_BATCH>;        /* logical source offsets */
+    hyper dsts<MAX_BATCH>;        /* logical destination offsets */
+    unsigned int block_size;      /* bytes of each copy */
+};
+
+/*
+ * Version 2 batches: counted arrays, so only the copies actually sent go on
+ * the wire. pba_srcs and pba_dsts (and lens) must have the same length.
+ */
+struct pba_batch2_params {
+    hyper pba_srcs<MAX_BATCH2>;
+    hyper pba_dsts<MAX_BATCH2>;
+    unsigned int block_size;      /* size of each block */
+};
+
+struct pba_seg_batch2_params {
+    hyper pba_srcs<MAX_BATCH2>;
+    hyper pba_dsts<MAX_BATCH2>;
+    unsigned int lens<MAX_BATCH2>; /* bytes of each copy */
+};
+
+struct logical_batch2_params {
+    unsigned int handle;          /* from REGISTER_EXTENTS */
+    hyper srcs<MAX_BATCH2>;       /* logical source offsets */
+    hyper dsts<MAX_BATCH2>;       /* logical destination offsets */
+    unsigned int block_size;      /* bytes of each copy */
+};
+
+/*
+ * Compact batches (WRITE_PBA_PACKED). ENC_RUNS sends runs of equally spaced
+ * copies: copy k of a run moves src + k * stride to dst + k * stride.
+ * ENC_DELTA sends each copy as varints of the zigzag-coded difference from
+ * the previous copy's source, then destination (then length when
+ * block_size is 0), all in units of 1 << shift bytes.
+ */
+enum batch_encoding {
+    ENC_RUNS = 1,
+    ENC_DELTA = 2
+};
+
+struct copy_run {
+    hyper src;
+    hyper dst;
+    unsigned int count;           /* copies in the run */
+    hyper stride;                 /* bytes from one copy to the next, both sides */
+};
+
+struct delta_list {
+    unsigned int shift;
+    opaque bytes<MAX_DELTA_BYTES>;
+};
+
+union packed_batch switch (batch_encoding enc) {
+case ENC_RUNS:
+    copy_run runs<MAX_BATCH2>;
+case ENC_DELTA:
+    delta_list deltas;
+};
+
+struct pba_packed_params {
+    unsigned int count;           /* copies encoded */
+    unsigned int block_size;      /* bytes of each copy; 0: per copy (ENC_DELTA) */
+    packed_batch batch;
+};
+
+/*
+ * One-way batches (WRITE_PBA_ASYNC): the server runs them in the order
+ * sent and does not reply. seq numbers a connection's batches from 0 up;
+ * BARRIER, on the same connection, answers for all of them at once.
+ */
+struct async_batch_params {
+    unsigned hyper seq;
+    hyper pba_srcs<MAX_BATCH2>;
+    hyper pba_dsts<MAX_BATCH2>;
+    unsigned int lens<MAX_BATCH2>; /* bytes of each copy; empty: block_size each */
+    unsigned int block_size;
+};
+
+/* The connection's one-way batches since its previous BARRIER */
+struct barrier_reply {
+    int result;                   /* 0: all ran and are on stable storage */
+    unsigned hyper batches;       /* how many the server ran */
+    unsigned hyper failed_seq;    /* result -1: the first that failed, or ~0 if the flush did */
+};
+
 /* Timing data returned from server */
 struct get_server_ios {
     unsigned hyper server_read_time;
@@ -24,11 +142,39 @@ struct get_server_ios {
     unsigned hyper server_other_time;
 };
 
+/* Named server counters (buffer pool, ...) returned by GET_STATS */
+struct stat_entry {
+    string name<64>;
+    unsigned hyper value;
+};
+typedef stat_entry stat_list<>;
+
 program BLOCKCOPY_PROG {
     version BLOCKCOPY_VERS {
         int WRITE_PBA(pba_write_params) = 1;
         get_server_ios GET_TIME(void) = 2;
         void RESET_TIME(void) = 3;
         int WRITE_PBA_BATCH(pba_batch_params) = 4;
+        stat_list GET_STATS(void) = 5;
+        int WRITE_PBA_SEGS(pba_seg_batch_params) = 6;
+        unsigned int REGISTER_EXTENTS(extent_upload) = 7;
+        int WRITE_LOGICAL_BATCH(logical_batch_params) = 8;
+        int UNREGISTER_EXTENTS(unsigned int) = 12;
     } = 1;
+
+    /* Same procedures; the batches take counted arrays */
+    version BLOCKCOPY_VERS2 {
+        int WRITE_PBA(pba_write_params) = 1;
+        get_server_ios GET_TIME(void) = 2;
+        void RESET_TIME(void) = 3;
+        int WRITE_PBA_BATCH(pba_batch2_params) = 4;
+        stat_list GET_STATS(void) = 5;
+        int WRITE_PBA_SEGS(pba_seg_batch2_params) = 6;
+        unsigned int REGISTER_EXTENTS(extent_upload) = 7;
+        int WRITE_LOGICAL_BATCH(logical_batch2_params) = 8;
+        int WRITE_PBA_PACKED(pba_packed_params) = 9;
+        void WRITE_PBA_ASYNC(async_batch_params) = 10;
+        barrier_reply BARRIER(void) = 11;
+        int UNREGISTER_EXTENTS(unsigned int) = 12;
+    } = 2;
 } = 0x34567890;
\ No newline at end of file
@@ -3,59 +3,197 @@
  * It was generated using rpcgen.
  */
 
+#include <memory.h> /* for memset */
 #include "blockcopy_random.h"
 
 /* Default timeout can be changed using clnt_control() */
 static struct timeval TIMEOUT = { 25, 0 };
 
-int *
-write_pba_1(argp, clnt)
-	pba_write_params *argp;
-	CLIENT *clnt;
+enum clnt_stat 
+write_pba_1(pba_write_params *argp, int *clnt_res, CLIENT *clnt)
 {
-	static int clnt_res;
+	return (clnt_call(clnt, WRITE_PBA,
+		(xdrproc_t) xdr_pba_write_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+get_time_1(void *argp, get_server_ios *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, GET_TIME,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_get_server_ios, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+reset_time_1(void *argp, void *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, RESET_TIME,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_void, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+write_pba_batch_1(pba_batch_params *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_PBA_BATCH,
+		(xdrproc_t) xdr_pba_batch_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+get_stats_1(void *argp, stat_list *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, GET_STATS,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_stat_list, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+write_pba_segs_1(pba_seg_batch_params *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_PBA_SEGS,
+		(xdrproc_t) xdr_pba_seg_batch_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
 
-	memset((char *)&clnt_res, 0, sizeof(clnt_res));
-	if (clnt_call(clnt, WRITE_PBA, xdr_pba_write_params, argp, xdr_int, &clnt_res, TIMEOUT) != RPC_SUCCESS)
-		return (NULL);
-	return (&clnt_res);
+enum clnt_stat 
+register_extents_1(extent_upload *argp, u_int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, REGISTER_EXTENTS,
+		(xdrproc_t) xdr_extent_upload, (caddr_t) argp,
+		(xdrproc_t) xdr_u_int, (caddr_t) clnt_res,
+		TIMEOUT));
 }
 
-get_server_ios *
-get_time_1(argp, clnt)
-	void *argp;
-	CLIENT *clnt;
+enum clnt_stat 
+write_logical_batch_1(logical_batch_params *argp, int *clnt_res, CLIENT *clnt)
 {
-	static get_server_ios clnt_res;
+	return (clnt_call(clnt, WRITE_LOGICAL_BATCH,
+		(xdrproc_t) xdr_logical_batch_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
 
-	memset((char *)&clnt_res, 0, sizeof(clnt_res));
-	if (clnt_call(clnt, GET_TIME, xdr_void, argp, xdr_get_server_ios, &clnt_res, TIMEOUT) != RPC_SUCCESS)
-		return (NULL);
-	return (&clnt_res);
+enum clnt_stat 
+unregister_extents_1(u_int *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, UNREGISTER_EXTENTS,
+		(xdrproc_t) xdr_u_int, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
 }
 
-void *
-reset_time_1(argp, clnt)
-	void *argp;
-	CLIENT *clnt;
+enum clnt_stat 
+write_pba_2(pba_write_params *argp, int *clnt_res, CLIENT *clnt)
 {
-	static char clnt_res;
+	return (clnt_call(clnt, WRITE_PBA,
+		(xdrproc_t) xdr_pba_write_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
 
-	memset((char *)&clnt_res, 0, sizeof(clnt_res));
-	if (clnt_call(clnt, RESET_TIME, xdr_void, argp, xdr_void, &clnt_res, TIMEOUT) != RPC_SUCCESS)
-		return (NULL);
-	return ((void *)&clnt_res);
+enum clnt_stat 
+get_time_2(void *argp, get_server_ios *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, GET_TIME,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_get_server_ios, (caddr_t) clnt_res,
+		TIMEOUT));
 }
 
-int *
-write_pba_batch_1(argp, clnt)
-	pba_batch_params *argp;
-	CLIENT *clnt;
+enum clnt_stat 
+reset_time_2(void *argp, void *clnt_res, CLIENT *clnt)
 {
-	static int clnt_res;
+	return (clnt_call(clnt, RESET_TIME,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_void, (caddr_t) clnt_res,
+		TIMEOUT));
+}
 
-	memset((char *)&clnt_res, 0, sizeof(clnt_res));
-	if (clnt_call(clnt, WRITE_PBA_BATCH, xdr_pba_batch_params, argp, xdr_int, &clnt_res, TIMEOUT) != RPC_SUCCESS)
-		return (NULL);
-	return (&clnt_res);
+enum clnt_stat 
+write_pba_batch_2(pba_batch2_params *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_PBA_BATCH,
+		(xdrproc_t) xdr_pba_batch2_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+get_stats_2(void *argp, stat_list *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, GET_STATS,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_stat_list, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+write_pba_segs_2(pba_seg_batch2_params *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_PBA_SEGS,
+		(xdrproc_t) xdr_pba_seg_batch2_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+register_extents_2(extent_upload *argp, u_int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, REGISTER_EXTENTS,
+		(xdrproc_t) xdr_extent_upload, (caddr_t) argp,
+		(xdrproc_t) xdr_u_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+write_logical_batch_2(logical_batch2_params *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_LOGICAL_BATCH,
+		(xdrproc_t) xdr_logical_batch2_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+write_pba_packed_2(pba_packed_params *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_PBA_PACKED,
+		(xdrproc_t) xdr_pba_packed_params, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+write_pba_async_2(async_batch_params *argp, void *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, WRITE_PBA_ASYNC,
+		(xdrproc_t) xdr_async_batch_params, (caddr_t) argp,
+		(xdrproc_t) xdr_void, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+barrier_2(void *argp, barrier_reply *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, BARRIER,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_barrier_reply, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
+enum clnt_stat 
+unregister_extents_2(u_int *argp, int *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, UNREGISTER_EXTENTS,
+		(xdrproc_t) xdr_u_int, (caddr_t) argp,
+		(xdrproc_t) xdr_int, (caddr_t) clnt_res,
+		TIMEOUT));
 }
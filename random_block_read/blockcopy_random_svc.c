@@ -4,229 +4,250 @@
  */
 
 #include "blockcopy_random.h"
-#include <sys/ioctl.h>
-#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <netdb.h>
-#include <signal.h>
-#include <sys/ttycom.h>
+#include <rpc/pmap_clnt.h>
+#include <string.h>
 #include <memory.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <syslog.h>
 
-#ifdef __STDC__
+#ifndef SIG_PF
 #define SIG_PF void(*)(int)
 #endif
 
-#ifdef DEBUG
-#define RPC_SVC_FG
-#endif
-
-#define _RPCSVC_CLOSEDOWN 120
-static int _rpcpmstart;		/* Started by a port monitor ? */
-static int _rpcfdtype;		/* Whether Stream or Datagram ? */
-static int _rpcsvcdirty;	/* Still serving ? */
-
-static
-void _msgout(msg)
-	char *msg;
-{
-#ifdef RPC_SVC_FG
-	if (_rpcpmstart)
-		syslog(LOG_ERR, "%s", msg);
-	else
-		(void) fprintf(stderr, "%s\n", msg);
-#else
-	syslog(LOG_ERR, "%s", msg);
-#endif
-}
-
-static void
-closedown()
-{
-	if (_rpcsvcdirty == 0) {
-		extern fd_set svc_fdset;
-		static int size;
-		int i, openfd;
-
-		if (_rpcfdtype == SOCK_DGRAM)
-			exit(0);
-		if (size == 0) {
-			size = getdtablesize();
-		}
-		for (i = 0, openfd = 0; i < size && openfd < 2; i++)
-			if (FD_ISSET(i, &svc_fdset))
-				openfd++;
-		if (openfd <= (_rpcpmstart?0:1))
-			exit(0);
-	}
-	(void) alarm(_RPCSVC_CLOSEDOWN);
-}
-
-static void
-blockcopy_prog_1(rqstp, transp)
-	struct svc_req *rqstp;
-	SVCXPRT *transp;
+void
+blockcopy_prog_1(struct svc_req *rqstp, register SVCXPRT *transp)
 {
 	union {
 		pba_write_params write_pba_1_arg;
 		pba_batch_params write_pba_batch_1_arg;
+		pba_seg_batch_params write_pba_segs_1_arg;
+		extent_upload register_extents_1_arg;
+		logical_batch_params write_logical_batch_1_arg;
+		u_int unregister_extents_1_arg;
 	} argument;
-	char *result;
-	bool_t (*xdr_argument)(), (*xdr_result)();
-	char *(*local)();
+	union {
+		int write_pba_1_res;
+		get_server_ios get_time_1_res;
+		int write_pba_batch_1_res;
+		stat_list get_stats_1_res;
+		int write_pba_segs_1_res;
+		u_int register_extents_1_res;
+		int write_logical_batch_1_res;
+		int unregister_extents_1_res;
+	} result;
+	bool_t retval;
+	xdrproc_t _xdr_argument, _xdr_result;
+	bool_t (*local)(char *, void *, struct svc_req *);
 
-	_rpcsvcdirty = 1;
 	switch (rqstp->rq_proc) {
 	case NULLPROC:
-		(void) svc_sendreply(transp, (xdrproc_t) xdr_void, (char *)NULL);
-		_rpcsvcdirty = 0;
+		(void) svc_sendreply (transp, (xdrproc_t) xdr_void, (char *)NULL);
 		return;
 
 	case WRITE_PBA:
-		xdr_argument = xdr_pba_write_params;
-		xdr_result = xdr_int;
-		local = (char *(*)()) write_pba_1_svc;
+		_xdr_argument = (xdrproc_t) xdr_pba_write_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_1_svc;
 		break;
 
 	case GET_TIME:
-		xdr_argument = xdr_void;
-		xdr_result = xdr_get_server_ios;
-		local = (char *(*)()) get_time_1_svc;
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_get_server_ios;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))get_time_1_svc;
 		break;
 
 	case RESET_TIME:
-		xdr_argument = xdr_void;
-		xdr_result = xdr_void;
-		local = (char *(*)()) reset_time_1_svc;
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_void;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))reset_time_1_svc;
 		break;
 
 	case WRITE_PBA_BATCH:
-		xdr_argument = xdr_pba_batch_params;
-		xdr_result = xdr_int;
-		local = (char *(*)()) write_pba_batch_1_svc;
+		_xdr_argument = (xdrproc_t) xdr_pba_batch_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_batch_1_svc;
+		break;
+
+	case GET_STATS:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_stat_list;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))get_stats_1_svc;
+		break;
+
+	case WRITE_PBA_SEGS:
+		_xdr_argument = (xdrproc_t) xdr_pba_seg_batch_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_segs_1_svc;
+		break;
+
+	case REGISTER_EXTENTS:
+		_xdr_argument = (xdrproc_t) xdr_extent_upload;
+		_xdr_result = (xdrproc_t) xdr_u_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))register_extents_1_svc;
+		break;
+
+	case WRITE_LOGICAL_BATCH:
+		_xdr_argument = (xdrproc_t) xdr_logical_batch_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_logical_batch_1_svc;
+		break;
+
+	case UNREGISTER_EXTENTS:
+		_xdr_argument = (xdrproc_t) xdr_u_int;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))unregister_extents_1_svc;
 		break;
 
 	default:
-		svcerr_noproc(transp);
-		_rpcsvcdirty = 0;
+		svcerr_noproc (transp);
 		return;
 	}
-	(void) memset((char *)&argument, 0, sizeof (argument));
-	if (!svc_getargs(transp, xdr_argument, (caddr_t) &argument)) {
-		svcerr_decode(transp);
-		_rpcsvcdirty = 0;
+	memset ((char *)&argument, 0, sizeof (argument));
+	if (!svc_getargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		svcerr_decode (transp);
 		return;
 	}
-	result = (*local)(&argument, rqstp);
-	if (result != NULL && !svc_sendreply(transp, (xdrproc_t) xdr_result, result)) {
-		svcerr_systemerr(transp);
+	retval = (bool_t) (*local)((char *)&argument, (void *)&result, rqstp);
+	if (retval > 0 && !svc_sendreply(transp, (xdrproc_t) _xdr_result, (char *)&result)) {
+		svcerr_systemerr (transp);
 	}
-	if (!svc_freeargs(transp, xdr_argument, (caddr_t) &argument)) {
-		_msgout("unable to free arguments");
-		exit(1);
+	if (!svc_freeargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		fprintf (stderr, "%s", "unable to free arguments");
+		exit (1);
 	}
-	_rpcsvcdirty = 0;
+	if (!blockcopy_prog_1_freeresult (transp, _xdr_result, (caddr_t) &result))
+		fprintf (stderr, "%s", "unable to free results");
+
 	return;
 }
 
+void
+blockcopy_prog_2(struct svc_req *rqstp, register SVCXPRT *transp)
+{
+	union {
+		pba_write_params write_pba_2_arg;
+		pba_batch2_params write_pba_batch_2_arg;
+		pba_seg_batch2_params write_pba_segs_2_arg;
+		extent_upload register_extents_2_arg;
+		logical_batch2_params write_logical_batch_2_arg;
+		pba_packed_params write_pba_packed_2_arg;
+		async_batch_params write_pba_async_2_arg;
+		u_int unregister_extents_2_arg;
+	} argument;
+	union {
+		int write_pba_2_res;
+		get_server_ios get_time_2_res;
+		int write_pba_batch_2_res;
+		stat_list get_stats_2_res;
+		int write_pba_segs_2_res;
+		u_int register_extents_2_res;
+		int write_logical_batch_2_res;
+		int write_pba_packed_2_res;
+		barrier_reply barrier_2_res;
+		int unregister_extents_2_res;
+	} result;
+	bool_t retval;
+	xdrproc_t _xdr_argument, _xdr_result;
+	bool_t (*local)(char *, void *, struct svc_req *);
 
+	switch (rqstp->rq_proc) {
+	case NULLPROC:
+		(void) svc_sendreply (transp, (xdrproc_t) xdr_void, (char *)NULL);
+		return;
 
-int
-main(argc, argv)
-int argc;
-char *argv[];
-{
-	SVCXPRT *transp = NULL;
-	int sock;
-	int proto = 0;
-	struct sockaddr_in saddr;
-	int asize = sizeof (saddr);
-
-	if (getsockname(0, (struct sockaddr *)&saddr, &asize) == 0) {
-		int ssize = sizeof (int);
-
-		if (saddr.sin_family != AF_INET)
-			exit(1);
-		if (getsockopt(0, SOL_SOCKET, SO_TYPE,
-				(char *)&_rpcfdtype, &ssize) == -1)
-			exit(1);
-		sock = 0;
-		_rpcpmstart = 1;
-		proto = 0;
-		openlog("blockcopy_random", LOG_PID, LOG_DAEMON);
-	} else {
-#ifndef RPC_SVC_FG
-		int size;
-		int pid, i;
-
-		pid = fork();
-		if (pid < 0) {
-			perror("cannot fork");
-			exit(1);
-		}
-		if (pid)
-			exit(0);
-		size = getdtablesize();
-		for (i = 0; i < size; i++)
-			(void) close(i);
-		i = open("/dev/console", 2);
-		(void) dup2(i, 1);
-		(void) dup2(i, 2);
-		i = open("/dev/tty", 2);
-		if (i >= 0) {
-			(void) ioctl(i, TIOCNOTTY, (char *)NULL);
-			(void) close(i);
-		}
-		openlog("blockcopy_random", LOG_PID, LOG_DAEMON);
-#endif
-		sock = RPC_ANYSOCK;
-		(void) pmap_unset(BLOCKCOPY_PROG, BLOCKCOPY_VERS);
-	}
+	case WRITE_PBA:
+		_xdr_argument = (xdrproc_t) xdr_pba_write_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_2_svc;
+		break;
 
-	if ((_rpcfdtype == 0) || (_rpcfdtype == SOCK_DGRAM)) {
-		transp = svcudp_create(sock);
-		if (transp == NULL) {
-			_msgout("cannot create udp service.");
-			exit(1);
-		}
-		if (!_rpcpmstart)
-			proto = IPPROTO_UDP;
-		if (!svc_register(transp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, proto)) {
-			_msgout("unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS, udp).");
-			exit(1);
-		}
-	}
+	case GET_TIME:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_get_server_ios;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))get_time_2_svc;
+		break;
 
-	if ((_rpcfdtype == 0) || (_rpcfdtype == SOCK_STREAM)) {
-		if (_rpcpmstart)
-			transp = svcfd_create(sock, 0, 0);
-		else
-			transp = svctcp_create(sock, 0, 0);
-		if (transp == NULL) {
-			_msgout("cannot create tcp service.");
-			exit(1);
-		}
-		if (!_rpcpmstart)
-			proto = IPPROTO_TCP;
-		if (!svc_register(transp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, proto)) {
-			_msgout("unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS, tcp).");
-			exit(1);
-		}
-	}
+	case RESET_TIME:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_void;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))reset_time_2_svc;
+		break;
 
-	if (transp == (SVCXPRT *)NULL) {
-		_msgout("could not create a handle");
-		exit(1);
+	case WRITE_PBA_BATCH:
+		_xdr_argument = (xdrproc_t) xdr_pba_batch2_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_batch_2_svc;
+		break;
+
+	case GET_STATS:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_stat_list;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))get_stats_2_svc;
+		break;
+
+	case WRITE_PBA_SEGS:
+		_xdr_argument = (xdrproc_t) xdr_pba_seg_batch2_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_segs_2_svc;
+		break;
+
+	case REGISTER_EXTENTS:
+		_xdr_argument = (xdrproc_t) xdr_extent_upload;
+		_xdr_result = (xdrproc_t) xdr_u_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))register_extents_2_svc;
+		break;
+
+	case WRITE_LOGICAL_BATCH:
+		_xdr_argument = (xdrproc_t) xdr_logical_batch2_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_logical_batch_2_svc;
+		break;
+
+	case WRITE_PBA_PACKED:
+		_xdr_argument = (xdrproc_t) xdr_pba_packed_params;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_packed_2_svc;
+		break;
+
+	case WRITE_PBA_ASYNC:
+		_xdr_argument = (xdrproc_t) xdr_async_batch_params;
+		_xdr_result = (xdrproc_t) xdr_void;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))write_pba_async_2_svc;
+		break;
+
+	case BARRIER:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_barrier_reply;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))barrier_2_svc;
+		break;
+
+	case UNREGISTER_EXTENTS:
+		_xdr_argument = (xdrproc_t) xdr_u_int;
+		_xdr_result = (xdrproc_t) xdr_int;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))unregister_extents_2_svc;
+		break;
+
+	default:
+		svcerr_noproc (transp);
+		return;
+	}
+	memset ((char *)&argument, 0, sizeof (argument));
+	if (!svc_getargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		svcerr_decode (transp);
+		return;
+	}
+	retval = (bool_t) (*local)((char *)&argument, (void *)&result, rqstp);
+	if (retval > 0 && !svc_sendreply(transp, (xdrproc_t) _xdr_result, (char *)&result)) {
+		svcerr_systemerr (transp);
 	}
-	if (_rpcpmstart) {
-		(void) signal(SIGALRM, (void(*)()) closedown);
-		(void) alarm(_RPCSVC_CLOSEDOWN);
+	if (!svc_freeargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		fprintf (stderr, "%s", "unable to free arguments");
+		exit (1);
 	}
-	svc_run();
-	_msgout("svc_run returned");
-	exit(1);
-	/* NOTREACHED */
+	if (!blockcopy_prog_2_freeresult (transp, _xdr_result, (caddr_t) &result))
+		fprintf (stderr, "%s", "unable to free results");
+
+	return;
 }
@@ -6,48 +6,352 @@
 #include "blockcopy_random.h"
 
 bool_t
-xdr_pba_write_params(xdrs, objp)
-	XDR *xdrs;
-	pba_write_params *objp;
+xdr_pba_write_params (XDR *xdrs, pba_write_params *objp)
 {
+	register int32_t *buf;
 
-	if (!xdr_int64_t(xdrs, &objp->pba_src))
-		return (FALSE);
-	if (!xdr_int64_t(xdrs, &objp->pba_dst))
-		return (FALSE);
-	if (!xdr_int(xdrs, &objp->nbytes))
-		return (FALSE);
-	return (TRUE);
+	 if (!xdr_quad_t (xdrs, &objp->pba_src))
+		 return FALSE;
+	 if (!xdr_quad_t (xdrs, &objp->pba_dst))
+		 return FALSE;
+	 if (!xdr_int (xdrs, &objp->nbytes))
+		 return FALSE;
+	return TRUE;
 }
 
 bool_t
-xdr_pba_batch_params(xdrs, objp)
-	XDR *xdrs;
-	pba_batch_params *objp;
+xdr_pba_batch_params (XDR *xdrs, pba_batch_params *objp)
 {
+	register int32_t *buf;
 
-	if (!xdr_vector(xdrs, (char *)objp->pba_srcs, MAX_BATCH, sizeof(int64_t), (xdrproc_t)xdr_int64_t))
-		return (FALSE);
-	if (!xdr_vector(xdrs, (char *)objp->pba_dsts, MAX_BATCH, sizeof(int64_t), (xdrproc_t)xdr_int64_t))
-		return (FALSE);
-	if (!xdr_uint32(xdrs, &objp->count))
-		return (FALSE);
-	if (!xdr_uint32(xdrs, &objp->block_size))
-		return (FALSE);
-	return (TRUE);
+	int i;
+	 if (!xdr_vector (xdrs, (char *)objp->pba_srcs, MAX_BATCH,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->pba_dsts, MAX_BATCH,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->count))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->block_size))
+		 return FALSE;
+	return TRUE;
 }
 
 bool_t
-xdr_get_server_ios(xdrs, objp)
-	XDR *xdrs;
-	get_server_ios *objp;
+xdr_pba_seg_batch_params (XDR *xdrs, pba_seg_batch_params *objp)
 {
+	register int32_t *buf;
 
-	if (!xdr_u_int64_t(xdrs, &objp->server_read_time))
-		return (FALSE);
-	if (!xdr_u_int64_t(xdrs, &objp->server_write_time))
-		return (FALSE);
-	if (!xdr_u_int64_t(xdrs, &objp->server_other_time))
-		return (FALSE);
-	return (TRUE);
+	int i;
+
+	if (xdrs->x_op == XDR_ENCODE) {
+		 if (!xdr_vector (xdrs, (char *)objp->pba_srcs, MAX_BATCH,
+			sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+			 return FALSE;
+		 if (!xdr_vector (xdrs, (char *)objp->pba_dsts, MAX_BATCH,
+			sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+			 return FALSE;
+		buf = XDR_INLINE (xdrs, (1 +  MAX_BATCH )* BYTES_PER_XDR_UNIT);
+		if (buf == NULL) {
+			 if (!xdr_vector (xdrs, (char *)objp->lens, MAX_BATCH,
+				sizeof (u_int), (xdrproc_t) xdr_u_int))
+				 return FALSE;
+			 if (!xdr_u_int (xdrs, &objp->count))
+				 return FALSE;
+		} else {
+			{
+				register u_int *genp;
+
+				for (i = 0, genp = objp->lens;
+					i < MAX_BATCH; ++i) {
+					IXDR_PUT_U_LONG(buf, *genp++);
+				}
+			}
+			IXDR_PUT_U_LONG(buf, objp->count);
+		}
+		return TRUE;
+	} else if (xdrs->x_op == XDR_DECODE) {
+		 if (!xdr_vector (xdrs, (char *)objp->pba_srcs, MAX_BATCH,
+			sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+			 return FALSE;
+		 if (!xdr_vector (xdrs, (char *)objp->pba_dsts, MAX_BATCH,
+			sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+			 return FALSE;
+		buf = XDR_INLINE (xdrs, (1 +  MAX_BATCH )* BYTES_PER_XDR_UNIT);
+		if (buf == NULL) {
+			 if (!xdr_vector (xdrs, (char *)objp->lens, MAX_BATCH,
+				sizeof (u_int), (xdrproc_t) xdr_u_int))
+				 return FALSE;
+			 if (!xdr_u_int (xdrs, &objp->count))
+				 return FALSE;
+		} else {
+			{
+				register u_int *genp;
+
+				for (i = 0, genp = objp->lens;
+					i < MAX_BATCH; ++i) {
+					*genp++ = IXDR_GET_U_LONG(buf);
+				}
+			}
+			objp->count = IXDR_GET_U_LONG(buf);
+		}
+	 return TRUE;
+	}
+
+	 if (!xdr_vector (xdrs, (char *)objp->pba_srcs, MAX_BATCH,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->pba_dsts, MAX_BATCH,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->lens, MAX_BATCH,
+		sizeof (u_int), (xdrproc_t) xdr_u_int))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->count))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_extent_rec (XDR *xdrs, extent_rec *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_quad_t (xdrs, &objp->logical))
+		 return FALSE;
+	 if (!xdr_quad_t (xdrs, &objp->physical))
+		 return FALSE;
+	 if (!xdr_quad_t (xdrs, &objp->len))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_extent_upload (XDR *xdrs, extent_upload *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_int (xdrs, &objp->handle))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->extents.extents_val, (u_int *) &objp->extents.extents_len, EXTENT_UPLOAD_CHUNK,
+		sizeof (extent_rec), (xdrproc_t) xdr_extent_rec))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_logical_batch_params (XDR *xdrs, logical_batch_params *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_int (xdrs, &objp->handle))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->srcs.srcs_val, (u_int *) &objp->srcs.srcs_len, MAX_BATCH,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->dsts.dsts_val, (u_int *) &objp->dsts.dsts_len, MAX_BATCH,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->block_size))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_pba_batch2_params (XDR *xdrs, pba_batch2_params *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_array (xdrs, (char **)&objp->pba_srcs.pba_srcs_val, (u_int *) &objp->pba_srcs.pba_srcs_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->pba_dsts.pba_dsts_val, (u_int *) &objp->pba_dsts.pba_dsts_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->block_size))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_pba_seg_batch2_params (XDR *xdrs, pba_seg_batch2_params *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_array (xdrs, (char **)&objp->pba_srcs.pba_srcs_val, (u_int *) &objp->pba_srcs.pba_srcs_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->pba_dsts.pba_dsts_val, (u_int *) &objp->pba_dsts.pba_dsts_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->lens.lens_val, (u_int *) &objp->lens.lens_len, MAX_BATCH2,
+		sizeof (u_int), (xdrproc_t) xdr_u_int))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_logical_batch2_params (XDR *xdrs, logical_batch2_params *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_int (xdrs, &objp->handle))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->srcs.srcs_val, (u_int *) &objp->srcs.srcs_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->dsts.dsts_val, (u_int *) &objp->dsts.dsts_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->block_size))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_batch_encoding (XDR *xdrs, batch_encoding *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_enum (xdrs, (enum_t *) objp))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_copy_run (XDR *xdrs, copy_run *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_quad_t (xdrs, &objp->src))
+		 return FALSE;
+	 if (!xdr_quad_t (xdrs, &objp->dst))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->count))
+		 return FALSE;
+	 if (!xdr_quad_t (xdrs, &objp->stride))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_delta_list (XDR *xdrs, delta_list *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_int (xdrs, &objp->shift))
+		 return FALSE;
+	 if (!xdr_bytes (xdrs, (char **)&objp->bytes.bytes_val, (u_int *) &objp->bytes.bytes_len, MAX_DELTA_BYTES))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_packed_batch (XDR *xdrs, packed_batch *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_batch_encoding (xdrs, &objp->enc))
+		 return FALSE;
+	switch (objp->enc) {
+	case ENC_RUNS:
+		 if (!xdr_array (xdrs, (char **)&objp->packed_batch_u.runs.runs_val, (u_int *) &objp->packed_batch_u.runs.runs_len, MAX_BATCH2,
+			sizeof (copy_run), (xdrproc_t) xdr_copy_run))
+			 return FALSE;
+		break;
+	case ENC_DELTA:
+		 if (!xdr_delta_list (xdrs, &objp->packed_batch_u.deltas))
+			 return FALSE;
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_pba_packed_params (XDR *xdrs, pba_packed_params *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_int (xdrs, &objp->count))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->block_size))
+		 return FALSE;
+	 if (!xdr_packed_batch (xdrs, &objp->batch))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_async_batch_params (XDR *xdrs, async_batch_params *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_quad_t (xdrs, &objp->seq))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->pba_srcs.pba_srcs_val, (u_int *) &objp->pba_srcs.pba_srcs_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->pba_dsts.pba_dsts_val, (u_int *) &objp->pba_dsts.pba_dsts_len, MAX_BATCH2,
+		sizeof (quad_t), (xdrproc_t) xdr_quad_t))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->lens.lens_val, (u_int *) &objp->lens.lens_len, MAX_BATCH2,
+		sizeof (u_int), (xdrproc_t) xdr_u_int))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->block_size))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_barrier_reply (XDR *xdrs, barrier_reply *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_int (xdrs, &objp->result))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->batches))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->failed_seq))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_get_server_ios (XDR *xdrs, get_server_ios *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_u_quad_t (xdrs, &objp->server_read_time))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->server_write_time))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->server_other_time))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_stat_entry (XDR *xdrs, stat_entry *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_string (xdrs, &objp->name, 64))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->value))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_stat_list (XDR *xdrs, stat_list *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_array (xdrs, (char **)&objp->stat_list_val, (u_int *) &objp->stat_list_len, ~0,
+		sizeof (stat_entry), (xdrproc_t) xdr_stat_entry))
+		 return FALSE;
+	return TRUE;
 }
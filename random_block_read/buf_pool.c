@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "buf_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define BUF_POOL_ALIGN 4096
+#define MAX_THREAD_CACHES 64
+
+/*
+ * Per-thread magazine; only its owner touches bufs/len. A slot is claimed
+ * on a thread's first get or put and released, drained, when it exits.
+ */
+struct thread_cache {
+    void *bufs[BUF_POOL_CACHE];
+    int len;
+    _Atomic int claimed;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+} __attribute__((aligned(64)));
+
+static char *arena = NULL;
+static size_t arena_len = 0;
+static size_t buf_size = 0;
+
+/* Shared free list: refills and drains of thread caches, threads without one */
+static pthread_mutex_t free_lock = PTHREAD_MUTEX_INITIALIZER;
+static void **free_list = NULL;
+static size_t free_len = 0;
+
+static struct thread_cache caches[MAX_THREAD_CACHES];
+static __thread struct thread_cache *t_cache = NULL;
+static __thread int t_no_cache = 0;     /* every slot was taken: use the shared list */
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+/* Counts of threads without a magazine */
+static _Atomic uint64_t shared_hits = 0;
+static _Atomic uint64_t shared_misses = 0;
+
+static _Atomic uint64_t in_use = 0;
+static _Atomic uint64_t peak = 0;
+
+int buf_pool_init(size_t count, size_t size, int lock_mem) {
+    size = (size + BUF_POOL_ALIGN - 1) & ~(size_t)(BUF_POOL_ALIGN - 1);
+    arena_len = count * size;
+
+    if (posix_memalign((void **)&arena, BUF_POOL_ALIGN, arena_len) != 0) {
+        perror("posix_memalign");
+        return -1;
+    }
+    if (lock_mem && mlock(arena, arena_len) != 0) {
+        perror("mlock");
+        return -1;
+    }
+
+    free_list = malloc(count * sizeof(void *));
+    if (!free_list) {
+        perror("malloc");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) free_list[i] = arena + i * size;
+    free_len = count;
+    buf_size = size;
+    return 0;
+}
+
+static inline int owned(void *buf) {
+    return (char *)buf >= arena && (char *)buf < arena + arena_len;
+}
+
+/* Thread exit: hand the magazine's buffers back and free the slot */
+static void release_cache(void *arg) {
+    struct thread_cache *c = arg;
+    pthread_mutex_lock(&free_lock);
+    while (c->len > 0) free_list[free_len++] = c->bufs[--c->len];
+    pthread_mutex_unlock(&free_lock);
+    atomic_store_explicit(&c->claimed, 0, memory_order_release);
+}
+
+static void make_cache_key(void) {
+    pthread_key_create(&cache_key, release_cache);
+}
+
+/* This thread's magazine, or NULL when all MAX_THREAD_CACHES are in use */
+static struct thread_cache *my_cache(void) {
+    if (t_cache || t_no_cache) return t_cache;
+    pthread_once(&cache_once, make_cache_key);
+    for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&caches[i].claimed, &expected, 1)) {
+            t_cache = &caches[i];
+            pthread_setspecific(cache_key, t_cache);
+            return t_cache;
+        }
+    }
+    t_no_cache = 1;
+    return NULL;
+}
+
+static void note_borrow(void) {
+    uint64_t now = atomic_fetch_add_explicit(&in_use, 1, memory_order_relaxed) + 1;
+    uint64_t old = atomic_load_explicit(&peak, memory_order_relaxed);
+    while (now > old &&
+           !atomic_compare_exchange_weak_explicit(&peak, &old, now,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void *buf_pool_get(size_t size) {
+    struct thread_cache *c = my_cache();
+
+    if (size <= buf_size && !c) {
+        void *buf = NULL;
+        pthread_mutex_lock(&free_lock);
+        if (free_len > 0) buf = free_list[--free_len];
+        pthread_mutex_unlock(&free_lock);
+        if (buf) {
+            atomic_fetch_add_explicit(&shared_hits, 1, memory_order_relaxed);
+            note_borrow();
+            return buf;
+        }
+    } else if (size <= buf_size) {
+        if (c->len == 0) {
+            /* refill half a magazine from the shared list */
+            pthread_mutex_lock(&free_lock);
+            while (c->len < BUF_POOL_CACHE / 2 && free_len > 0)
+                c->bufs[c->len++] = free_list[--free_len];
+            pthread_mutex_unlock(&free_lock);
+        }
+        if (c->len > 0) {
+            atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+            note_borrow();
+            return c->bufs[--c->len];
+        }
+    }
+
+    atomic_fetch_add_explicit(c ? &c->misses : &shared_misses, 1, memory_order_relaxed);
+    void *buf;
+    if (posix_memalign(&buf, BUF_POOL_ALIGN, size) != 0) return NULL;
+    return buf;
+}
+
+void buf_pool_put(void *buf) {
+    if (!buf) return;
+    if (!owned(buf)) {
+        free(buf);
+        return;
+    }
+
+    atomic_fetch_sub_explicit(&in_use, 1, memory_order_relaxed);
+
+    struct thread_cache *c = my_cache();
+    if (!c) {
+        pthread_mutex_lock(&free_lock);
+        free_list[free_len++] = buf;
+        pthread_mutex_unlock(&free_lock);
+        return;
+    }
+    if (c->len == BUF_POOL_CACHE) {
+        /* drain half back so other threads can refill */
+        pthread_mutex_lock(&free_lock);
+        while (c->len > BUF_POOL_CACHE / 2) free_list[free_len++] = c->bufs[--c->len];
+        pthread_mutex_unlock(&free_lock);
+    }
+    c->bufs[c->len++] = buf;
+}
+
+void buf_pool_get_stats(struct buf_pool_stats *out) {
+    memset(out, 0, sizeof(*out));
+
+    out->hits = atomic_load_explicit(&shared_hits, memory_order_relaxed);
+    out->misses = atomic_load_explicit(&shared_misses, memory_order_relaxed);
+    for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+        out->hits += atomic_load_explicit(&caches[i].hits, memory_order_relaxed);
+        out->misses += atomic_load_explicit(&caches[i].misses, memory_order_relaxed);
+    }
+    out->in_use = atomic_load_explicit(&in_use, memory_order_relaxed);
+    out->peak = atomic_load_explicit(&peak, memory_order_relaxed);
+}
+
+void buf_pool_reset_stats(void) {
+    atomic_store_explicit(&shared_hits, 0, memory_order_relaxed);
+    atomic_store_explicit(&shared_misses, 0, memory_order_relaxed);
+    for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+        atomic_store_explicit(&caches[i].hits, 0, memory_order_relaxed);
+        atomic_store_explicit(&caches[i].misses, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&peak, atomic_load_explicit(&in_use, memory_order_relaxed),
+                          memory_order_relaxed);
+}
@@ -0,0 +1,36 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUF_POOL_DEFAULT_COUNT 256
+#define BUF_POOL_DEFAULT_SIZE (16 * 4096)   /* -b 16 is the largest copy we run */
+#define BUF_POOL_CACHE 16                   /* buffers kept per thread */
+
+struct buf_pool_stats {
+    uint64_t hits;       /* served from the pool */
+    uint64_t misses;     /* fell back to posix_memalign */
+    uint64_t in_use;     /* pool buffers currently borrowed */
+    uint64_t peak;       /* high-water mark of in_use */
+};
+
+/*
+ * Carve `count` ALIGN-aligned buffers of `size` bytes out of one arena,
+ * optionally mlock'd. Call once before serving requests.
+ */
+int buf_pool_init(size_t count, size_t size, int lock_mem);
+
+/*
+ * Borrow a buffer of at least `size` bytes. Each thread keeps a small
+ * private cache, so the common path takes no lock; threads beyond the
+ * first 64 alive at once go to the shared list under its lock. Larger
+ * requests, or an empty pool, fall back to posix_memalign (a miss).
+ */
+void *buf_pool_get(size_t size);
+void buf_pool_put(void *buf);
+
+void buf_pool_get_stats(struct buf_pool_stats *out);
+void buf_pool_reset_stats(void);
+
+#endif
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include "client_agent.h"
+#include "blockcopy_random.h"
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define AGENT_MAX_SESSIONS 64
+
+struct agent_client {
+    int sock;
+    int fds[AGENT_MAX_SESSIONS];    /* borrowed sessions, closed on release */
+    int nfds;
+};
+
+struct agent_client *agent_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "agent: socket path too long\n");
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("agent connect");
+        if (sock >= 0) close(sock);
+        return NULL;
+    }
+    struct agent_client *ac = calloc(1, sizeof(*ac));
+    if (!ac) {
+        close(sock);
+        return NULL;
+    }
+    ac->sock = sock;
+    return ac;
+}
+
+/* One AGENT_GET: the session's socket and the server's version, or -1 */
+static int get_session(struct agent_client *ac, int *vers) {
+    char req = AGENT_GET;
+    if (send(ac->sock, &req, 1, MSG_NOSIGNAL) != 1) return -1;
+
+    unsigned char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+    if (recvmsg(ac->sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cm), sizeof(fd));
+    if (byte == 0) {
+        close(fd);
+        return -1;
+    }
+    *vers = byte;
+    return fd;
+}
+
+CLIENT *agent_session(struct agent_client *ac, rpcvers_t *vers) {
+    if (ac->nfds == AGENT_MAX_SESSIONS) {
+        fprintf(stderr, "agent: too many sessions\n");
+        return NULL;
+    }
+    int server_vers;
+    int fd = get_session(ac, &server_vers);
+    if (fd < 0) {
+        fprintf(stderr, "agent: no session to the server\n");
+        return NULL;
+    }
+    ac->fds[ac->nfds++] = fd;
+    if ((rpcvers_t)server_vers < *vers) *vers = server_vers;
+
+    /* clnttcp_create uses the connected socket as it is and leaves it open */
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(fd, (struct sockaddr *)&peer, &len) != 0) {
+        perror("agent getpeername");
+        return NULL;
+    }
+    CLIENT *clnt = clnttcp_create(&peer, BLOCKCOPY_PROG, *vers, &fd, 0, 0);
+    if (!clnt) clnt_pcreateerror("agent session");
+    return clnt;
+}
+
+void agent_release(struct agent_client *ac) {
+    char req = AGENT_DONE;
+    send(ac->sock, &req, 1, MSG_NOSIGNAL);
+    for (int i = 0; i < ac->nfds; i++) close(ac->fds[i]);
+    close(ac->sock);
+    free(ac);
+}
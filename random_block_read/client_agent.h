@@ -0,0 +1,41 @@
+#ifndef CLIENT_AGENT_H
+#define CLIENT_AGENT_H
+
+#include <rpc/rpc.h>
+
+/*
+ * Session agent (agent_random): a long-lived process on the client host
+ * that keeps TCP connections to the server open and lends them to
+ * short-lived clients over a Unix socket, so a client starts without a
+ * portmapper lookup or a TCP handshake. Requests are one byte each:
+ *
+ *   AGENT_GET   lend one more session. The reply is one byte, the highest
+ *               protocol version the server speaks (0: no session), with
+ *               the connected socket attached (SCM_RIGHTS).
+ *   AGENT_DONE  every session lent on this Unix connection is idle again,
+ *               with no call half sent or half answered: take them back.
+ *
+ * A client that closes the Unix connection without AGENT_DONE may have
+ * left a session mid-call; the agent drops those.
+ */
+
+#define AGENT_DEFAULT_PATH "/tmp/blockcopy_agent.sock"
+#define AGENT_GET 'G'
+#define AGENT_DONE 'D'
+
+struct agent_client;
+
+/* Connect to the agent at path; NULL on error */
+struct agent_client *agent_connect(const char *path);
+
+/*
+ * Borrow a session and wrap it in an RPC handle at the highest version up
+ * to *vers the server speaks, which is stored back in *vers. NULL on
+ * error. clnt_destroy() the handle before agent_release().
+ */
+CLIENT *agent_session(struct agent_client *ac, rpcvers_t *vers);
+
+/* Hand every borrowed session back to the agent and disconnect */
+void agent_release(struct agent_client *ac);
+
+#endif
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include "client_native.h"
+#include "native_proto.h"
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A caller waiting for the reply to request id */
+struct native_call {
+    uint64_t id;
+    int done;
+    int result;
+};
+
+struct native_client {
+    int fd;
+    pthread_mutex_t lock;       /* pending, reading and dead */
+    pthread_cond_t cond;
+    pthread_mutex_t wlock;      /* frames go out whole */
+    struct native_call *pending[NATIVE_MAX_PENDING];
+    uint64_t next_id;
+    int reading;                /* a caller is reading replies for everyone */
+    int dead;                   /* the connection ended */
+};
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull
+         + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+static int send_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = recv(fd, buf, len, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        buf += r;
+        len -= r;
+    }
+    return 0;
+}
+
+/*
+ * Read one reply and hand it to the caller waiting for its id; called
+ * without the lock by the caller whose turn it is to read. Returns -1
+ * when the connection is done.
+ */
+static int read_reply(struct native_client *nc) {
+    uint8_t msg[NATIVE_HDR_LEN + NATIVE_REPLY_LEN];
+    if (recv_all(nc->fd, msg, sizeof(msg)) != 0) return -1;
+    uint32_t len, res;
+    uint16_t type;
+    uint64_t id;
+    memcpy(&len, msg, 4);
+    memcpy(&type, msg + 4, 2);
+    memcpy(&id, msg + 8, 8);
+    memcpy(&res, msg + NATIVE_HDR_LEN, 4);
+    if (le32toh(len) != NATIVE_REPLY_LEN || le16toh(type) != NATIVE_REPLY) {
+        fprintf(stderr, "native: unexpected frame from server\n");
+        return -1;
+    }
+    id = le64toh(id);
+
+    pthread_mutex_lock(&nc->lock);
+    for (int k = 0; k < NATIVE_MAX_PENDING; k++) {
+        struct native_call *call = nc->pending[k];
+        if (call && call->id == id) {
+            call->result = (int32_t)le32toh(res);
+            call->done = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nc->lock);
+    return 0;
+}
+
+struct native_client *native_connect(const char *host, const char *port) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        return NULL;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        perror("native connect");
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct native_client *nc = calloc(1, sizeof(*nc));
+    if (!nc) {
+        close(fd);
+        return NULL;
+    }
+    nc->fd = fd;
+    pthread_mutex_init(&nc->lock, NULL);
+    pthread_cond_init(&nc->cond, NULL);
+    pthread_mutex_init(&nc->wlock, NULL);
+    return nc;
+}
+
+/* Frame of count copies in buf, which grows as needed; returns its size, 0 on error */
+static size_t build_frame(uint8_t **buf, size_t *cap, uint64_t id, const int64_t *srcs,
+                          const int64_t *dsts, const uint32_t *lens, uint32_t count,
+                          uint32_t block_size) {
+    uint32_t body = native_copy_len(count, lens != NULL);
+    size_t size = NATIVE_HDR_LEN + (size_t)body;
+    if (size > *cap) {
+        uint8_t *b = realloc(*buf, size);
+        if (!b) return 0;
+        *buf = b;
+        *cap = size;
+    }
+
+    uint8_t *p = *buf;
+    uint32_t v32 = htole32(body);
+    uint16_t type = htole16(NATIVE_COPY), flags = htole16(lens ? NATIVE_LENS : 0);
+    uint64_t v64 = htole64(id);
+    memcpy(p, &v32, 4);
+    memcpy(p + 4, &type, 2);
+    memcpy(p + 6, &flags, 2);
+    memcpy(p + 8, &v64, 8);
+    native_copy_encode(p + NATIVE_HDR_LEN, srcs, dsts, lens, count, block_size);
+    return size;
+}
+
+int native_copy(struct native_client *nc, const int64_t *srcs, const int64_t *dsts,
+                const uint32_t *lens, uint32_t count, uint32_t block_size, uint64_t *rpc_ns) {
+    static __thread uint8_t *frame;
+    static __thread size_t frame_cap;
+
+    /* take a pending slot and an id */
+    struct native_call call = { 0, 0, -1 };
+    int k = -1;
+    pthread_mutex_lock(&nc->lock);
+    while (!nc->dead) {
+        for (k = 0; k < NATIVE_MAX_PENDING && nc->pending[k]; k++)
+            ;
+        if (k < NATIVE_MAX_PENDING) break;
+        pthread_cond_wait(&nc->cond, &nc->lock);
+    }
+    if (nc->dead) {
+        pthread_mutex_unlock(&nc->lock);
+        fprintf(stderr, "native: connection lost\n");
+        return -1;
+    }
+    call.id = nc->next_id++;
+    nc->pending[k] = &call;
+    pthread_mutex_unlock(&nc->lock);
+
+    size_t size = build_frame(&frame, &frame_cap, call.id, srcs, dsts, lens, count, block_size);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    int sent = 0;
+    if (size > 0) {
+        pthread_mutex_lock(&nc->wlock);
+        sent = send_all(nc->fd, frame, size) == 0;
+        pthread_mutex_unlock(&nc->wlock);
+    }
+
+    /* one waiter at a time reads replies, for itself and for the others */
+    pthread_mutex_lock(&nc->lock);
+    while (sent && !call.done && !nc->dead) {
+        if (nc->reading) {
+            pthread_cond_wait(&nc->cond, &nc->lock);
+            continue;
+        }
+        nc->reading = 1;
+        pthread_mutex_unlock(&nc->lock);
+        int rc = read_reply(nc);
+        pthread_mutex_lock(&nc->lock);
+        nc->reading = 0;
+        if (rc != 0) nc->dead = 1;
+        pthread_cond_broadcast(&nc->cond);
+    }
+    nc->pending[k] = NULL;
+    pthread_cond_broadcast(&nc->cond);
+    pthread_mutex_unlock(&nc->lock);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+
+    if (!call.done) {
+        fprintf(stderr, "native: batch failed to send\n");
+        return -1;
+    }
+    *rpc_ns += ns_diff(t0, t1);
+    return call.result;
+}
+
+void native_close(struct native_client *nc) {
+    close(nc->fd);
+    pthread_mutex_destroy(&nc->lock);
+    pthread_cond_destroy(&nc->cond);
+    pthread_mutex_destroy(&nc->wlock);
+    free(nc);
+}
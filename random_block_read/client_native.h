@@ -0,0 +1,28 @@
+#ifndef CLIENT_NATIVE_H
+#define CLIENT_NATIVE_H
+
+#include <stdint.h>
+
+/* Batches one connection may have unanswered at once */
+#define NATIVE_MAX_PENDING 64
+
+struct native_client;
+
+/* Connect to the server's native transport (server_random -N); NULL on error */
+struct native_client *native_connect(const char *host, const char *port);
+
+/*
+ * Send count copies as one NATIVE_COPY frame and wait for its reply: copy
+ * i moves lens[i] bytes from srcs[i] to dsts[i], or block_size bytes when
+ * lens is NULL. Several threads may call it at once on one connection:
+ * while they wait, one of them reads the replies and matches them to the
+ * callers by request id, in whatever order they come. Returns the
+ * server's result (0 or -1), or -1 if the connection failed; the round
+ * trip is added to *rpc_ns.
+ */
+int native_copy(struct native_client *nc, const int64_t *srcs, const int64_t *dsts,
+                const uint32_t *lens, uint32_t count, uint32_t block_size, uint64_t *rpc_ns);
+
+void native_close(struct native_client *nc);
+
+#endif
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include "client_pipe.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { SLOT_FREE, SLOT_FILLING, SLOT_QUEUED };
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull
+         + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+static int range_cmp(const void *a, const void *b) {
+    int64_t x = ((const struct pipe_range *)a)->lo, y = ((const struct pipe_range *)b)->lo;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Whether any of a[] meets any of b[], both sorted by lo. Ranges of one
+ * list may overlap each other: a range is only passed over once it ends
+ * before the other list's current range starts, and so before every later one.
+ */
+static int ranges_meet(const struct pipe_range *a, uint32_t na, const struct pipe_range *b,
+                       uint32_t nb) {
+    uint32_t i = 0, j = 0;
+    while (i < na && j < nb) {
+        if (a[i].hi <= b[j].lo) i++;
+        else if (b[j].hi <= a[i].lo) j++;
+        else return 1;
+    }
+    return 0;
+}
+
+static void batch_ranges(struct pipe_batch *b) {
+    for (uint32_t i = 0; i < b->count; i++) {
+        int64_t len = b->split ? (int64_t)b->lens[i] : (int64_t)b->block_size;
+        b->reads[i].lo = b->srcs[i];
+        b->reads[i].hi = b->srcs[i] + len;
+        b->writes[i].lo = b->dsts[i];
+        b->writes[i].hi = b->dsts[i] + len;
+    }
+    qsort(b->reads, b->count, sizeof(b->reads[0]), range_cmp);
+    qsort(b->writes, b->count, sizeof(b->writes[0]), range_cmp);
+}
+
+/* b must wait for an in-flight batch; called with the lock held */
+static int conflicts(const struct client_pipe *p, const struct pipe_batch *b) {
+    for (int k = 0; k < p->depth; k++) {
+        const struct pipe_batch *o = &p->slots[k];
+        if (o == b || o->state != SLOT_QUEUED) continue;
+        if (ranges_meet(b->writes, b->count, o->reads, o->count) ||
+            ranges_meet(b->writes, b->count, o->writes, o->count) ||
+            ranges_meet(b->reads, b->count, o->writes, o->count))
+            return 1;
+    }
+    return 0;
+}
+
+/* Room for the latency of batch seq; called with the lock held */
+static int lat_reserve(struct client_pipe *p, uint64_t seq) {
+    if (seq < p->lat_cap) return 0;
+    size_t cap = p->lat_cap * 2;
+    uint64_t *l = realloc(p->lat_ns, cap * sizeof(*l));
+    if (!l) {
+        perror("realloc");
+        return -1;
+    }
+    p->lat_ns = l;
+    p->lat_cap = cap;
+    return 0;
+}
+
+/*
+ * The connection the next batch goes out on; called with the lock held.
+ * Ties between least-outstanding connections go round robin too.
+ */
+static struct pipe_conn *conn_pick(struct client_pipe *p) {
+    int best = p->next_conn % p->nconns;
+    if (p->policy == PIPE_LEAST_OUTSTANDING) {
+        for (int i = 1; i < p->nconns; i++) {
+            int k = (p->next_conn + i) % p->nconns;
+            if (p->conns[k].outstanding < p->conns[best].outstanding) best = k;
+        }
+    }
+    p->next_conn = best + 1;
+    p->conns[best].outstanding++;
+    return &p->conns[best];
+}
+
+/* Account for a batch the server answered; called with the lock held */
+static void batch_done(struct client_pipe *p, struct pipe_batch *b, struct pipe_conn *c, int rc,
+                       uint64_t rpc_ns) {
+    c->outstanding--;
+    c->batches++;
+    c->busy_ns += rpc_ns;
+    if (rc != 0) {
+        p->failed = 1;
+    } else {
+        p->copies += b->copies;
+        p->split += b->split;
+        c->copies += b->copies;
+    }
+    p->lat_ns[b->seq] = rpc_ns;
+    p->in_flight--;
+    b->state = SLOT_FREE;
+}
+
+static void *pipe_worker(void *arg) {
+    struct client_pipe *p = arg;
+    pthread_mutex_lock(&p->lock);
+    int k = p->started++;
+    struct pipe_batch *b = &p->slots[k];
+    for (;;) {
+        while (b->state != SLOT_QUEUED && !p->stop) pthread_cond_wait(&p->cond, &p->lock);
+        if (b->state != SLOT_QUEUED) break;
+        struct pipe_conn *c = conn_pick(p);
+        pthread_mutex_unlock(&p->lock);
+
+        uint64_t rpc_ns = 0;
+        int rc = p->send(c->clnt, b, &rpc_ns);
+
+        pthread_mutex_lock(&p->lock);
+        batch_done(p, b, c, rc, rpc_ns);
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int pipe_init(struct client_pipe *p, CLIENT **clnts, int nconns, int depth, uint32_t cap,
+              pipe_send_fn send, enum pipe_policy policy) {
+    memset(p, 0, sizeof(*p));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    p->depth = depth;
+    p->nconns = nconns;
+    p->policy = policy;
+    p->send = send;
+    p->lat_cap = 1024;
+    p->lat_ns = malloc(p->lat_cap * sizeof(*p->lat_ns));
+    p->slots = calloc(depth, sizeof(*p->slots));
+    p->conns = calloc(nconns, sizeof(*p->conns));
+    if (!p->lat_ns || !p->slots || !p->conns) goto fail;
+    for (int k = 0; k < nconns; k++) p->conns[k].clnt = clnts[k];
+
+    for (int k = 0; k < depth; k++) {
+        struct pipe_batch *b = &p->slots[k];
+        b->srcs = malloc(cap * sizeof(*b->srcs));
+        b->dsts = malloc(cap * sizeof(*b->dsts));
+        b->lens = malloc(cap * sizeof(*b->lens));
+        if (!b->srcs || !b->dsts || !b->lens) goto fail;
+        if (depth > 1) {
+            b->reads = malloc(cap * sizeof(*b->reads));
+            b->writes = malloc(cap * sizeof(*b->writes));
+            if (!b->reads || !b->writes) goto fail;
+        }
+    }
+
+    if (depth > 1) {
+        p->threads = calloc(depth, sizeof(*p->threads));
+        if (!p->threads) goto fail;
+        for (int k = 0; k < depth; k++) {
+            int ret = pthread_create(&p->threads[k], NULL, pipe_worker, p);
+            if (ret != 0) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+                pipe_free(p);
+                return -1;
+            }
+            p->nthreads++;
+        }
+    }
+    return 0;
+
+fail:
+    perror("pipe_init");
+    pipe_free(p);
+    return -1;
+}
+
+struct pipe_batch *pipe_get(struct client_pipe *p) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    pthread_mutex_lock(&p->lock);
+    struct pipe_batch *b = NULL;
+    while (!p->failed) {
+        for (int k = 0; k < p->depth && !b; k++)
+            if (p->slots[k].state == SLOT_FREE) b = &p->slots[k];
+        if (b) break;
+        pthread_cond_wait(&p->cond, &p->lock);
+    }
+    if (b) {
+        b->state = SLOT_FILLING;
+        b->count = 0;
+        b->handle = 0;
+        b->copies = 0;
+        b->split = 0;
+    }
+    pthread_mutex_unlock(&p->lock);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    if (p->depth > 1) p->wait_ns += ns_diff(t0, t1);
+    return b;
+}
+
+int pipe_put(struct client_pipe *p, struct pipe_batch *b) {
+    /* depth 1: send it here and now */
+    if (p->depth == 1) {
+        struct pipe_conn *c = NULL;
+        pthread_mutex_lock(&p->lock);
+        int ok = lat_reserve(p, p->next_seq) == 0;
+        if (ok) {
+            b->seq = p->next_seq++;
+            p->in_flight = p->peak = 1;
+            c = conn_pick(p);
+        } else {
+            p->failed = 1;
+            b->state = SLOT_FREE;
+        }
+        pthread_mutex_unlock(&p->lock);
+        if (!ok) return -1;
+
+        uint64_t rpc_ns = 0;
+        int rc = p->send(c->clnt, b, &rpc_ns);
+        p->wait_ns += rpc_ns;
+        pthread_mutex_lock(&p->lock);
+        batch_done(p, b, c, rc, rpc_ns);
+        pthread_mutex_unlock(&p->lock);
+        return rc;
+    }
+
+    batch_ranges(b);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    pthread_mutex_lock(&p->lock);
+    while (!p->failed && conflicts(p, b)) pthread_cond_wait(&p->cond, &p->lock);
+    if (p->failed || lat_reserve(p, p->next_seq) != 0) {
+        p->failed = 1;
+        b->state = SLOT_FREE;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        return -1;
+    }
+    b->seq = p->next_seq++;
+    b->state = SLOT_QUEUED;
+    if (++p->in_flight > p->peak) p->peak = p->in_flight;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    p->wait_ns += ns_diff(t0, t1);
+    return 0;
+}
+
+int pipe_drain(struct client_pipe *p) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    pthread_mutex_lock(&p->lock);
+    while (p->in_flight > 0) pthread_cond_wait(&p->cond, &p->lock);
+    int rc = p->failed ? -1 : 0;
+    pthread_mutex_unlock(&p->lock);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    if (p->depth > 1) p->wait_ns += ns_diff(t0, t1);
+    return rc;
+}
+
+static int u64_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void pipe_latency(const struct client_pipe *p, double *mean, double *p50, double *p99,
+                  double *max) {
+    *mean = *p50 = *p99 = *max = 0;
+    size_t n = p->next_seq;
+    uint64_t *l = n ? malloc(n * sizeof(*l)) : NULL;
+    if (!l) return;
+    memcpy(l, p->lat_ns, n * sizeof(*l));
+    qsort(l, n, sizeof(*l), u64_cmp);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += l[i];
+    *mean = sum / n / 1e3;
+    *p50 = l[n / 2] / 1e3;
+    *p99 = l[(n * 99) / 100] / 1e3;
+    *max = l[n - 1] / 1e3;
+    free(l);
+}
+
+void pipe_free(struct client_pipe *p) {
+    if (p->threads) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        for (int k = 0; k < p->nthreads; k++) pthread_join(p->threads[k], NULL);
+        free(p->threads);
+        p->threads = NULL;
+    }
+    if (p->slots) {
+        for (int k = 0; k < p->depth; k++) {
+            free(p->slots[k].srcs);
+            free(p->slots[k].dsts);
+            free(p->slots[k].lens);
+            free(p->slots[k].reads);
+            free(p->slots[k].writes);
+        }
+        free(p->slots);
+        p->slots = NULL;
+    }
+    free(p->lat_ns);
+    p->lat_ns = NULL;
+    free(p->conns);
+    p->conns = NULL;
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+}
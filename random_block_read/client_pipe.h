@@ -0,0 +1,113 @@
+#ifndef CLIENT_PIPE_H
+#define CLIENT_PIPE_H
+
+#include <pthread.h>
+#include <rpc/rpc.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPE_MAX_DEPTH 64
+
+/* [lo, hi) bytes a batch reads or writes, by the addresses it sends */
+struct pipe_range {
+    int64_t lo;
+    int64_t hi;
+};
+
+/* One batch of copies, filled by the caller between pipe_get and pipe_put */
+struct pipe_batch {
+    int64_t *srcs;          /* device addresses, or logical offsets with a handle */
+    int64_t *dsts;
+    uint32_t *lens;         /* per-entry bytes, used when split > 0 */
+    uint32_t count;         /* entries */
+    size_t block_size;      /* bytes per entry otherwise */
+    unsigned handle;        /* -L extent map handle, 0 for device addresses */
+    long copies;            /* copies of the workload the entries make up */
+    long split;             /* of which split at extent boundaries */
+
+    /* owned by the pipe */
+    int state;
+    uint64_t seq;           /* position in the order batches were put */
+    struct pipe_range *reads, *writes; /* count of each, sorted by lo */
+};
+
+/* How a batch picks its connection among several (-R) */
+enum pipe_policy {
+    PIPE_ROUND_ROBIN,       /* each connection in turn */
+    PIPE_LEAST_OUTSTANDING  /* the one with the fewest batches on it */
+};
+
+/* One connection of the pipe and what went over it */
+struct pipe_conn {
+    CLIENT *clnt;
+    int outstanding;        /* batches being sent on it or waiting to be */
+    uint64_t batches;
+    long copies;            /* of batches the server ran */
+    uint64_t busy_ns;       /* summed round trips */
+};
+
+/*
+ * Sends b on clnt and waits for the reply; returns 0 or -1 and the time
+ * the call took in *rpc_ns.
+ */
+typedef int (*pipe_send_fn)(CLIENT *clnt, const struct pipe_batch *b, uint64_t *rpc_ns);
+
+/*
+ * Up to `depth` batches in flight, each sent by its own thread so the
+ * next batch is built while earlier ones are on the wire or on the
+ * device. They are spread over nconns connections, at most depth, by the
+ * pipe's policy; batches on one connection go out one after the other.
+ * A batch that writes what an in-flight batch reads or writes, or reads
+ * what it writes, waits for it, so the result on disk is the one of
+ * sending the batches one at a time. With depth 1 batches are sent by
+ * the caller, without threads.
+ */
+struct client_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int depth;
+    struct pipe_batch *slots;
+    struct pipe_conn *conns;
+    int nconns;
+    enum pipe_policy policy;
+    int next_conn;          /* round robin cursor */
+    pthread_t *threads;
+    int nthreads;
+    int started;            /* threads that picked their slot */
+    pipe_send_fn send;
+    int failed;
+    int stop;
+    int in_flight;
+    int peak;               /* most batches in flight at once */
+    uint64_t next_seq;
+    long copies;            /* copies of batches the server ran */
+    long split;
+    uint64_t wait_ns;       /* caller blocked on the pipe (depth 1: sending) */
+    uint64_t *lat_ns;       /* lat_ns[seq]: round trip of batch seq */
+    size_t lat_cap;
+};
+
+/*
+ * Start a pipe of depth batches of up to cap entries over the nconns
+ * connections clnts[], chosen per batch by policy. Returns 0 or -1.
+ */
+int pipe_init(struct client_pipe *p, CLIENT **clnts, int nconns, int depth, uint32_t cap,
+              pipe_send_fn send, enum pipe_policy policy);
+
+/* An empty batch to fill; blocks until a slot is free. NULL once a batch failed */
+struct pipe_batch *pipe_get(struct client_pipe *p);
+
+/* Send b once no in-flight batch conflicts with it; -1 once a batch failed */
+int pipe_put(struct client_pipe *p, struct pipe_batch *b);
+
+/* Wait for every batch in flight; returns 0, or -1 if any failed */
+int pipe_drain(struct client_pipe *p);
+
+/* Round trips of the batches sent, in microseconds */
+void pipe_latency(const struct client_pipe *p, double *mean, double *p50, double *p99,
+                  double *max);
+
+/* Stop the threads and free the batches; the connections stay open */
+void pipe_free(struct client_pipe *p);
+
+#endif
@@ -1,25 +1,29 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
-#include <linux/fiemap.h>
-#include <linux/fs.h>
+#include <netdb.h>
+#include <netinet/in.h>
 #include <rpc/rpc.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "batch_pack.h"
 #include "blockcopy_random.h"
+#include "client_agent.h"
+#include "client_native.h"
+#include "client_pipe.h"
 #include "client_random.h"
-
-typedef struct {
-    uint64_t pba;
-    size_t len;
-} pba_seg;
+#include "client_shm.h"
+#include "extent_map.h"
+#include "native_proto.h"
+#include "shm_ring.h"
 
 static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
     return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull
@@ -30,95 +34,557 @@ static inline double get_elapsed(uint64_t ns) {
     return (double)ns / 1e9;
 }
 
-/* helper to get physical block address from logical offset */
-static int get_pba(int fd, off_t logical, size_t length,
-                   pba_seg **out, size_t *out_cnt, uint64_t *fiemap_ns) {
-    struct timespec t_before, t_after;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &t_before);
+static uint64_t g_fiemap_ns = 0;
+static uint64_t g_rpc_total_ns = 0;
+
+/* Protocol version agreed with the server; 2 sends counted arrays */
+static rpcvers_t g_vers = BLOCKCOPY_VERS2;
+
+/* Server's fixed RPC port (host:port, server_random -r); 0 asks the portmapper */
+static int g_rpc_port = 0;
+static int g_vers_known = 0;
+
+/* -a: sessions borrowed from agent_random instead of connections of our own */
+static const char *g_agent_path = NULL;
+static struct agent_client *g_agent = NULL;
+
+/* Connection setup, the first one separately: it pays any lookup */
+static int g_connects = 0;
+static uint64_t g_connect_ns = 0;
+static uint64_t g_first_connect_ns = 0;
+
+/*
+ * Split a copy of len bytes from logical src to logical dst into pieces that
+ * each lie inside one extent on both sides: piece k moves lens[k] bytes from
+ * PBA srcs[k] to PBA dsts[k]. Returns the number of pieces (1 unless the copy
+ * straddles an extent boundary), or -1 if a range is unmapped or needs more
+ * than MAX_BATCH pieces. On a miss the map is re-read if the file changed,
+ * or else just the two ranges are.
+ */
+static int split_copy(struct extent_map *map, off_t src, off_t dst, size_t len,
+                      int64_t *srcs, int64_t *dsts, uint32_t *lens) {
+    static struct extent_seg s[MAX_BATCH], d[MAX_BATCH];
+    int ns = extent_map_segments(map, src, len, s, MAX_BATCH);
+    int nd = ns < 0 ? -1 : extent_map_segments(map, dst, len, d, MAX_BATCH);
+    if (nd < 0) {
+        int r = extent_map_refresh(map);
+        if (r < 0) return -1;
+        if (r == 0 && (extent_map_remap(map, src, len) != 0 ||
+                       extent_map_remap(map, dst, len) != 0))
+            return -1;
+        ns = extent_map_segments(map, src, len, s, MAX_BATCH);
+        nd = ns < 0 ? -1 : extent_map_segments(map, dst, len, d, MAX_BATCH);
+        if (nd < 0) return -1;
+    }
+
+    /* cut at the union of both sides' segment boundaries */
+    int n = 0, i = 0, j = 0;
+    uint64_t s_off = 0, d_off = 0;
+    while (i < ns) {
+        if (n == MAX_BATCH) return -1;
+        uint64_t take = s[i].len - s_off;
+        if (take > d[j].len - d_off) take = d[j].len - d_off;
+        srcs[n] = (int64_t)(s[i].physical + s_off);
+        dsts[n] = (int64_t)(d[j].physical + d_off);
+        lens[n] = (uint32_t)take;
+        n++;
+        s_off += take;
+        d_off += take;
+        if (s_off == s[i].len) i++, s_off = 0;
+        if (d_off == d[j].len) j++, d_off = 0;
+    }
+    return n;
+}
 
-    size_t size = sizeof(struct fiemap) + EXTENTS_MAX * sizeof(struct fiemap_extent);
-    struct fiemap *fiemap = (struct fiemap *)calloc(1, size);
-    if (!fiemap) return -1;
+/* Batch requests sent with each encoding (ENC_PLAIN, ENC_RUNS, ENC_DELTA) */
+static _Atomic long g_enc_batches[3];
+/* XDR bytes of the batch requests' arguments */
+static _Atomic uint64_t g_request_bytes = 0;
+static int g_encoding = ENC_AUTO;
+
+/* -N: batches go over the native transport instead of WRITE_PBA_* */
+static struct native_client *g_native = NULL;
+/* -U: batches go through a shared-memory ring to a server on this host */
+static struct shm_client *g_shm = NULL;
+
+/* -A: batches go out one-way (WRITE_PBA_ASYNC), a BARRIER every g_barrier_every */
+static int g_async = 0;
+static long g_barrier_every = 0;
+static long g_barriers = 0;
+static uint64_t g_barrier_ns = 0;
+/*
+ * Copies of each one-way batch sent, by sequence number, for recounting
+ * after a barrier fails: batches from g_async_failed_from on are not
+ * confirmed. g_async_confirmed is the first batch after the last barrier
+ * that succeeded.
+ */
+static long *g_async_copies = NULL;
+static long *g_async_split = NULL;
+static size_t g_async_cap = 0;
+static uint64_t g_async_sent = 0;
+static uint64_t g_async_confirmed = 0;
+static int g_async_failed = 0;
+static uint64_t g_async_failed_from = 0;
+
+/*
+ * Version 2 arguments for count copies (lens NULL: all of block_size bytes),
+ * in the encoding -E asks for or, by default, the smallest one: counted
+ * arrays, runs of equally spaced copies, or delta varints. Returns the
+ * procedure to call, filling the matching argument.
+ */
+static rpcproc_t encode_batch2(int64_t *srcs, int64_t *dsts, uint32_t *lens, int count,
+                               size_t block_size, pba_batch2_params *plain,
+                               pba_seg_batch2_params *segs, pba_packed_params *packed) {
+    static __thread copy_run *runs;
+    static __thread uint8_t *deltas;
+    static __thread int cap;
+    if (count > cap) {
+        copy_run *r = realloc(runs, count * sizeof(*r));
+        if (r) runs = r;
+        uint8_t *d = realloc(deltas, (size_t)count * PACK_COPY_MAX);
+        if (d) deltas = d;
+        if (r && d) cap = count;
+    }
 
-    fiemap->fm_start = logical;
-    fiemap->fm_length = length;
-    fiemap->fm_extent_count = EXTENTS_MAX;
+    /* XDR sizes, without the fields all three share */
+    size_t plain_bytes = 16 * (size_t)count + (lens ? 4 * (size_t)count : 0);
+    size_t best = plain_bytes;
+    int enc = ENC_PLAIN;
+    uint32_t nruns = 0;
+    size_t ndelta = 0;
+    unsigned shift = 0;
+    if (count <= cap && !lens && (g_encoding == ENC_AUTO || g_encoding == ENC_RUNS)) {
+        nruns = pack_runs(srcs, dsts, count, NULL);
+        if (g_encoding == ENC_RUNS || 28 * (size_t)nruns < best) {
+            best = 28 * (size_t)nruns;
+            enc = ENC_RUNS;
+        }
+    }
+    if (count <= cap && (g_encoding == ENC_AUTO || g_encoding == ENC_DELTA)) {
+        shift = pack_shift(srcs, dsts, lens, count);
+        ndelta = pack_deltas(srcs, dsts, lens, count, shift, deltas);
+        if (g_encoding == ENC_DELTA || ((ndelta + 3) & ~(size_t)3) + 4 < best) enc = ENC_DELTA;
+    }
 
-    int result = 0;
+    if (enc == ENC_PLAIN && lens) {
+        segs->pba_srcs.pba_srcs_len = count;
+        segs->pba_srcs.pba_srcs_val = srcs;
+        segs->pba_dsts.pba_dsts_len = count;
+        segs->pba_dsts.pba_dsts_val = dsts;
+        segs->lens.lens_len = count;
+        segs->lens.lens_val = lens;
+        return WRITE_PBA_SEGS;
+    }
+    if (enc == ENC_PLAIN) {
+        plain->pba_srcs.pba_srcs_len = count;
+        plain->pba_srcs.pba_srcs_val = srcs;
+        plain->pba_dsts.pba_dsts_len = count;
+        plain->pba_dsts.pba_dsts_val = dsts;
+        plain->block_size = block_size;
+        return WRITE_PBA_BATCH;
+    }
 
-    if (ioctl(fd, FS_IOC_FIEMAP, fiemap) < 0) {
-        perror("ioctl fiemap");
-        result = -1;
-        goto exit;
+    packed->count = count;
+    packed->block_size = lens ? 0 : block_size;
+    packed->batch.enc = enc;
+    if (enc == ENC_RUNS) {
+        pack_runs(srcs, dsts, count, runs);
+        packed->batch.packed_batch_u.runs.runs_len = nruns;
+        packed->batch.packed_batch_u.runs.runs_val = runs;
+    } else {
+        packed->batch.packed_batch_u.deltas.shift = shift;
+        packed->batch.packed_batch_u.deltas.bytes.bytes_len = ndelta;
+        packed->batch.packed_batch_u.deltas.bytes.bytes_val = (char *)deltas;
     }
-    if (fiemap->fm_mapped_extents > EXTENTS_MAX) {
-        fprintf(stderr,
-                "More mapped extents needed: mapped %ld, but need %u\n",
-                (long)fiemap->fm_mapped_extents, EXTENTS_MAX);
-        result = -1;
-        goto exit;
+    return WRITE_PBA_PACKED;
+}
+
+/*
+ * Send count collected copies: WRITE_PBA_BATCH when all of them are whole
+ * blocks, WRITE_PBA_SEGS with per-copy lengths when one was split, or under
+ * version 2 WRITE_PBA_PACKED when an encoding is smaller. Version 1 copies
+ * them into its fixed MAX_BATCH arrays, which always go on the wire in full.
+ * The round trip is added to *rpc_ns.
+ */
+static int send_batch(CLIENT *clnt, int64_t *srcs, int64_t *dsts, uint32_t *lens,
+                      int count, int split, size_t block_size, uint64_t *rpc_ns) {
+    static __thread pba_batch_params batch;
+    static __thread pba_seg_batch_params segs;
+    pba_batch2_params batch2;
+    pba_seg_batch2_params segs2;
+    pba_packed_params packed;
+
+    rpcproc_t proc;
+    xdrproc_t xdr_arg;
+    void *arg;
+    if (g_vers >= BLOCKCOPY_VERS2) {
+        proc = encode_batch2(srcs, dsts, split ? lens : NULL, count, block_size, &batch2, &segs2,
+                             &packed);
+        if (proc == WRITE_PBA_PACKED) {
+            xdr_arg = (xdrproc_t)xdr_pba_packed_params;
+            arg = &packed;
+            g_enc_batches[packed.batch.enc]++;
+        } else {
+            xdr_arg = split ? (xdrproc_t)xdr_pba_seg_batch2_params
+                            : (xdrproc_t)xdr_pba_batch2_params;
+            arg = split ? (void *)&segs2 : (void *)&batch2;
+            g_enc_batches[ENC_PLAIN]++;
+        }
+    } else if (split) {
+        memcpy(segs.pba_srcs, srcs, count * sizeof(segs.pba_srcs[0]));
+        memcpy(segs.pba_dsts, dsts, count * sizeof(segs.pba_dsts[0]));
+        memcpy(segs.lens, lens, count * sizeof(segs.lens[0]));
+        segs.count = count;
+        proc = WRITE_PBA_SEGS;
+        xdr_arg = (xdrproc_t)xdr_pba_seg_batch_params;
+        arg = &segs;
+        g_enc_batches[ENC_PLAIN]++;
+    } else {
+        memcpy(batch.pba_srcs, srcs, count * sizeof(batch.pba_srcs[0]));
+        memcpy(batch.pba_dsts, dsts, count * sizeof(batch.pba_dsts[0]));
+        batch.count = count;
+        batch.block_size = block_size;
+        proc = WRITE_PBA_BATCH;
+        xdr_arg = (xdrproc_t)xdr_pba_batch_params;
+        arg = &batch;
+        g_enc_batches[ENC_PLAIN]++;
     }
-    if (fiemap->fm_mapped_extents == 0) {
-        fprintf(stderr, "no extents mapped at logical %ld\n", (long)logical);
-        result = -1;
-        goto exit;
+    g_request_bytes += xdr_sizeof(xdr_arg, arg);
+
+    struct timespec t_rpc0, t_rpc1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc0);
+    int rpc_res = -1;
+    struct timeval timeout = {25, 0};
+    enum clnt_stat st = clnt_call(clnt, proc, xdr_arg, arg, (xdrproc_t)xdr_int,
+                                  (caddr_t)&rpc_res, timeout);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc1);
+
+    if (st != RPC_SUCCESS || rpc_res == -1) {
+        fprintf(stderr, "RPC batch write failed\n");
+        return -1;
     }
+    *rpc_ns += ns_diff(t_rpc0, t_rpc1);
+    return 0;
+}
+
+/* Free the server's copy of map `handle`; older servers keep it until they evict it */
+static void unregister_map(CLIENT *clnt, u_int handle) {
+    int res;
+    if (handle) unregister_extents_1(&handle, &res, clnt);
+}
+
+/* Upload the extent map to the server in chunks; returns its handle, 0 on error */
+static u_int register_map(CLIENT *clnt, const struct extent_map *map) {
+    static extent_rec chunk[EXTENT_UPLOAD_CHUNK];
+    u_int handle = 0;
+    size_t done = 0;
+    do {
+        size_t n = map->n - done;
+        if (n > EXTENT_UPLOAD_CHUNK) n = EXTENT_UPLOAD_CHUNK;
+        for (size_t k = 0; k < n; k++) {
+            chunk[k].logical = map->ext[done + k].logical;
+            chunk[k].physical = map->ext[done + k].physical;
+            chunk[k].len = map->ext[done + k].len;
+        }
+
+        extent_upload up;
+        up.handle = handle;
+        up.extents.extents_len = n;
+        up.extents.extents_val = chunk;
+        u_int res = 0;
+        if (register_extents_1(&up, &res, clnt) != RPC_SUCCESS || res == 0) {
+            fprintf(stderr, "RPC register extents failed\n");
+            unregister_map(clnt, handle);
+            return 0;
+        }
+        handle = res;
+        done += n;
+    } while (done < map->n);
+    return handle;
+}
 
-    pba_seg *vec = calloc(fiemap->fm_mapped_extents, sizeof(pba_seg));
-    size_t n = 0;
-    if (!vec) {
-        result = -1;
-        goto exit;
+/* Send count copies by logical offset; the server translates them with map `handle` */
+static int send_logical_batch(CLIENT *clnt, u_int handle, int64_t *srcs, int64_t *dsts,
+                              int count, size_t block_size, uint64_t *rpc_ns) {
+    logical_batch2_params params;
+    params.handle = handle;
+    params.srcs.srcs_len = count;
+    params.srcs.srcs_val = srcs;
+    params.dsts.dsts_len = count;
+    params.dsts.dsts_val = dsts;
+    params.block_size = block_size;
+
+    struct timespec t_rpc0, t_rpc1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc0);
+    int rpc_res = -1;
+    enum clnt_stat st;
+    if (g_vers >= BLOCKCOPY_VERS2) {
+        st = write_logical_batch_2(&params, &rpc_res, clnt);
+    } else {
+        /* same layout; the version 1 bound on the arrays is MAX_BATCH */
+        logical_batch_params p1;
+        p1.handle = handle;
+        p1.srcs.srcs_len = count;
+        p1.srcs.srcs_val = srcs;
+        p1.dsts.dsts_len = count;
+        p1.dsts.dsts_val = dsts;
+        p1.block_size = block_size;
+        st = write_logical_batch_1(&p1, &rpc_res, clnt);
     }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc1);
 
-    for (size_t i = 0; i < fiemap->fm_mapped_extents; ++i) {
-        struct fiemap_extent *e = &fiemap->fm_extents[i];
+    if (st != RPC_SUCCESS || rpc_res == -1) {
+        fprintf(stderr, "RPC logical batch write failed\n");
+        return -1;
+    }
+    *rpc_ns += ns_diff(t_rpc0, t_rpc1);
+    return 0;
+}
 
-        vec[n].pba = e->fe_physical + (logical - e->fe_logical);
-        vec[n].len = length;
-        n++;
+/* A barrier may wait for every batch still queued in the socket buffers */
+#define BARRIER_TIMEOUT_SEC 300
+
+/*
+ * Send a batch as WRITE_PBA_ASYNC without waiting: with a zero timeout
+ * clnt_call flushes the request and returns RPC_TIMEDOUT at once. The
+ * server sends no reply; the batch's outcome comes with the next BARRIER.
+ */
+static int send_async(CLIENT *clnt, const struct pipe_batch *b, uint64_t *rpc_ns) {
+    async_batch_params params;
+    params.seq = b->seq;
+    params.pba_srcs.pba_srcs_len = b->count;
+    params.pba_srcs.pba_srcs_val = b->srcs;
+    params.pba_dsts.pba_dsts_len = b->count;
+    params.pba_dsts.pba_dsts_val = b->dsts;
+    params.lens.lens_len = b->split ? b->count : 0;
+    params.lens.lens_val = b->lens;
+    params.block_size = b->block_size;
+    g_enc_batches[ENC_PLAIN]++;
+    g_request_bytes += xdr_sizeof((xdrproc_t)xdr_async_batch_params, &params);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    struct timeval timeout = {0, 0};
+    enum clnt_stat st = clnt_call(clnt, WRITE_PBA_ASYNC, (xdrproc_t)xdr_async_batch_params,
+                                  (caddr_t)&params, (xdrproc_t)xdr_void, NULL, timeout);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    if (st != RPC_TIMEDOUT && st != RPC_SUCCESS) {
+        fprintf(stderr, "RPC async batch write failed\n");
+        return -1;
+    }
+    *rpc_ns += ns_diff(t0, t1);
+
+    if (b->seq >= g_async_cap) {
+        size_t cap = g_async_cap ? 2 * g_async_cap : 1024;
+        while (cap <= b->seq) cap *= 2;
+        long *copies = realloc(g_async_copies, cap * sizeof(*copies));
+        if (copies) g_async_copies = copies;
+        long *split = realloc(g_async_split, cap * sizeof(*split));
+        if (split) g_async_split = split;
+        if (!copies || !split) {
+            perror("realloc");
+            return -1;
+        }
+        g_async_cap = cap;
+    }
+    g_async_copies[b->seq] = b->copies;
+    g_async_split[b->seq] = b->split;
+    g_async_sent = b->seq + 1;
+    return 0;
+}
+
+/*
+ * Wait until the server has run and flushed every one-way batch sent on
+ * clnt so far. Returns -1 if one of them failed, naming the first.
+ */
+static int send_barrier(CLIENT *clnt, uint64_t *rpc_ns) {
+    barrier_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    struct timeval timeout = {BARRIER_TIMEOUT_SEC, 0};
+    enum clnt_stat st = clnt_call(clnt, BARRIER, (xdrproc_t)xdr_void, NULL,
+                                  (xdrproc_t)xdr_barrier_reply, (caddr_t)&reply, timeout);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    g_barriers++;
+    g_barrier_ns += ns_diff(t0, t1);
+    *rpc_ns += ns_diff(t0, t1);
+
+    if (st != RPC_SUCCESS || reply.result != 0) {
+        /* without a reply, or unflushed, nothing since the last barrier is confirmed */
+        uint64_t from = g_async_confirmed;
+        if (st != RPC_SUCCESS)
+            fprintf(stderr, "RPC barrier failed\n");
+        else if (reply.failed_seq == ~0ull)
+            fprintf(stderr, "Barrier: the server could not flush its devices\n");
+        else
+            fprintf(stderr, "Barrier: batch %llu failed on the server\n",
+                    (unsigned long long)(from = reply.failed_seq));
+        if (!g_async_failed || from < g_async_failed_from) g_async_failed_from = from;
+        g_async_failed = 1;
+        return -1;
     }
+    g_async_confirmed = g_async_sent;
+    return 0;
+}
 
-    if (n == 0) {
-        free(vec);
-        result = -1;
-        goto exit;
+/* pipe_send_fn: a batch of device copies, or of logical ones under -L */
+static int send_pipe_batch(CLIENT *clnt, const struct pipe_batch *b, uint64_t *rpc_ns) {
+    if (g_native) {
+        g_enc_batches[ENC_PLAIN]++;
+        g_request_bytes += NATIVE_HDR_LEN + native_copy_len(b->count, b->split > 0);
+        return native_copy(g_native, b->srcs, b->dsts, b->split ? b->lens : NULL, b->count,
+                           b->block_size, rpc_ns);
+    }
+    if (g_shm) {
+        g_enc_batches[ENC_PLAIN]++;
+        g_request_bytes += sizeof(struct shm_sqe) + native_copy_len(b->count, b->split > 0);
+        return shm_copy(g_shm, b->srcs, b->dsts, b->split ? b->lens : NULL, b->count,
+                        b->block_size, rpc_ns);
     }
+    if (g_async) {
+        if (send_async(clnt, b, rpc_ns) != 0) return -1;
+        if (g_barrier_every > 0 && (b->seq + 1) % g_barrier_every == 0)
+            return send_barrier(clnt, rpc_ns);
+        return 0;
+    }
+    if (b->handle)
+        return send_logical_batch(clnt, b->handle, b->srcs, b->dsts, b->count, b->block_size,
+                                  rpc_ns);
+    return send_batch(clnt, b->srcs, b->dsts, b->lens, b->count, b->split > 0, b->block_size,
+                      rpc_ns);
+}
 
-    *out = vec;
-    *out_cnt = n;
+/*
+ * Straight to g_rpc_port, no portmapper. The first connection asks for
+ * g_vers with a NULLPROC call and steps down if the server is older.
+ */
+static CLIENT *connect_direct(const char *host) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        return NULL;
+    }
+    struct sockaddr_in addr;
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    freeaddrinfo(res);
+    addr.sin_port = htons(g_rpc_port);
 
-exit:
-    free(fiemap);
+    int sock = RPC_ANYSOCK;
+    CLIENT *clnt = clnttcp_create(&addr, BLOCKCOPY_PROG, g_vers, &sock, 0, 0);
+    if (!clnt) {
+        clnt_pcreateerror(host);
+        return NULL;
+    }
+    if (g_vers_known) return clnt;
+
+    struct timeval tv = { 25, 0 };
+    enum clnt_stat st = clnt_call(clnt, NULLPROC, (xdrproc_t)xdr_void, NULL,
+                                  (xdrproc_t)xdr_void, NULL, tv);
+    if (st == RPC_PROGVERSMISMATCH) {
+        struct rpc_err rerr;
+        clnt_geterr(clnt, &rerr);
+        if (rerr.re_vers.high >= BLOCKCOPY_VERS && rerr.re_vers.high < g_vers) {
+            g_vers = rerr.re_vers.high;
+            clnt_control(clnt, CLSET_VERS, (char *)&g_vers);
+            st = RPC_SUCCESS;
+        }
+    }
+    if (st != RPC_SUCCESS) {
+        clnt_perror(clnt, host);
+        clnt_destroy(clnt);
+        return NULL;
+    }
+    g_vers_known = 1;
+    return clnt;
+}
 
-    clock_gettime(CLOCK_MONOTONIC_RAW, &t_after);
-    *fiemap_ns = ns_diff(t_before, t_after);
-    return result;
+/*
+ * A connection at the highest version up to g_vers the server speaks:
+ * borrowed from the agent (-a), direct to host:port, or through the
+ * portmapper. NULL on error.
+ */
+static CLIENT *connect_server(const char *host) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    CLIENT *clnt;
+    if (g_agent_path) {
+        if (!g_agent) g_agent = agent_connect(g_agent_path);
+        clnt = g_agent ? agent_session(g_agent, &g_vers) : NULL;
+    } else if (g_rpc_port) {
+        clnt = connect_direct(host);
+    } else {
+        clnt = clnt_create_vers(host, BLOCKCOPY_PROG, &g_vers, BLOCKCOPY_VERS, g_vers, "tcp");
+        if (!clnt) clnt_pcreateerror(host);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    if (g_connects++ == 0) g_first_connect_ns = ns_diff(t0, t1);
+    g_connect_ns += ns_diff(t0, t1);
+    return clnt;
 }
 
 static void usage(const char *prog) {
     fprintf(stderr,
-        "Usage: %s <server_hostname> <file_path> [options]\n"
+        "Usage: %s <server_hostname[:port]> <file_path> [options]\n"
+        "  A port (server_random -r) skips the portmapper\n"
         "Options:\n"
         "  -b block_number    # of blocks (1 block = 4096B, default: 1)\n"
         "  -n iterations      Number of random copies (default: 1000000)\n"
         "  -s seed            Random seed (default: current time)\n"
         "  -l                 Show progress log\n"
         "  -t                 Output results in CSV format\n"
-        "  -B (atch) size        Batch size for RPC (default: 100, max: 1024)\n",
-        prog);
+        "  -B (atch) size        Batch size for RPC (default: 100, max: 65536, 1024 with -P 1)\n"
+        "  -i index_file      Keep the file's extent map in index_file across runs\n"
+        "  -L                 Register the extent map with the server, send logical offsets\n"
+        "  -F                 No whole-file extent map: ranged FIEMAP per batch\n"
+        "  -c spans           Extent map windows spot-checked per batch (default: 1, 0: off)\n"
+        "  -P version         Protocol version (default: 2, or 1 if the server has only that)\n"
+        "  -E encoding        Version 2 batch encoding: plain, runs, delta (default: smallest)\n"
+        "  -q depth           Batches in flight (default: 1, max: %d)\n"
+        "  -K conns           RPC connections the batches in flight share\n"
+        "                     (default: one per batch, at most -q)\n"
+        "  -R policy          Connection for each batch with -K: rr (round robin) or least\n"
+        "                     (fewest batches outstanding; default)\n"
+        "  -N port            Send batches over the server's native transport on this port\n"
+        "  -U path            Same host: send batches through a shared-memory ring attached\n"
+        "                     at the server's Unix socket\n"
+        "  -Y usec            With -U, poll for completions this long before sleeping\n"
+        "                     (default: 0)\n"
+        "  -A every           Send batches one-way, without waiting for replies; a barrier\n"
+        "                     every this many batches and at the end reports failures\n"
+        "                     (0: only at the end)\n"
+        "  -a path            Borrow open connections from agent_random on this Unix socket\n"
+        "                     (\"-\": %s)\n",
+        prog, PIPE_MAX_DEPTH, AGENT_DEFAULT_PATH);
 }
 
-static uint64_t g_fiemap_ns = 0;
-static uint64_t g_rpc_total_ns = 0;
-
 int main(int argc, char *argv[]) {
     if (argc < 3) {
         usage(argv[0]);
         return 1;
     }
 
-    const char *server_host = argv[1];
+    // host or host:port
+    char server_host[256];
+    const char *colon = strrchr(argv[1], ':');
+    size_t host_len = colon ? (size_t)(colon - argv[1]) : strlen(argv[1]);
+    if (host_len >= sizeof(server_host)) {
+        fprintf(stderr, "Server host name too long\n");
+        return 1;
+    }
+    memcpy(server_host, argv[1], host_len);
+    server_host[host_len] = '\0';
+    if (colon) {
+        g_rpc_port = atoi(colon + 1);
+        if (g_rpc_port <= 0 || g_rpc_port > 65535) {
+            fprintf(stderr, "Port must be between 1 and 65535.\n");
+            return 1;
+        }
+    }
     const char *path = argv[2];
 
     /* Options */
@@ -128,9 +594,19 @@ int main(int argc, char *argv[]) {
     int log = 0;
     int csv = 0;
     int batch_size = 100;  // Default batch size
+    const char *index_path = NULL;
+    int logical = 0;
+    int ranged = 0;
+    int checks = EXTENT_CHECKS_PER_BATCH;
+    int depth = 1;
+    const char *native_port = NULL;
+    const char *shm_path = NULL;
+    long spin_us = 0;
+    int nconns = 0;
+    enum pipe_policy policy = PIPE_LEAST_OUTSTANDING;
 
     int opt;
-    while ((opt = getopt(argc, argv, "b:n:s:ltB:")) != -1) {
+    while ((opt = getopt(argc, argv, "b:n:s:ltB:i:LFc:P:E:q:K:R:N:U:Y:A:a:")) != -1) {
         switch (opt) {
         case 'b': {
             int block_num = strtoul(optarg, NULL, 10);
@@ -156,10 +632,88 @@ int main(int argc, char *argv[]) {
         case 't':
             csv = 1;
             break;
+        case 'i':
+            index_path = optarg;
+            break;
+        case 'L':
+            logical = 1;
+            break;
+        case 'F':
+            ranged = 1;
+            break;
+        case 'c':
+            checks = atoi(optarg);
+            if (checks < 0) checks = 0;
+            break;
+        case 'E':
+            if (strcmp(optarg, "plain") == 0) g_encoding = ENC_PLAIN;
+            else if (strcmp(optarg, "runs") == 0) g_encoding = ENC_RUNS;
+            else if (strcmp(optarg, "delta") == 0) g_encoding = ENC_DELTA;
+            else {
+                fprintf(stderr, "Encoding must be plain, runs or delta\n");
+                return 1;
+            }
+            break;
         case 'B':
             batch_size = atoi(optarg);
-            if (batch_size <= 0 || batch_size > MAX_BATCH) {
-                fprintf(stderr, "Batch size must be between 1 and %d\n", MAX_BATCH);
+            if (batch_size <= 0 || batch_size > MAX_BATCH2) {
+                fprintf(stderr, "Batch size must be between 1 and %d\n", MAX_BATCH2);
+                return 1;
+            }
+            break;
+        case 'q':
+            depth = atoi(optarg);
+            if (depth < 1 || depth > PIPE_MAX_DEPTH) {
+                fprintf(stderr, "Depth must be between 1 and %d\n", PIPE_MAX_DEPTH);
+                return 1;
+            }
+            break;
+        case 'K':
+            nconns = atoi(optarg);
+            if (nconns < 1 || nconns > PIPE_MAX_DEPTH) {
+                fprintf(stderr, "Connections must be between 1 and %d\n", PIPE_MAX_DEPTH);
+                return 1;
+            }
+            break;
+        case 'R':
+            if (strcmp(optarg, "rr") == 0) {
+                policy = PIPE_ROUND_ROBIN;
+            } else if (strcmp(optarg, "least") == 0) {
+                policy = PIPE_LEAST_OUTSTANDING;
+            } else {
+                fprintf(stderr, "Policy must be rr or least.\n");
+                return 1;
+            }
+            break;
+        case 'N':
+            native_port = optarg;
+            break;
+        case 'U':
+            shm_path = optarg;
+            break;
+        case 'Y':
+            spin_us = strtol(optarg, NULL, 10);
+            if (spin_us < 0) {
+                fprintf(stderr, "Spin time must not be negative.\n");
+                return 1;
+            }
+            break;
+        case 'A':
+            g_async = 1;
+            g_barrier_every = strtol(optarg, NULL, 10);
+            if (g_barrier_every < 0) {
+                fprintf(stderr, "Barrier interval must not be negative.\n");
+                return 1;
+            }
+            break;
+        case 'a':
+            g_agent_path = strcmp(optarg, "-") == 0 ? AGENT_DEFAULT_PATH : optarg;
+            break;
+        case 'P':
+            g_vers = strtoul(optarg, NULL, 10);
+            if (g_vers < BLOCKCOPY_VERS || g_vers > BLOCKCOPY_VERS2) {
+                fprintf(stderr, "Protocol version must be %d or %d\n", BLOCKCOPY_VERS,
+                        BLOCKCOPY_VERS2);
                 return 1;
             }
             break;
@@ -168,6 +722,34 @@ int main(int argc, char *argv[]) {
             return 1;
         }
     }
+    if (ranged && (logical || index_path)) {
+        fprintf(stderr, "-F keeps no whole-file map; it cannot be combined with -L or -i\n");
+        return 1;
+    }
+    if (native_port && logical) {
+        fprintf(stderr, "-N carries device copies only; it cannot be combined with -L\n");
+        return 1;
+    }
+    if (shm_path && (logical || native_port)) {
+        fprintf(stderr, "-U carries device copies only; it cannot be combined with -L or -N\n");
+        return 1;
+    }
+    if (nconns > depth) {
+        fprintf(stderr, "-K %d: more connections than batches in flight (-q %d)\n", nconns,
+                depth);
+        return 1;
+    }
+    if (nconns > 1 && (native_port || shm_path)) {
+        fprintf(stderr, "-K spreads RPC batches; -N and -U have one connection each\n");
+        return 1;
+    }
+    // One RPC connection per batch in flight unless -K says otherwise
+    if (nconns == 0) nconns = native_port || shm_path ? 1 : depth;
+    if (g_async && (logical || native_port || shm_path || depth > 1)) {
+        fprintf(stderr, "-A streams device copies on one RPC connection; it cannot be combined "
+                        "with -L, -N, -U or -q\n");
+        return 1;
+    }
 
     struct timespec t_total0, t_total1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total0);
@@ -177,16 +759,25 @@ int main(int argc, char *argv[]) {
 
     srand(seed);
 
-    // RPC connect
-    CLIENT *clnt = clnt_create(server_host, BLOCKCOPY_PROG, BLOCKCOPY_VERS, "tcp");
-    if (!clnt) {
-        clnt_pcreateerror(server_host);
+    // RPC connect, at the highest version up to g_vers the server speaks
+    CLIENT *clnt = connect_server(server_host);
+    if (!clnt) exit(1);
+    int max_batch = g_vers >= BLOCKCOPY_VERS2 ? MAX_BATCH2 : MAX_BATCH;
+    if (g_async && g_vers < BLOCKCOPY_VERS2) {
+        fprintf(stderr, "-A needs protocol version 2\n");
+        clnt_destroy(clnt);
+        exit(1);
+    }
+    if (batch_size > max_batch) {
+        fprintf(stderr, "Batch size must be at most %d with protocol version %lu\n", max_batch,
+                (unsigned long)g_vers);
+        clnt_destroy(clnt);
         exit(1);
     }
 
     {
-        void *res = reset_time_1(NULL, clnt);
-        if (res == NULL) {
+        char res;
+        if (reset_time_1(NULL, &res, clnt) != RPC_SUCCESS) {
             fprintf(stderr, "RPC reset server time failed\n");
             clnt_destroy(clnt);
             exit(1);
@@ -207,14 +798,54 @@ int main(int argc, char *argv[]) {
     }
     off_t filesize = st.st_size;
 
+    // Whole-file extent map: FIEMAP once here (or none with a valid -i index)
+    struct extent_map map;
+    memset(&map, 0, sizeof(map));
+    map.fd = fd;
+    map.st = st;
+    if (!ranged && extent_map_open(&map, fd, index_path) != 0) {
+        fprintf(stderr, "cannot read the extent map of %s\n", path);
+        exit(1);
+    }
+
+    // -L: the server keeps the map; copies then go out by logical offset
+    u_int handle = 0;
+    if (logical && (handle = register_map(clnt, &map)) == 0) exit(1);
+
+    // Batches go out on clnt, or with -q spread over nconns connections of
+    // their own while the next one is built; -N multiplexes them on one
+    // native connection, -U on one ring with a slot per batch in flight
+    CLIENT *pipe_clnts[PIPE_MAX_DEPTH];
+    int own_clnts = nconns > 1;
+    pipe_clnts[0] = clnt;
+    for (int k = 0; own_clnts && k < nconns; k++)
+        if (!(pipe_clnts[k] = connect_server(server_host))) exit(1);
+    if (native_port && !(g_native = native_connect(server_host, native_port))) exit(1);
+    if (shm_path && !(g_shm = shm_connect(shm_path, depth, max_batch, spin_us))) exit(1);
+    struct client_pipe pipe;
+    if (pipe_init(&pipe, pipe_clnts, nconns, depth, max_batch, send_pipe_batch, policy) != 0)
+        exit(1);
+
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_prep1);
 
-    // Allocate batch parameters
-    pba_batch_params batch_params;
-    
+    // Logical offsets of the batch's copies, and the pieces of the one being translated
+    int64_t *copy_srcs = malloc(batch_size * sizeof(*copy_srcs));
+    int64_t *copy_dsts = malloc(batch_size * sizeof(*copy_dsts));
+    uint64_t *fiemap_offs = malloc(2 * batch_size * sizeof(*fiemap_offs));
+    int64_t piece_srcs[MAX_BATCH], piece_dsts[MAX_BATCH];
+    uint32_t piece_lens[MAX_BATCH];
+    if (!copy_srcs || !copy_dsts || !fiemap_offs) {
+        perror("malloc");
+        exit(1);
+    }
+
+    // Copies requested and skipped; the pipe counts those the server ran
+    long skipped = 0, batches = 0;
+    int failed = 0;
+
     // Test Start
     long i = 0;
-    while (i < iterations) {
+    while (i < iterations && !failed) {
         if (log && (i % 1000 == 0)) {
             struct timespec now_ts;
             clock_gettime(CLOCK_MONOTONIC_RAW, &now_ts);
@@ -227,79 +858,147 @@ int main(int argc, char *argv[]) {
                     i, iterations, (double)i / iterations * 100.0, elapsed);
         }
 
+        // Re-read the extent map if the file changed since the last batch,
+        // otherwise spot-check part of it for blocks moved behind our back
+        struct timespec t_map0, t_map1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_map0);
+        int refreshed = ranged ? 0 : extent_map_refresh(&map);
+        if (refreshed == 0 && !ranged && checks > 0) {
+            int moved = extent_map_check(&map, checks);
+            refreshed = moved < 0 ? -1 : moved > 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_map1);
+        g_fiemap_ns += ns_diff(t_map0, t_map1);
+        if (refreshed < 0) {
+            fprintf(stderr, "cannot re-read the extent map\n");
+            break;
+        }
+        if (refreshed > 0) {
+            filesize = map.st.st_size;
+            // batches in flight still name the old map: let them finish first
+            if (logical) {
+                if (pipe_drain(&pipe) != 0) {
+                    failed = 1;
+                    break;
+                }
+                unregister_map(clnt, handle);
+                if ((handle = register_map(clnt, &map)) == 0) break;
+            }
+        }
+
         off_t max_blocks = filesize / block_size;
         if (max_blocks == 0) {
             fprintf(stderr, "File too small for chosen block size.\n");
             break;
         }
 
-        // Collect batch_size operations
-        int batch_count = 0;
-        for (int b = 0; b < batch_size && i < iterations; b++, i++) {
+        // Draw batch_size copies by logical offset
+        int ncopies = 0;
+        for (; ncopies < batch_size && i < iterations; ncopies++, i++) {
             // RANDOM source / dest blocks
             off_t src_blk = rand() % max_blocks;
             off_t dst_blk = rand() % max_blocks;
             while (src_blk == dst_blk) dst_blk = rand() % max_blocks;
 
-            off_t src_logical = src_blk * block_size;
-            off_t dst_logical = dst_blk * block_size;
-
-            pba_seg *src_pba = NULL;
-            pba_seg *dst_pba = NULL;
-            size_t src_pba_cnt = 0, dst_pba_cnt = 0;
-
-            uint64_t fiemap_ns0 = 0, fiemap_ns1 = 0;
+            copy_srcs[ncopies] = src_blk * block_size;
+            copy_dsts[ncopies] = dst_blk * block_size;
+        }
+        batches++;
+
+        // -L: no translation here, the server splits at extent boundaries
+        if (logical) {
+            struct pipe_batch *batch = pipe_get(&pipe);
+            if (!batch) break;
+            memcpy(batch->srcs, copy_srcs, ncopies * sizeof(batch->srcs[0]));
+            memcpy(batch->dsts, copy_dsts, ncopies * sizeof(batch->dsts[0]));
+            batch->count = ncopies;
+            batch->block_size = block_size;
+            batch->handle = handle;
+            batch->copies = ncopies;
+            if (pipe_put(&pipe, batch) != 0) break;
+            continue;
+        }
 
-            if (get_pba(fd, src_logical, block_size,
-                        &src_pba, &src_pba_cnt, &fiemap_ns0) != 0)
-                continue;
+        // -F: fetch only the extents this batch touches, in a few ranged FIEMAPs
+        if (ranged) {
+            memcpy(fiemap_offs, copy_srcs, ncopies * sizeof(fiemap_offs[0]));
+            memcpy(fiemap_offs + ncopies, copy_dsts, ncopies * sizeof(fiemap_offs[0]));
+            struct timespec t_fm0, t_fm1;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_fm0);
+            int calls = extent_map_load_ranges(&map, fd, fiemap_offs, 2 * ncopies, block_size,
+                                               EXTENT_MERGE_GAP);
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_fm1);
+            g_fiemap_ns += ns_diff(t_fm0, t_fm1);
+            if (calls < 0) {
+                fprintf(stderr, "cannot read the extents of a batch\n");
+                break;
+            }
+        }
 
-            if (get_pba(fd, dst_logical, block_size,
-                        &dst_pba, &dst_pba_cnt, &fiemap_ns1) != 0) {
-                free(src_pba);
+        // Translate; a split copy takes one entry per piece
+        struct pipe_batch *batch = NULL;
+        for (int b = 0; b < ncopies; b++) {
+            off_t src_logical = copy_srcs[b];
+            off_t dst_logical = copy_dsts[b];
+
+            struct timespec t_fm0, t_fm1;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_fm0);
+            int n = split_copy(&map, src_logical, dst_logical, block_size,
+                               piece_srcs, piece_dsts, piece_lens);
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_fm1);
+            g_fiemap_ns += ns_diff(t_fm0, t_fm1);
+            if (n < 0) {
+                skipped++;
                 continue;
             }
 
-            if (src_pba_cnt != dst_pba_cnt) {
-                fprintf(stderr, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
-                fprintf(stderr, "Number of extents are not same. src_pba_cnt: %lu, dst_pba_cnt: %lu\n",
-                        (unsigned long)src_pba_cnt, (unsigned long)dst_pba_cnt);
-                free(src_pba);
-                free(dst_pba);
-                continue;
+            // No room for every piece: send what we have first
+            if (batch && batch->count + n > (uint32_t)max_batch) {
+                if (pipe_put(&pipe, batch) != 0) {
+                    failed = 1;
+                    break;
+                }
+                batch = NULL;
+            }
+            if (!batch) {
+                if (!(batch = pipe_get(&pipe))) {
+                    failed = 1;
+                    break;
+                }
+                batch->block_size = block_size;
             }
 
             // Add to batch
-            batch_params.pba_srcs[batch_count] = src_pba[0].pba;
-            batch_params.pba_dsts[batch_count] = dst_pba[0].pba;
-            batch_count++;
-
-            free(src_pba);
-            free(dst_pba);
-
-            g_fiemap_ns += fiemap_ns0 + fiemap_ns1;
+            memcpy(&batch->srcs[batch->count], piece_srcs, n * sizeof(piece_srcs[0]));
+            memcpy(&batch->dsts[batch->count], piece_dsts, n * sizeof(piece_dsts[0]));
+            memcpy(&batch->lens[batch->count], piece_lens, n * sizeof(piece_lens[0]));
+            batch->count += n;
+            batch->copies++;
+            if (n > 1) batch->split++;
         }
 
         // Send batched RPC call
-        if (batch_count > 0) {
-            batch_params.count = batch_count;
-            batch_params.block_size = block_size;
-
-            struct timespec t_rpc0, t_rpc1;
-            clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc0);
-            int *rpc_res = write_pba_batch_1(&batch_params, clnt);
-            clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc1);
-
-            uint64_t rpc_total_ns = ns_diff(t_rpc0, t_rpc1);
+        if (!failed && batch && pipe_put(&pipe, batch) != 0) break;
+    }
 
-            if (rpc_res == NULL || *rpc_res == -1) {
-                fprintf(stderr, "RPC batch write failed\n");
-                break;
+    // Wait for the batches still in flight; -A: until the server has run
+    // and flushed them. Any failure makes the run fail.
+    if (pipe_drain(&pipe) != 0) failed = 1;
+    long executed = pipe.copies, split_copies = pipe.split;
+    g_rpc_total_ns = pipe.wait_ns;
+    if (g_async) {
+        if (send_barrier(clnt, &g_rpc_total_ns) != 0) failed = 1;
+        // One-way batches count once a barrier confirmed them
+        if (g_async_failed) {
+            executed = split_copies = 0;
+            for (uint64_t s = 0; s < g_async_failed_from && s < g_async_sent; s++) {
+                executed += g_async_copies[s];
+                split_copies += g_async_split[s];
             }
-
-            g_rpc_total_ns += rpc_total_ns;
         }
     }
+    free(g_async_copies);
+    free(g_async_split);
 
     if (log) {
         struct timespec now_ts;
@@ -316,19 +1015,43 @@ int main(int argc, char *argv[]) {
     struct timespec t_end0, t_end1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_end0);
 
+    size_t map_extents = map.n;
+    extent_map_free(&map);
     close(fd);
+    double lat_mean, lat_p50, lat_p99, lat_max;
+    pipe_latency(&pipe, &lat_mean, &lat_p50, &lat_p99, &lat_max);
+    uint64_t pipe_batches = pipe.next_seq;
+    int peak = pipe.peak;
+    struct pipe_conn conns[PIPE_MAX_DEPTH];
+    memcpy(conns, pipe.conns, nconns * sizeof(conns[0]));
+    pipe_free(&pipe);
+    for (int k = 0; own_clnts && k < nconns; k++) clnt_destroy(pipe_clnts[k]);
+    if (g_native) native_close(g_native);
+    if (g_shm) shm_close(g_shm);
+    free(copy_srcs);
+    free(copy_dsts);
+    free(fiemap_offs);
 
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total1);
     t_end1 = t_total1;
 
     // Get server time
-    get_server_ios *time_res = get_time_1(NULL, clnt);
-    if (time_res == NULL) {
+    get_server_ios time_out;
+    get_server_ios *time_res = &time_out;
+    if (get_time_1(NULL, time_res, clnt) != RPC_SUCCESS) {
         fprintf(stderr, "RPC get server time failed\n");
         clnt_destroy(clnt);
         exit(1);
     }
+
+    // Named server counters; older servers do not implement GET_STATS
+    stat_list server_stats;
+    memset(&server_stats, 0, sizeof(server_stats));
+    if (get_stats_1(NULL, &server_stats, clnt) != RPC_SUCCESS)
+        memset(&server_stats, 0, sizeof(server_stats));
+    unregister_map(clnt, handle);
     clnt_destroy(clnt);
+    if (g_agent) agent_release(g_agent);
 
     uint64_t server_read_ns  = time_res->server_read_time;
     uint64_t server_write_ns = time_res->server_write_time;
@@ -339,10 +1062,11 @@ int main(int argc, char *argv[]) {
     uint64_t end_ns   = ns_diff(t_end0, t_end1);
     uint64_t fiemap_ns = g_fiemap_ns;
 
-    uint64_t rpc_ns = g_rpc_total_ns
-                      - server_read_ns
-                      - server_write_ns
-                      - server_other_ns;
+    // With -q or -A the server's time overlaps the client's and may exceed
+    // the time spent waiting on it, so the split is not exact there
+    int overlapped = depth > 1 || g_async;
+    uint64_t server_ns = server_read_ns + server_write_ns + server_other_ns;
+    uint64_t rpc_ns = g_rpc_total_ns > server_ns || !overlapped ? g_rpc_total_ns - server_ns : 0;
 
     uint64_t io_ns = total_ns
                      - prep_ns
@@ -350,13 +1074,14 @@ int main(int argc, char *argv[]) {
                      - fiemap_ns
                      - g_rpc_total_ns;
 
-    if (prep_ns + end_ns + fiemap_ns + rpc_ns
+    if (!overlapped && prep_ns + end_ns + fiemap_ns + rpc_ns
         + server_read_ns + server_write_ns + server_other_ns + io_ns != total_ns) {
         fprintf(stderr, "Time calculation failed. Do not match with total_ns\n");
         exit(1);
     }
 
-    long long total_bytes = (long long)iterations * block_size;
+    // Only copies the server ran count towards throughput
+    long long total_bytes = (long long)executed * block_size;
     double throughput_mbps = (total_bytes / (1024.0 * 1024.0))
                              / get_elapsed(total_ns);
 
@@ -364,7 +1089,7 @@ int main(int argc, char *argv[]) {
         printf("%lu,%ld,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n",
                block_size / ALIGN,
                iterations,
-               block_size / ALIGN * iterations,
+               block_size / ALIGN * executed,
                (double)filesize / (1024.0 * 1024.0 * 1024.0),
                get_elapsed(server_read_ns),
                get_elapsed(server_write_ns),
@@ -376,12 +1101,19 @@ int main(int argc, char *argv[]) {
                get_elapsed(io_ns),
                get_elapsed(total_ns),
                batch_size);
-        return 0;
+        return failed ? 1 : 0;
     }
 
     printf("\n\n");
     printf("------------ RPC Test Results ------------\n");
-    printf("Iterations attempted: %ld\n", iterations);
+    printf("Iterations attempted: %ld\n", i);
+    printf("Copies executed: %ld (%ld split at extent boundaries, %ld skipped)\n",
+           executed, split_copies, skipped);
+    if (g_async_failed)
+        printf("FAILED: batches from %llu on were not confirmed by a barrier and are not "
+               "counted\n", (unsigned long long)g_async_failed_from);
+    else if (failed)
+        printf("FAILED: a batch failed; the run stopped early\n");
     printf("Block size: %zu bytes\n", block_size);
     printf("Batch size: %d\n", batch_size);
     printf("Seed: %ld\n", seed);
@@ -392,9 +1124,62 @@ int main(int argc, char *argv[]) {
     printf("  Write Elapsed time: %.3f seconds\n", get_elapsed(server_write_ns));
     printf("  Other Elapsed time: %.3f seconds\n", get_elapsed(server_other_ns));
     printf("\n");
+    if (server_stats.stat_list_len > 0) {
+        printf("Server Stats: \n");
+        for (u_int k = 0; k < server_stats.stat_list_len; k++)
+            printf("  %s: %llu\n", server_stats.stat_list_val[k].name,
+                   (unsigned long long)server_stats.stat_list_val[k].value);
+        printf("\n");
+    }
     printf("Client Main Result: \n");
     printf("  Fiemap Elapsed time: %.3f seconds\n", get_elapsed(fiemap_ns));
+    printf("  Extent map: %zu extents, %llu loads%s\n", map_extents,
+           (unsigned long long)map.loads, map.index_hit ? " (index reused)" : "");
+    printf("  Fiemap calls: %llu (%.2f per batch)\n", (unsigned long long)map.fiemap_calls,
+           batches ? (double)map.fiemap_calls / batches : 0.0);
+    printf("  Extent checks: %llu windows, %llu ranges re-mapped\n",
+           (unsigned long long)map.checks, (unsigned long long)map.remaps);
     printf("  RPC Elapsed time: %.3f seconds\n", get_elapsed(rpc_ns));
+    if (g_request_bytes > 0)
+        printf("  Request bytes: %llu (%.1f per copy; batches: %ld plain, %ld runs, %ld delta)\n",
+               (unsigned long long)g_request_bytes,
+               executed ? (double)g_request_bytes / executed : 0.0,
+               g_enc_batches[ENC_PLAIN], g_enc_batches[ENC_RUNS], g_enc_batches[ENC_DELTA]);
+    printf("  Connect: %d connections, %.1f us first, %.1f us mean (%s)\n", g_connects,
+           g_first_connect_ns / 1e3, g_connects ? g_connect_ns / 1e3 / g_connects : 0.0,
+           g_agent_path ? "agent" : g_rpc_port ? "direct" : "portmapper");
+    printf("  Batch latency: %.1f us mean, %.1f p50, %.1f p99, %.1f max (%llu batches, "
+           "up to %d in flight)\n", lat_mean, lat_p50, lat_p99, lat_max,
+           (unsigned long long)pipe_batches, peak);
+    if (nconns > 1) {
+        printf("  Connections: %d (%s)\n", nconns,
+               policy == PIPE_ROUND_ROBIN ? "round robin" : "least outstanding");
+        for (int k = 0; k < nconns; k++)
+            printf("    conn %d: %llu batches, %ld copies, %.1f us mean round trip, "
+                   "%.3f s busy\n", k, (unsigned long long)conns[k].batches, conns[k].copies,
+                   conns[k].batches ? conns[k].busy_ns / 1e3 / conns[k].batches : 0.0,
+                   get_elapsed(conns[k].busy_ns));
+    }
+    if (g_async && g_barrier_every > 0)
+        printf("  Barriers: %ld, %.1f us mean wait (every %ld batches and at the end)\n",
+               g_barriers, g_barriers ? g_barrier_ns / 1e3 / g_barriers : 0.0,
+               g_barrier_every);
+    else if (g_async)
+        printf("  Barriers: %ld, %.1f us mean wait (at the end)\n", g_barriers,
+               g_barriers ? g_barrier_ns / 1e3 / g_barriers : 0.0);
+    // Round trip beyond the server's own time: the transport's cost per batch
+    if (pipe_batches > 0) {
+        double overhead_us = lat_mean - get_elapsed(server_ns) * 1e6 / pipe_batches;
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        double cpu_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6
+                      + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+        printf("  Transport: %s, %.1f us per batch over server time (%.2f us per copy), "
+               "client CPU %.2f us per copy\n",
+               g_native ? "native" : g_shm ? "shm" : g_async ? "async" : "rpc", overhead_us,
+               executed ? overhead_us * pipe_batches / executed : 0.0,
+               executed ? cpu_us / executed : 0.0);
+    }
     printf("  I/O Elapsed time: %.3f seconds\n", get_elapsed(io_ns));
     printf("\n");
     printf("Client Other Result: \n");
@@ -413,5 +1198,5 @@ int main(int argc, char *argv[]) {
     printf("  Approx throughput: %.2f MB/s\n", throughput_mbps);
     printf("------------------------------------------\n");
 
-    return 0;
+    return failed ? 1 : 0;
 }
\ No newline at end of file
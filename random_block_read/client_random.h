@@ -4,6 +4,10 @@
 #define DEFAULT_BLOCK_SIZE 4096
 #define DEFAULT_ITERS 1000000
 #define ALIGN 4096
-#define EXTENTS_MAX 1
+#define EXTENT_CHECKS_PER_BATCH 1  /* extent map windows spot-checked per batch (-c) */
+
+/* Batch encodings besides the protocol's ENC_RUNS and ENC_DELTA (-E) */
+#define ENC_PLAIN 0   /* counted arrays */
+#define ENC_AUTO 3    /* smallest of the three, per batch */
 
 #endif
@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include "client_shm.h"
+#include "native_proto.h"
+#include "shm_ring.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A caller waiting for the completion of the batch in its slot */
+struct shm_call {
+    uint64_t id;
+    int done;
+    int result;
+};
+
+struct shm_client {
+    int sock;
+    int sq_efd;
+    int cq_efd;
+    void *base;
+    size_t size;
+    uint32_t entries;
+    uint32_t slot_bytes;
+    uint64_t spin_ns;
+    pthread_mutex_t lock;       /* everything below, and the client's ring indexes */
+    pthread_cond_t cond;
+    struct shm_call *pending[SHM_MAX_ENTRIES];  /* by slot */
+    uint32_t sq_tail;
+    uint32_t cq_head;
+    uint64_t next_id;
+    int reading;                /* a caller is waiting on the ring for everyone */
+    int dead;                   /* the server let go of the ring */
+};
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull
+         + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+/* Hand the memfd and both eventfds to the server; 0 once it accepts them */
+static int send_fds(int sock, int memfd, int sq_efd, int cq_efd) {
+    int fds[3] = { memfd, sq_efd, cq_efd };
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&u, 0, sizeof(u));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) return -1;
+
+    char status;
+    if (recv(sock, &status, 1, 0) != 1 || status != 0) return -1;
+    return 0;
+}
+
+struct shm_client *shm_connect(const char *path, uint32_t entries, uint32_t max_copies,
+                               long spin_us) {
+    struct shm_client *sc = calloc(1, sizeof(*sc));
+    if (!sc) return NULL;
+    sc->sock = sc->sq_efd = sc->cq_efd = -1;
+
+    uint32_t n = 1;
+    while (n < entries && n < SHM_MAX_ENTRIES) n <<= 1;
+    sc->entries = n;
+    if (max_copies > NATIVE_MAX_COPIES) max_copies = NATIVE_MAX_COPIES;
+    sc->slot_bytes = (native_copy_len(max_copies, 1) + SHM_PAGE - 1) / SHM_PAGE * SHM_PAGE;
+    sc->size = shm_ring_size(sc->entries, sc->slot_bytes);
+    sc->spin_ns = spin_us > 0 ? (uint64_t)spin_us * 1000 : 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "shm: socket path too long\n");
+        free(sc);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int memfd = memfd_create("blockcopy-ring", MFD_CLOEXEC);
+    if (memfd < 0 || ftruncate(memfd, sc->size) != 0) {
+        perror("shm memfd");
+        goto fail;
+    }
+    sc->base = mmap(NULL, sc->size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (sc->base == MAP_FAILED) {
+        sc->base = NULL;
+        perror("shm mmap");
+        goto fail;
+    }
+    struct shm_ring_hdr *h = sc->base;
+    h->magic = SHM_MAGIC;
+    h->version = SHM_VERSION;
+    h->entries = sc->entries;
+    h->slot_bytes = sc->slot_bytes;
+
+    sc->sq_efd = eventfd(0, EFD_CLOEXEC);
+    sc->cq_efd = eventfd(0, EFD_CLOEXEC);
+    sc->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sc->sq_efd < 0 || sc->cq_efd < 0 || sc->sock < 0 ||
+        connect(sc->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("shm connect");
+        goto fail;
+    }
+    if (send_fds(sc->sock, memfd, sc->sq_efd, sc->cq_efd) != 0) {
+        fprintf(stderr, "shm: server refused the ring\n");
+        goto fail;
+    }
+    close(memfd);
+
+    pthread_mutex_init(&sc->lock, NULL);
+    pthread_cond_init(&sc->cond, NULL);
+    return sc;
+
+fail:
+    if (memfd >= 0) close(memfd);
+    if (sc->base) munmap(sc->base, sc->size);
+    if (sc->sq_efd >= 0) close(sc->sq_efd);
+    if (sc->cq_efd >= 0) close(sc->cq_efd);
+    if (sc->sock >= 0) close(sc->sock);
+    free(sc);
+    return NULL;
+}
+
+/* Hand every posted completion to its caller; under the lock */
+static int reap(struct shm_client *sc) {
+    struct shm_ring_hdr *h = sc->base;
+    struct shm_cqe *cq = shm_cq(sc->base, sc->entries);
+    uint32_t tail = atomic_load_explicit(&h->cq_tail, memory_order_acquire);
+    int n = 0;
+    for (; sc->cq_head != tail; sc->cq_head++, n++) {
+        struct shm_cqe e = cq[sc->cq_head & (sc->entries - 1)];
+        struct shm_call *call = e.slot < sc->entries ? sc->pending[e.slot] : NULL;
+        if (call && call->id == e.id) {
+            call->result = e.result;
+            call->done = 1;
+        }
+    }
+    if (n > 0) {
+        atomic_store_explicit(&h->cq_head, sc->cq_head, memory_order_release);
+        pthread_cond_broadcast(&sc->cond);
+    }
+    return n;
+}
+
+/*
+ * Wait, without the lock, until the server posts past cq_head: spin for
+ * -Y, then sleep on the eventfd. Returns -1 when the server is gone.
+ */
+static int wait_cq(struct shm_client *sc, uint32_t head) {
+    struct shm_ring_hdr *h = sc->base;
+    if (sc->spin_ns) {
+        uint64_t deadline = now_ns() + sc->spin_ns;
+        while (atomic_load_explicit(&h->cq_tail, memory_order_acquire) == head &&
+               now_ns() < deadline)
+            shm_cpu_relax();
+        if (atomic_load_explicit(&h->cq_tail, memory_order_acquire) != head) return 0;
+    }
+
+    atomic_store(&h->client_sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    int rc = 0;
+    if (atomic_load_explicit(&h->cq_tail, memory_order_acquire) == head) {
+        struct pollfd p[2] = { { sc->cq_efd, POLLIN, 0 }, { sc->sock, POLLIN, 0 } };
+        if (poll(p, 2, -1) < 0 && errno != EINTR) rc = -1;
+        if (p[0].revents & POLLIN) {
+            uint64_t v;
+            if (read(sc->cq_efd, &v, sizeof(v)) < 0) rc = -1;
+        }
+        if (p[1].revents) rc = -1;
+    }
+    atomic_store(&h->client_sleeping, 0);
+    return rc;
+}
+
+int shm_copy(struct shm_client *sc, const int64_t *srcs, const int64_t *dsts,
+             const uint32_t *lens, uint32_t count, uint32_t block_size, uint64_t *rpc_ns) {
+    struct shm_ring_hdr *h = sc->base;
+    uint32_t body = native_copy_len(count, lens != NULL);
+    if (count > NATIVE_MAX_COPIES || body > sc->slot_bytes) {
+        fprintf(stderr, "shm: batch of %u copies does not fit a slot\n", count);
+        return -1;
+    }
+
+    /* a free slot is also a free ring entry: at most entries are ever in flight */
+    struct shm_call call = { 0, 0, -1 };
+    uint32_t k = 0;
+    pthread_mutex_lock(&sc->lock);
+    while (!sc->dead) {
+        for (k = 0; k < sc->entries && sc->pending[k]; k++)
+            ;
+        if (k < sc->entries) break;
+        pthread_cond_wait(&sc->cond, &sc->lock);
+    }
+    if (sc->dead) {
+        pthread_mutex_unlock(&sc->lock);
+        fprintf(stderr, "shm: server detached\n");
+        return -1;
+    }
+    call.id = sc->next_id++;
+    sc->pending[k] = &call;
+    pthread_mutex_unlock(&sc->lock);
+
+    native_copy_encode(shm_slot(sc->base, sc->entries, sc->slot_bytes, k), srcs, dsts, lens,
+                       count, block_size);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    pthread_mutex_lock(&sc->lock);
+    struct shm_sqe *e = &shm_sq(sc->base)[sc->sq_tail & (sc->entries - 1)];
+    e->id = call.id;
+    e->slot = k;
+    e->len = body;
+    e->flags = lens ? NATIVE_LENS : 0;
+    e->pad = 0;
+    atomic_store_explicit(&h->sq_tail, ++sc->sq_tail, memory_order_release);
+
+    /* pairs with the fence the server runs after raising server_sleeping */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&h->server_sleeping, memory_order_relaxed)) {
+        uint64_t one = 1;
+        if (write(sc->sq_efd, &one, sizeof(one)) != sizeof(one)) sc->dead = 1;
+    }
+
+    /* one waiter at a time watches the completion ring, for itself and the others */
+    while (!call.done && !sc->dead) {
+        if (reap(sc) > 0) continue;
+        if (sc->reading) {
+            pthread_cond_wait(&sc->cond, &sc->lock);
+            continue;
+        }
+        sc->reading = 1;
+        uint32_t head = sc->cq_head;
+        pthread_mutex_unlock(&sc->lock);
+        int rc = wait_cq(sc, head);
+        pthread_mutex_lock(&sc->lock);
+        sc->reading = 0;
+        if (rc != 0) sc->dead = 1;
+        pthread_cond_broadcast(&sc->cond);
+    }
+    sc->pending[k] = NULL;
+    pthread_cond_broadcast(&sc->cond);
+    pthread_mutex_unlock(&sc->lock);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+
+    if (!call.done) {
+        fprintf(stderr, "shm: server detached\n");
+        return -1;
+    }
+    *rpc_ns += ns_diff(t0, t1);
+    return call.result;
+}
+
+void shm_close(struct shm_client *sc) {
+    munmap(sc->base, sc->size);
+    close(sc->sq_efd);
+    close(sc->cq_efd);
+    close(sc->sock);
+    pthread_mutex_destroy(&sc->lock);
+    pthread_cond_destroy(&sc->cond);
+    free(sc);
+}
@@ -0,0 +1,28 @@
+#ifndef CLIENT_SHM_H
+#define CLIENT_SHM_H
+
+#include <stdint.h>
+
+struct shm_client;
+
+/*
+ * Attach to the server's same-host transport (server_random -U) on the
+ * Unix socket path: create a ring of at least `entries` entries whose
+ * slots hold batches of up to max_copies copies, and hand it to the
+ * server. A waiter with nothing completed spins for spin_us microseconds
+ * before sleeping on the completion eventfd. NULL on error.
+ */
+struct shm_client *shm_connect(const char *path, uint32_t entries, uint32_t max_copies,
+                               long spin_us);
+
+/*
+ * Same contract as native_copy(): submit count copies as one ring entry
+ * and wait for its completion; safe to call from several threads, up to
+ * the ring's entries at once. Returns the server's result, or -1.
+ */
+int shm_copy(struct shm_client *sc, const int64_t *srcs, const int64_t *dsts,
+             const uint32_t *lens, uint32_t count, uint32_t block_size, uint64_t *rpc_ns);
+
+void shm_close(struct shm_client *sc);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Lookup throughput of the client extent map against extent count: binary
+ * search over struct extent versus the Eytzinger extent_index.
+ *
+ *   ./extent_bench [max_extents] [lookups]
+ *
+ * Extents are synthetic: 4 KiB to 1 MiB long with occasional holes, at
+ * scattered physical addresses, as on an aged, fragmented volume.
+ */
+#include "extent_index.h"
+#include "extent_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BLOCK 4096ull
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Same search extent_map uses below EXTENT_INDEX_MIN extents */
+static int bsearch_find(const struct extent *ext, size_t n, uint64_t logical, struct extent *out) {
+    if (n == 0 || logical < ext[0].logical) return -1;
+    size_t lo = 0, hi = n;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (ext[mid].logical <= logical) lo = mid;
+        else hi = mid;
+    }
+    if (logical >= ext[lo].logical + ext[lo].len) return -1;
+    *out = ext[lo];
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    size_t lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000000;
+
+    struct extent *ext = malloc(max * sizeof(*ext));
+    uint64_t *probes = malloc(lookups * sizeof(*probes));
+    if (!ext || !probes) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("%10s %10s %16s %16s %8s\n", "extents", "size_gib", "bsearch_lps", "eytzinger_lps",
+           "speedup");
+    for (size_t n = 1000; n <= max; n *= 10) {
+        uint64_t logical = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (rng() % 8 == 0) logical += (1 + rng() % 16) * BLOCK;
+            ext[i].logical = logical;
+            ext[i].len = (1 + rng() % 256) * BLOCK;
+            ext[i].physical = (rng() % (1ull << 28)) * BLOCK;
+            logical += ext[i].len;
+        }
+        for (size_t i = 0; i < lookups; i++) probes[i] = rng() % logical;
+
+        struct extent_index x = {0};
+        if (extent_index_build(&x, ext, n) != 0) {
+            fprintf(stderr, "extent_index_build failed at %zu extents\n", n);
+            return 1;
+        }
+
+        /* both searches must agree on every probe */
+        struct extent a, b;
+        uint64_t sum_b = 0, sum_x = 0;
+        double t0 = now();
+        for (size_t i = 0; i < lookups; i++)
+            if (bsearch_find(ext, n, probes[i], &a) == 0)
+                sum_b += a.physical + (probes[i] - a.logical);
+        double t1 = now();
+        for (size_t i = 0; i < lookups; i++)
+            if (extent_index_find(&x, probes[i], &b) == 0)
+                sum_x += b.physical + (probes[i] - b.logical);
+        double t2 = now();
+        if (sum_b != sum_x) {
+            fprintf(stderr, "lookup mismatch at %zu extents\n", n);
+            return 1;
+        }
+
+        double lps_b = lookups / (t1 - t0), lps_x = lookups / (t2 - t1);
+        printf("%10zu %10.1f %16.0f %16.0f %7.2fx\n", n, logical / (double)(1ull << 30), lps_b,
+               lps_x, lps_x / lps_b);
+        extent_index_free(&x);
+    }
+
+    free(probes);
+    free(ext);
+    return 0;
+}
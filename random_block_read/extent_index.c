@@ -0,0 +1,101 @@
+#include "extent_index.h"
+#include "extent_map.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LEN_BITS 24
+#define LEN_MAX ((1ull << LEN_BITS) - 1)
+#define DELTA_MIN (-(1ll << (63 - LEN_BITS)))
+#define DELTA_MAX ((1ll << (63 - LEN_BITS)) - 1)
+
+/* Largest unit, at most 4 KiB, every offset and length is a multiple of */
+static unsigned unit_shift(const struct extent *ext, size_t n) {
+    uint64_t bits = 1ull << 12;
+    for (size_t i = 0; i < n; i++) bits |= ext[i].logical | ext[i].physical | ext[i].len;
+    return __builtin_ctzll(bits);
+}
+
+/* Lay sorted[] out in Eytzinger order: an in-order walk of the implicit tree */
+static size_t layout(struct extent_index *x, const uint64_t *keys, const uint64_t *vals,
+                     size_t i, size_t k) {
+    if (k <= x->n) {
+        i = layout(x, keys, vals, i, 2 * k);
+        x->keys[k] = keys[i];
+        x->vals[k] = vals[i];
+        i++;
+        i = layout(x, keys, vals, i, 2 * k + 1);
+    }
+    return i;
+}
+
+int extent_index_build(struct extent_index *x, const struct extent *ext, size_t n) {
+    extent_index_free(x);
+    x->shift = unit_shift(ext, n);
+
+    size_t entries = 0;
+    for (size_t i = 0; i < n; i++) {
+        int64_t delta = ((int64_t)ext[i].physical - (int64_t)ext[i].logical) >> x->shift;
+        if (delta < DELTA_MIN || delta > DELTA_MAX) return -1;
+        entries += ((ext[i].len >> x->shift) + LEN_MAX - 1) / LEN_MAX;
+    }
+
+    uint64_t *keys = malloc(entries * sizeof(*keys));
+    uint64_t *vals = malloc(entries * sizeof(*vals));
+    x->n = entries;
+    /* keys[k]'s grandchildren of grandchildren share one cache line */
+    if (!keys || !vals ||
+        posix_memalign((void **)&x->keys, 64, (entries + 1) * sizeof(*x->keys)) != 0 ||
+        posix_memalign((void **)&x->vals, 64, (entries + 1) * sizeof(*x->vals)) != 0) {
+        free(keys);
+        free(vals);
+        extent_index_free(x);
+        return -1;
+    }
+
+    size_t j = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t logical = ext[i].logical >> x->shift;
+        uint64_t left = ext[i].len >> x->shift;
+        uint64_t delta = (uint64_t)(((int64_t)ext[i].physical - (int64_t)ext[i].logical) >> x->shift);
+        while (left > 0) {
+            uint64_t take = left < LEN_MAX ? left : LEN_MAX;
+            keys[j] = logical << x->shift;
+            vals[j] = delta << LEN_BITS | take;
+            j++;
+            logical += take;
+            left -= take;
+        }
+    }
+    x->keys[0] = x->vals[0] = 0;
+    layout(x, keys, vals, 0, 1);
+    free(keys);
+    free(vals);
+    return 0;
+}
+
+int extent_index_find(const struct extent_index *x, uint64_t logical, struct extent *out) {
+    /* k's path records each turn: a 1 bit where keys[k] <= logical */
+    size_t k = 1;
+    while (k <= x->n) {
+        __builtin_prefetch(x->keys + 8 * k);
+        k = 2 * k + (x->keys[k] <= logical);
+    }
+    /* the last right turn is the greatest key <= logical */
+    k >>= __builtin_ffsll(k);
+    if (k == 0) return -1;
+
+    uint64_t v = x->vals[k];
+    uint64_t len = (v & LEN_MAX) << x->shift;
+    if (logical >= x->keys[k] + len) return -1;
+    out->logical = x->keys[k];
+    out->physical = out->logical + (uint64_t)(((int64_t)v >> LEN_BITS) * ((int64_t)1 << x->shift));
+    out->len = len;
+    return 0;
+}
+
+void extent_index_free(struct extent_index *x) {
+    free(x->keys);
+    free(x->vals);
+    x->keys = x->vals = NULL;
+    x->n = 0;
+}
@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+#include "extent_map.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Extents without a usable physical address */
+#define EXTENT_SKIP_FLAGS (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | \
+                           FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_INLINE | \
+                           FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_NOT_ALIGNED)
+
+/* On-disk index: this header, then `n` struct extent in logical order */
+#define INDEX_MAGIC 0x3130584449545845ull   /* "EXTIDX01" */
+
+struct index_header {
+    uint64_t magic;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec, mtime_nsec;
+    int64_t ctime_sec, ctime_nsec;
+    uint64_t generation;
+    uint64_t n;
+};
+
+static uint64_t generation_of(int fd) {
+    long gen = 0;
+    if (ioctl(fd, FS_IOC_GETVERSION, &gen) < 0) return 0;
+    return (uint32_t)gen;
+}
+
+static void fill_header(struct index_header *h, const struct extent_map *m) {
+    memset(h, 0, sizeof(*h));
+    h->magic = INDEX_MAGIC;
+    h->dev = m->st.st_dev;
+    h->ino = m->st.st_ino;
+    h->size = m->st.st_size;
+    h->mtime_sec = m->st.st_mtim.tv_sec;
+    h->mtime_nsec = m->st.st_mtim.tv_nsec;
+    h->ctime_sec = m->st.st_ctim.tv_sec;
+    h->ctime_nsec = m->st.st_ctim.tv_nsec;
+    h->generation = m->generation;
+    h->n = m->n;
+}
+
+/* Rebuild the search structure after ext changed; small maps do without */
+static void lookup_build(struct extent_map *m) {
+    if (m->n < EXTENT_INDEX_MIN || extent_index_build(&m->lookup, m->ext, m->n) != 0)
+        extent_index_free(&m->lookup);
+}
+
+static void index_unmap(struct extent_map *m) {
+    if (!m->index) return;
+    munmap(m->index, m->index_len);
+    m->index = NULL;
+    m->index_len = 0;
+    m->ext = NULL;
+    m->n = m->cap = 0;
+}
+
+/* Map index_path if it describes the file exactly as m->st finds it; returns 0 on a hit */
+static int index_map(struct extent_map *m) {
+    int fd = open(m->index_path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct index_header))
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+
+    struct index_header want;
+    fill_header(&want, m);
+    const struct index_header *h = p;
+    want.n = h->n;
+    if (memcmp(h, &want, sizeof(want)) != 0 ||
+        (size_t)st.st_size != sizeof(*h) + h->n * sizeof(struct extent)) {
+        munmap(p, st.st_size);
+        return -1;
+    }
+
+    m->index = p;
+    m->index_len = st.st_size;
+    m->ext = (struct extent *)(h + 1);
+    m->n = h->n;
+    m->cap = 0;
+    m->index_hit = 1;
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) return -1;
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* Replace index_path with the current map; a reader never sees a partial file */
+static void index_save(const struct extent_map *m) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", m->index_path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("extent index");
+        return;
+    }
+
+    struct index_header h;
+    fill_header(&h, m);
+    int ok = write_all(fd, &h, sizeof(h)) == 0 &&
+             write_all(fd, m->ext, m->n * sizeof(*m->ext)) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (!ok || rename(tmp, m->index_path) != 0) {
+        perror("extent index");
+        unlink(tmp);
+    }
+}
+
+static int append(struct extent_map *m, const struct fiemap_extent *e) {
+    if (m->n > 0) {
+        struct extent *last = &m->ext[m->n - 1];
+        /* an extent reported again by the FIEMAP of a later range */
+        if (e->fe_logical < last->logical + last->len) return 0;
+        if (last->logical + last->len == e->fe_logical &&
+            last->physical + last->len == e->fe_physical) {
+            last->len += e->fe_length;
+            return 0;
+        }
+    }
+    if (m->n == m->cap) {
+        size_t cap = m->cap ? 2 * m->cap : EXTENT_MAP_CHUNK;
+        struct extent *x = realloc(m->ext, cap * sizeof(*x));
+        if (!x) return -1;
+        m->ext = x;
+        m->cap = cap;
+    }
+    m->ext[m->n].logical = e->fe_logical;
+    m->ext[m->n].physical = e->fe_physical;
+    m->ext[m->n].len = e->fe_length;
+    m->n++;
+    return 0;
+}
+
+static struct fiemap *fiemap_alloc(void) {
+    return malloc(sizeof(struct fiemap) + EXTENT_MAP_CHUNK * sizeof(struct fiemap_extent));
+}
+
+/*
+ * Append the extents overlapping [start, end) to the map, EXTENT_MAP_CHUNK
+ * per FS_IOC_FIEMAP call. Returns the number of calls, or -1.
+ */
+static int fiemap_range(struct extent_map *m, struct fiemap *fm, uint64_t start, uint64_t end,
+                        uint32_t flags) {
+    int calls = 0;
+    while (start < end) {
+        memset(fm, 0, sizeof(*fm));
+        fm->fm_start = start;
+        fm->fm_length = end - start;
+        fm->fm_flags = flags;
+        fm->fm_extent_count = EXTENT_MAP_CHUNK;
+
+        calls++;
+        m->fiemap_calls++;
+        if (ioctl(m->fd, FS_IOC_FIEMAP, fm) < 0) {
+            perror("ioctl fiemap");
+            return -1;
+        }
+        if (fm->fm_mapped_extents == 0) break;
+
+        for (uint32_t i = 0; i < fm->fm_mapped_extents; i++) {
+            const struct fiemap_extent *e = &fm->fm_extents[i];
+            if (e->fe_flags & EXTENT_SKIP_FLAGS) continue;
+            if (append(m, e) != 0) return -1;
+        }
+
+        const struct fiemap_extent *last = &fm->fm_extents[fm->fm_mapped_extents - 1];
+        if (last->fe_flags & FIEMAP_EXTENT_LAST) break;
+        start = last->fe_logical + last->fe_length;
+    }
+    return calls;
+}
+
+int extent_map_load(struct extent_map *m, int fd) {
+    index_unmap(m);
+    m->fd = fd;
+    m->n = 0;
+    m->index_hit = 0;
+    if (fstat(fd, &m->st) < 0) {
+        perror("fstat");
+        return -1;
+    }
+    m->generation = generation_of(fd);
+
+    struct fiemap *fm = fiemap_alloc();
+    if (!fm) return -1;
+    int result = fiemap_range(m, fm, 0, FIEMAP_MAX_OFFSET, FIEMAP_FLAG_SYNC) < 0 ? -1 : 0;
+    free(fm);
+
+    m->loads++;
+    lookup_build(m);
+    if (result == 0 && m->index_path) index_save(m);
+    return result;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int extent_map_load_ranges(struct extent_map *m, int fd, uint64_t *offs, size_t n,
+                           uint64_t len, uint64_t merge_gap) {
+    index_unmap(m);
+    m->fd = fd;
+    m->n = 0;
+    m->index_hit = 0;
+    if (n == 0) return 0;
+
+    struct fiemap *fm = fiemap_alloc();
+    if (!fm) return -1;
+
+    /* sorted ranges closer than merge_gap share one FIEMAP pass */
+    qsort(offs, n, sizeof(*offs), cmp_u64);
+    int calls = 0;
+    uint64_t start = offs[0], end = offs[0] + len;
+    for (size_t i = 1; i <= n && calls >= 0; i++) {
+        if (i < n && offs[i] <= end + merge_gap) {
+            if (offs[i] + len > end) end = offs[i] + len;
+            continue;
+        }
+        int c = fiemap_range(m, fm, start, end, 0);
+        calls = c < 0 ? -1 : calls + c;
+        if (i < n) {
+            start = offs[i];
+            end = offs[i] + len;
+        }
+    }
+    free(fm);
+    lookup_build(m);
+    return calls;
+}
+
+int extent_map_open(struct extent_map *m, int fd, const char *index_path) {
+    m->fd = fd;
+    m->index_path = index_path;
+    if (index_path && fstat(fd, &m->st) == 0) {
+        m->generation = generation_of(fd);
+        if (index_map(m) == 0) {
+            lookup_build(m);
+            return 0;
+        }
+    }
+    return extent_map_load(m, fd);
+}
+
+/* The extent holding logical into *out; -1 if logical is in a hole */
+static int find(const struct extent_map *m, uint64_t logical, struct extent *out) {
+    if (m->lookup.n) return extent_index_find(&m->lookup, logical, out);
+    if (m->n == 0 || logical < m->ext[0].logical) return -1;
+
+    /* last extent starting at or before logical */
+    size_t lo = 0, hi = m->n;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (m->ext[mid].logical <= logical) lo = mid;
+        else hi = mid;
+    }
+    if (logical >= m->ext[lo].logical + m->ext[lo].len) return -1;
+    *out = m->ext[lo];
+    return 0;
+}
+
+int extent_map_segments(const struct extent_map *m, uint64_t logical, uint64_t len,
+                        struct extent_seg *out, int max) {
+    int n = 0;
+    while (len > 0) {
+        struct extent x;
+        if (find(m, logical, &x) != 0 || n == max) return -1;
+
+        uint64_t take = x.logical + x.len - logical;
+        if (take > len) take = len;
+        out[n].physical = x.physical + (logical - x.logical);
+        out[n].len = take;
+        n++;
+        logical += take;
+        len -= take;
+    }
+    return n;
+}
+
+int extent_map_refresh(struct extent_map *m) {
+    struct stat st;
+    if (fstat(m->fd, &st) < 0) {
+        perror("fstat");
+        return -1;
+    }
+    if (st.st_size == m->st.st_size &&
+        st.st_mtim.tv_sec == m->st.st_mtim.tv_sec &&
+        st.st_mtim.tv_nsec == m->st.st_mtim.tv_nsec &&
+        st.st_ctim.tv_sec == m->st.st_ctim.tv_sec &&
+        st.st_ctim.tv_nsec == m->st.st_ctim.tv_nsec)
+        return 0;
+
+    return extent_map_load(m, m->fd) == 0 ? 1 : -1;
+}
+
+/* First extent ending after logical */
+static size_t first_after(const struct extent_map *m, uint64_t logical) {
+    size_t lo = 0, hi = m->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (m->ext[mid].logical + m->ext[mid].len <= logical) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Move an index-backed map to the heap so it can be edited */
+static int own_extents(struct extent_map *m) {
+    if (!m->index) return 0;
+    size_t n = m->n;
+    struct extent *x = malloc((n ? n : 1) * sizeof(*x));
+    if (!x) return -1;
+    memcpy(x, m->ext, n * sizeof(*x));
+    index_unmap(m);
+    m->ext = x;
+    m->n = m->cap = n;
+    return 0;
+}
+
+/*
+ * Read the extents overlapping [start, end) again with FIEMAP and put the
+ * result in place of the stored ones if it differs. The range is widened to
+ * the neighbouring stored extents, so a hole that was filled in is read
+ * whole. Returns 1 if the range was re-mapped, 0 if it still matched, -1 on
+ * error.
+ */
+static int remap_range(struct extent_map *m, uint64_t start, uint64_t end) {
+    size_t i = first_after(m, start), j = first_after(m, end);
+    if (j < m->n && m->ext[j].logical < end) j++;
+    start = i > 0 ? m->ext[i - 1].logical + m->ext[i - 1].len : 0;
+    end = j < m->n ? m->ext[j].logical : FIEMAP_MAX_OFFSET;
+
+    struct extent_map cur;
+    memset(&cur, 0, sizeof(cur));
+    cur.fd = m->fd;
+    struct fiemap *fm = fiemap_alloc();
+    if (!fm) return -1;
+    int calls = fiemap_range(&cur, fm, start, end, 0);
+    free(fm);
+    m->fiemap_calls += cur.fiemap_calls;
+    if (calls < 0) {
+        free(cur.ext);
+        return -1;
+    }
+
+    /* extents reaching outside the range are kept only in part */
+    for (size_t k = 0; k < cur.n; k++) {
+        struct extent *e = &cur.ext[k];
+        if (e->logical < start) {
+            e->physical += start - e->logical;
+            e->len -= start - e->logical;
+            e->logical = start;
+        }
+        if (e->logical + e->len > end) e->len = end - e->logical;
+    }
+
+    if (cur.n == j - i && memcmp(cur.ext, m->ext + i, cur.n * sizeof(*cur.ext)) == 0) {
+        free(cur.ext);
+        return 0;
+    }
+
+    size_t n = m->n - (j - i) + cur.n;
+    if (own_extents(m) != 0) goto fail;
+    if (n > m->cap) {
+        struct extent *x = realloc(m->ext, n * sizeof(*x));
+        if (!x) goto fail;
+        m->ext = x;
+        m->cap = n;
+    }
+    memmove(m->ext + i + cur.n, m->ext + j, (m->n - j) * sizeof(*m->ext));
+    memcpy(m->ext + i, cur.ext, cur.n * sizeof(*cur.ext));
+    m->n = n;
+    free(cur.ext);
+
+    m->remaps++;
+    lookup_build(m);
+    if (m->index_path) index_save(m);
+    return 1;
+
+fail:
+    free(cur.ext);
+    return -1;
+}
+
+int extent_map_remap(struct extent_map *m, uint64_t logical, uint64_t len) {
+    return remap_range(m, logical, logical + len) < 0 ? -1 : 0;
+}
+
+int extent_map_check(struct extent_map *m, int spans) {
+    int remapped = 0;
+    for (int s = 0; s < spans && m->n > 0; s++) {
+        if (m->check_next >= m->n) m->check_next = 0;
+        size_t last = m->check_next + EXTENT_CHECK_SPAN;
+        if (last > m->n) last = m->n;
+        uint64_t start = m->ext[m->check_next].logical;
+        uint64_t end = m->ext[last - 1].logical + m->ext[last - 1].len;
+
+        m->checks++;
+        int r = remap_range(m, start, end);
+        if (r < 0) return -1;
+        remapped += r;
+        m->check_next = first_after(m, end);
+    }
+    return remapped;
+}
+
+void extent_map_free(struct extent_map *m) {
+    extent_index_free(&m->lookup);
+    if (m->index) {
+        index_unmap(m);
+        return;
+    }
+    free(m->ext);
+    m->ext = NULL;
+    m->n = m->cap = 0;
+}
@@ -0,0 +1,111 @@
+#ifndef EXTENT_MAP_H
+#define EXTENT_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "extent_index.h"
+
+/* Extents fetched per FS_IOC_FIEMAP call while loading */
+#define EXTENT_MAP_CHUNK 512
+
+/* Extents compared per FIEMAP by extent_map_check */
+#define EXTENT_CHECK_SPAN 64
+
+/* Ranges closer than this are fetched by one FIEMAP (largest ext4 extent) */
+#define EXTENT_MERGE_GAP (128ull << 20)
+
+struct extent {
+    uint64_t logical;
+    uint64_t physical;
+    uint64_t len;
+};
+
+/*
+ * Whole-file logical -> physical map, read once with FIEMAP and kept
+ * sorted by logical offset, so a translation is a binary search instead
+ * of an ioctl. Extents that are physically contiguous are merged. Maps of
+ * EXTENT_INDEX_MIN extents or more are searched through an extent_index.
+ */
+struct extent_map {
+    int fd;
+    struct extent *ext;     /* heap array, or inside `index` when mapped */
+    size_t n;
+    size_t cap;             /* 0 while ext points into the index file */
+    struct stat st;         /* file state the map was read from */
+    uint64_t generation;    /* FS_IOC_GETVERSION of the file, 0 if unsupported */
+    uint64_t loads;         /* FIEMAP passes over the whole file */
+    uint64_t fiemap_calls;  /* FS_IOC_FIEMAP ioctls issued, whole-file or ranged */
+    const char *index_path; /* on-disk index kept in step with the map, or NULL */
+    void *index;            /* read-only mapping of index_path */
+    size_t index_len;
+    int index_hit;          /* the map came from a valid index, not FIEMAP */
+    struct extent_index lookup; /* search structure over ext, empty for small maps */
+    size_t check_next;      /* where extent_map_check resumes its sweep */
+    uint64_t checks;        /* windows compared with FIEMAP by extent_map_check */
+    uint64_t remaps;        /* ranges found moved and read again */
+};
+
+/* Read the full extent list of fd; returns 0 or -1 */
+int extent_map_load(struct extent_map *m, int fd);
+
+/*
+ * Replace the map with just the extents covering [offs[i], offs[i] + len)
+ * for each of the n offsets, for when no whole-file map is kept. The
+ * offsets are sorted in place and ranges less than merge_gap apart are
+ * fetched by one FIEMAP pass, so a batch costs a few ioctls rather than
+ * one per offset. Returns the number of ioctls issued, or -1.
+ */
+int extent_map_load_ranges(struct extent_map *m, int fd, uint64_t *offs, size_t n,
+                           uint64_t len, uint64_t merge_gap);
+
+/*
+ * Same as extent_map_load, through an on-disk index at index_path that
+ * survives across runs. If the index was written for this file (device,
+ * inode) in its current state (size, mtime, ctime, generation), it is
+ * mmap'ed read-only and no FIEMAP is issued; otherwise the map is read with
+ * FIEMAP and the index rewritten. Later reloads rewrite it too.
+ * Returns 0 or -1; a missing or unwritable index is not an error.
+ */
+int extent_map_open(struct extent_map *m, int fd, const char *index_path);
+
+/* One physically contiguous piece of a logical range */
+struct extent_seg {
+    uint64_t physical;
+    uint64_t len;
+};
+
+/*
+ * Scatter list of [logical, logical + len): its physical segments in file
+ * order, at most max of them, into out. Returns the number of segments,
+ * or -1 if part of the range is unmapped (hole, delayed allocation) or it
+ * needs more than max segments.
+ */
+int extent_map_segments(const struct extent_map *m, uint64_t logical, uint64_t len,
+                        struct extent_seg *out, int max);
+
+/*
+ * Reload the map if the file changed since it was read (size, mtime or
+ * ctime differ). Returns 1 if reloaded, 0 if still valid, -1 on error.
+ */
+int extent_map_refresh(struct extent_map *m);
+
+/*
+ * Spot-check the map for layout changes that leave the file's timestamps
+ * alone, such as defragmentation moving its blocks. Each of `spans` steps
+ * reads the next EXTENT_CHECK_SPAN extents again with one FIEMAP, in a
+ * sweep that wraps around the map. A window that no longer matches is
+ * replaced by what FIEMAP returned and the rest of the map is kept.
+ * Returns the number of windows re-mapped, or -1.
+ */
+int extent_map_check(struct extent_map *m, int spans);
+
+/*
+ * Read the extents overlapping [logical, logical + len) again, e.g. after
+ * a lookup missed there, leaving the rest of the map alone. Returns 0 or -1.
+ */
+int extent_map_remap(struct extent_map *m, uint64_t logical, uint64_t len);
+
+void extent_map_free(struct extent_map *m);
+
+#endif
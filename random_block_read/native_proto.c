@@ -0,0 +1,59 @@
+#include "native_proto.h"
+#include <endian.h>
+#include <string.h>
+
+void native_copy_encode(uint8_t *body, const int64_t *srcs, const int64_t *dsts,
+                        const uint32_t *lens, uint32_t count, uint32_t block_size) {
+    uint8_t *p = body;
+    uint32_t v32 = htole32(count);
+    memcpy(p, &v32, 4);
+    v32 = htole32(block_size);
+    memcpy(p + 4, &v32, 4);
+    p += NATIVE_COPY_HDR_LEN;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    memcpy(p, srcs, count * sizeof(*srcs));
+    p += count * sizeof(*srcs);
+    memcpy(p, dsts, count * sizeof(*dsts));
+    p += count * sizeof(*dsts);
+    if (lens) memcpy(p, lens, count * sizeof(*lens));
+#else
+    for (uint32_t i = 0; i < count; i++, p += 8) {
+        uint64_t v64 = htole64((uint64_t)srcs[i]);
+        memcpy(p, &v64, 8);
+    }
+    for (uint32_t i = 0; i < count; i++, p += 8) {
+        uint64_t v64 = htole64((uint64_t)dsts[i]);
+        memcpy(p, &v64, 8);
+    }
+    for (uint32_t i = 0; lens && i < count; i++, p += 4) {
+        v32 = htole32(lens[i]);
+        memcpy(p, &v32, 4);
+    }
+#endif
+}
+
+int native_copy_decode(uint8_t *body, uint32_t len, uint16_t flags, int64_t **srcs,
+                       int64_t **dsts, uint32_t **lens, uint32_t *count, uint32_t *block_size) {
+    if (len < NATIVE_COPY_HDR_LEN) return -1;
+    uint32_t n, bs;
+    memcpy(&n, body, 4);
+    memcpy(&bs, body + 4, 4);
+    n = le32toh(n);
+    bs = le32toh(bs);
+    int with_lens = flags & NATIVE_LENS;
+    if (n > NATIVE_MAX_COPIES || len != native_copy_len(n, with_lens)) return -1;
+
+    *srcs = (int64_t *)(body + NATIVE_COPY_HDR_LEN);
+    *dsts = *srcs + n;
+    *lens = with_lens ? (uint32_t *)(*dsts + n) : NULL;
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+    for (uint32_t i = 0; i < n; i++) {
+        (*srcs)[i] = (int64_t)le64toh((uint64_t)(*srcs)[i]);
+        (*dsts)[i] = (int64_t)le64toh((uint64_t)(*dsts)[i]);
+        if (with_lens) (*lens)[i] = le32toh((*lens)[i]);
+    }
+#endif
+    *count = n;
+    *block_size = bs;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef NATIVE_PROTO_H
+#define NATIVE_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Native transport (-N): length-prefixed binary frames on a plain TCP
+ * connection, next to the RPC program. Every frame starts with a 16-byte
+ * header, all fields little-endian:
+ *
+ *   le32 body_len, le16 type, le16 flags, le64 id
+ *
+ * NATIVE_COPY carries a batch in columns so the body can be used in place:
+ *
+ *   le32 count, le32 block_size, le64 srcs[count], le64 dsts[count]
+ *   and, with NATIVE_LENS, le32 lens[count] (block_size is then ignored)
+ *
+ * The server answers each batch with a NATIVE_REPLY of the same id whose
+ * body is one le32 result (0 or -1). Batches of one connection may run at
+ * the same time and replies come back in completion order, so a client
+ * must not send a batch that overlaps one still unanswered.
+ */
+
+#define NATIVE_COPY 1
+#define NATIVE_REPLY 2
+
+#define NATIVE_LENS 0x1   /* per-copy lengths follow the addresses */
+
+#define NATIVE_HDR_LEN 16
+#define NATIVE_COPY_HDR_LEN 8
+#define NATIVE_REPLY_LEN 4
+
+/* Copies per NATIVE_COPY frame, as for a version 2 RPC batch */
+#define NATIVE_MAX_COPIES 65536
+#define NATIVE_MAX_BODY (NATIVE_COPY_HDR_LEN + (uint32_t)NATIVE_MAX_COPIES * 20)
+
+/* Body bytes of a NATIVE_COPY frame of count copies */
+static inline uint32_t native_copy_len(uint32_t count, int lens) {
+    return NATIVE_COPY_HDR_LEN + count * (lens ? 20 : 16);
+}
+
+/*
+ * Write the body of a NATIVE_COPY frame (lens NULL: all copies of
+ * block_size bytes) to body, which holds native_copy_len bytes.
+ */
+void native_copy_encode(uint8_t *body, const int64_t *srcs, const int64_t *dsts,
+                        const uint32_t *lens, uint32_t count, uint32_t block_size);
+
+/*
+ * Point srcs/dsts/lens into a NATIVE_COPY body of len bytes, 8-byte
+ * aligned, with flags from its header; on a big-endian host the columns
+ * are swapped in place first. lens is NULL without NATIVE_LENS. Returns
+ * -1 if the body does not hold exactly what its counts say.
+ */
+int native_copy_decode(uint8_t *body, uint32_t len, uint16_t flags, int64_t **srcs,
+                       int64_t **dsts, uint32_t **lens, uint32_t *count, uint32_t *block_size);
+
+#endif
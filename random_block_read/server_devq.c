@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include "server_devq.h"
+#include "block_cache.h"
+#include "buf_pool.h"
+#include "server_target.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+/* Completions of one handler thread's requests */
+struct devq_cq {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct devq_req *head;
+};
+
+/* One device I/O: plan->ios[idx] of the batch being run */
+struct devq_req {
+    struct devq_req *next;
+    struct devq_cq *cq;
+    char *buf;
+    int64_t dev_off;        /* offset on the device of the queue it is on */
+    uint32_t len;
+    uint32_t idx;
+    int is_write;
+    ssize_t res;
+};
+
+struct devq {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct devq_req *head, *tail;
+    int dev;
+} __attribute__((aligned(64)));
+
+static struct devq queues[TARGET_MAX_DEVS];
+static int devq_on = 0;
+
+static void *worker(void *arg) {
+    struct devq *q = arg;
+    int fd = target_dev(q->dev)->fd;
+
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        while (!q->head) pthread_cond_wait(&q->cond, &q->lock);
+        struct devq_req *r = q->head;
+        q->head = r->next;
+        if (!q->head) q->tail = NULL;
+        pthread_mutex_unlock(&q->lock);
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+        r->res = r->is_write ? pwrite(fd, r->buf, r->len, r->dev_off)
+                             : pread(fd, r->buf, r->len, r->dev_off);
+        if (r->res < 0) r->res = -errno;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        target_account(q->dev, r->is_write, ns_diff(t0, t1));
+
+        struct devq_cq *cq = r->cq;
+        pthread_mutex_lock(&cq->lock);
+        r->next = cq->head;
+        cq->head = r;
+        pthread_cond_signal(&cq->cond);
+        pthread_mutex_unlock(&cq->lock);
+    }
+    return NULL;
+}
+
+int devq_start(void) {
+    for (int i = 0; i < target_ndevs(); i++) {
+        struct devq *q = &queues[i];
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->cond, NULL);
+        q->head = q->tail = NULL;
+        q->dev = i;
+
+        pthread_t t;
+        if (pthread_create(&t, NULL, worker, q) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        pthread_detach(t);
+    }
+    devq_on = 1;
+    return 0;
+}
+
+/* Queue plan->ios[idx] on the worker of the device holding it */
+static void submit(struct devq_req *r, struct devq_cq *cq, const struct plan_io *io,
+                   uint32_t idx, char *buf, int is_write) {
+    int64_t rel = 0;
+    struct devq *q = &queues[target_map(io->off, &rel, NULL)];
+    *r = (struct devq_req){NULL, cq, buf + io->buf_off, rel, io->len, idx, is_write, 0};
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail) q->tail->next = r;
+    else q->head = r;
+    q->tail = r;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+struct devq_slot {
+    const struct plan_group *g;
+    char *buf;
+    uint32_t reads_left;    /* writes are queued when this reaches 0 */
+    uint32_t writes_left;   /* the group is done when this reaches 0 */
+    int failed;
+};
+
+int devq_copy_batch(struct batch_sched *sched, uint64_t *read_ns, uint64_t *write_ns) {
+    if (!devq_on) return -ENOSYS;
+    const struct batch_plan *plan = sched->plan;
+
+    static __thread struct devq_cq cq = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL};
+
+    /* plan->ios index -> request, slot and block cache fill token */
+    static __thread struct devq_req *reqs = NULL;
+    static __thread uint16_t *io_slot = NULL;
+    static __thread uint64_t *io_token = NULL;
+    static __thread uint32_t io_cap = 0;
+    if (io_cap < plan->nios) {
+        struct devq_req *q = realloc(reqs, plan->nios * sizeof(*q));
+        if (q) reqs = q;
+        uint16_t *p = realloc(io_slot, plan->nios * sizeof(*p));
+        if (p) io_slot = p;
+        uint64_t *t = realloc(io_token, plan->nios * sizeof(*t));
+        if (t) io_token = t;
+        if (!q || !p || !t) return -ENOSYS;
+        io_cap = plan->nios;
+    }
+
+    struct devq_slot slots[DEVQ_DEPTH];
+    int free_slots[DEVQ_DEPTH];
+    int nfree = DEVQ_DEPTH;
+    for (int i = 0; i < DEVQ_DEPTH; i++) free_slots[i] = DEVQ_DEPTH - 1 - i;
+
+    uint32_t done = 0;
+    int inflight = 0;
+    int result = 0;
+
+    while (done < plan->ngroups) {
+        /* --- SUBMIT: queue the reads of ready groups (writes follow them) --- */
+        int64_t next;
+        while (result == 0 && nfree > 0 && (next = batch_sched_peek(sched)) >= 0) {
+            const struct plan_group *g = &plan->groups[next];
+            char *buf = buf_pool_get(g->bytes);
+            if (!buf) {
+                perror("buf_pool_get");
+                result = -1;
+                break;
+            }
+            batch_sched_issue(sched, (uint32_t)next);
+
+            int s = free_slots[--nfree];
+            slots[s] = (struct devq_slot){g, buf, 0, g->nwrites, 0};
+            inflight++;
+
+            for (uint32_t k = 0; k < g->nreads; k++) {
+                uint32_t idx = g->read_first + k;
+                const struct plan_io *io = &plan->ios[idx];
+                if (block_cache_read(io->off, io->len, buf + io->buf_off)) continue;
+                io_token[idx] = block_cache_fill_begin(io->off, io->len);
+                io_slot[idx] = (uint16_t)s;
+                slots[s].reads_left++;
+                submit(&reqs[idx], &cq, io, idx, buf, 0);
+            }
+            if (slots[s].reads_left > 0) continue;
+
+            /* every read was a cache hit */
+            for (uint32_t k = 0; k < g->nwrites; k++) {
+                uint32_t idx = g->write_first + k;
+                io_slot[idx] = (uint16_t)s;
+                submit(&reqs[idx], &cq, &plan->ios[idx], idx, buf, 1);
+            }
+        }
+        if (inflight == 0) break;
+
+        /* --- REAP: time blocked here is charged to the phase that woke us --- */
+        struct timespec t_wait0, t_wait1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_wait0);
+        pthread_mutex_lock(&cq.lock);
+        while (!cq.head) pthread_cond_wait(&cq.cond, &cq.lock);
+        struct devq_req *list = cq.head;
+        cq.head = NULL;
+        pthread_mutex_unlock(&cq.lock);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_wait1);
+
+        if (list->is_write)
+            *write_ns += ns_diff(t_wait0, t_wait1);
+        else
+            *read_ns += ns_diff(t_wait0, t_wait1);
+
+        while (list) {
+            struct devq_req *r = list;
+            list = r->next;
+            const struct plan_io *io = &plan->ios[r->idx];
+            struct devq_slot *sl = &slots[io_slot[r->idx]];
+
+            int ok = r->res == (ssize_t)io->len;
+            if (!ok) {
+                fprintf(stderr, "devq %s at %lld: %s\n", r->is_write ? "write" : "read",
+                        (long long)io->off, r->res < 0 ? strerror((int)-r->res) : "short transfer");
+                sl->failed = 1;
+                result = -1;
+            }
+
+            if (!r->is_write) {
+                block_cache_fill_end(io->off, io->len, r->buf, ok, io_token[r->idx]);
+                if (--sl->reads_left > 0) continue;
+                if (!sl->failed) {
+                    const struct plan_group *g = sl->g;
+                    for (uint32_t k = 0; k < g->nwrites; k++) {
+                        uint32_t idx = g->write_first + k;
+                        io_slot[idx] = io_slot[r->idx];
+                        submit(&reqs[idx], &cq, &plan->ios[idx], idx, sl->buf, 1);
+                    }
+                    continue;
+                }
+                /* a read failed: its writes are never issued */
+                sl->writes_left = 0;
+            } else {
+                block_cache_write(io->off, io->len, r->buf, ok);
+                if (--sl->writes_left > 0) continue;
+            }
+
+            /* the group is complete: release its successors and its slot */
+            batch_sched_done(sched, (uint32_t)(sl->g - plan->groups));
+            buf_pool_put(sl->buf);
+            free_slots[nfree++] = io_slot[r->idx];
+            inflight--;
+            done++;
+        }
+    }
+
+    return result;
+}
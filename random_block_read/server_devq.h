@@ -0,0 +1,28 @@
+#ifndef SERVER_DEVQ_H
+#define SERVER_DEVQ_H
+
+#include "batch_sched.h"
+#include <stdint.h>
+
+/* Max planned groups in flight per batch on the device workers */
+#ifndef DEVQ_DEPTH
+#define DEVQ_DEPTH 64
+#endif
+
+/*
+ * Per-device queues: one worker thread per target device, each with its
+ * own submission queue, doing blocking pread/pwrite on that device only.
+ * Call once after target_open().
+ */
+int devq_start(void);
+
+/*
+ * Run one planned WRITE_PBA_BATCH on the device workers: ready groups are
+ * issued in the order `sched` picks, their reads queued on the devices
+ * that hold them and their writes once those reads are in, so a batch
+ * spanning several devices keeps all of them busy. Returns 0 on success,
+ * -1 if any copy failed, and -ENOSYS if the workers were not started.
+ */
+int devq_copy_batch(struct batch_sched *sched, uint64_t *read_ns, uint64_t *write_ns);
+
+#endif
@@ -0,0 +1,195 @@
+#include "server_extents.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ext_file {
+    uint32_t handle;        /* 0: slot unused */
+    struct ext_rec *ext;    /* sorted by logical offset */
+    size_t n;
+    size_t cap;
+};
+
+static struct ext_file files[EXTENTS_MAX_FILES];
+static uint32_t next_handle = 1;
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static _Atomic uint64_t registers = 0;
+static _Atomic uint64_t refused = 0;
+static _Atomic uint64_t misses = 0;
+
+/* Pieces of the batch being translated by this thread */
+static __thread struct {
+    int64_t *srcs;
+    int64_t *dsts;
+    uint32_t *lens;
+    size_t n;
+    size_t cap;
+} pieces;
+
+static struct ext_file *lookup(uint32_t handle) {
+    if (handle == 0) return NULL;
+    for (int i = 0; i < EXTENTS_MAX_FILES; i++)
+        if (files[i].handle == handle) return &files[i];
+    return NULL;
+}
+
+/* A free slot, or NULL if every map is in use */
+static struct ext_file *claim(void) {
+    for (int i = 0; i < EXTENTS_MAX_FILES; i++)
+        if (files[i].handle == 0) return &files[i];
+    return NULL;
+}
+
+uint32_t extents_register(uint32_t handle, const struct ext_rec *v, uint32_t n) {
+    pthread_rwlock_wrlock(&lock);
+
+    struct ext_file *f = NULL;
+    if (handle && !(f = lookup(handle))) goto fail;
+
+    /* reject anything out of order before touching (or taking) a map */
+    int64_t end = f && f->n ? f->ext[f->n - 1].logical + f->ext[f->n - 1].len : 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (v[i].len <= 0 || v[i].logical < end) goto fail;
+        end = v[i].logical + v[i].len;
+    }
+    if (!f && !(f = claim())) {
+        atomic_fetch_add_explicit(&refused, 1, memory_order_relaxed);
+        goto fail;
+    }
+
+    if (f->n + n > f->cap) {
+        size_t cap = f->cap ? f->cap : 1024;
+        while (cap < f->n + n) cap *= 2;
+        struct ext_rec *x = realloc(f->ext, cap * sizeof(*x));
+        if (!x) goto fail;
+        f->ext = x;
+        f->cap = cap;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        struct ext_rec *last = f->n ? &f->ext[f->n - 1] : NULL;
+        if (last && last->logical + last->len == v[i].logical &&
+            last->physical + last->len == v[i].physical) {
+            last->len += v[i].len;
+            continue;
+        }
+        f->ext[f->n++] = v[i];
+    }
+
+    if (f->handle == 0) {
+        f->handle = next_handle++;
+        if (next_handle == 0) next_handle = 1;
+    }
+    handle = f->handle;
+    pthread_rwlock_unlock(&lock);
+    atomic_fetch_add_explicit(&registers, 1, memory_order_relaxed);
+    return handle;
+
+fail:
+    pthread_rwlock_unlock(&lock);
+    return 0;
+}
+
+int extents_unregister(uint32_t handle) {
+    pthread_rwlock_wrlock(&lock);
+    struct ext_file *f = lookup(handle);
+    if (f) {
+        free(f->ext);
+        memset(f, 0, sizeof(*f));
+    }
+    pthread_rwlock_unlock(&lock);
+    return f ? 0 : -1;
+}
+
+/* Index of the extent holding logical, or -1 */
+static long find(const struct ext_file *f, int64_t logical) {
+    if (f->n == 0 || logical < f->ext[0].logical) return -1;
+    size_t lo = 0, hi = f->n;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (f->ext[mid].logical <= logical) lo = mid;
+        else hi = mid;
+    }
+    return logical < f->ext[lo].logical + f->ext[lo].len ? (long)lo : -1;
+}
+
+static int reserve(size_t n) {
+    if (n <= pieces.cap) return 0;
+    size_t cap = pieces.cap ? 2 * pieces.cap : 1024;
+    while (cap < n) cap *= 2;
+    int64_t *s = realloc(pieces.srcs, cap * sizeof(*s));
+    if (s) pieces.srcs = s;
+    int64_t *d = realloc(pieces.dsts, cap * sizeof(*d));
+    if (d) pieces.dsts = d;
+    uint32_t *l = realloc(pieces.lens, cap * sizeof(*l));
+    if (l) pieces.lens = l;
+    if (!s || !d || !l) return -1;
+    pieces.cap = cap;
+    return 0;
+}
+
+/* Append the pieces of one copy, cut where either side crosses an extent */
+static int split(const struct ext_file *f, int64_t src, int64_t dst, int64_t len) {
+    while (len > 0) {
+        long s = find(f, src), d = find(f, dst);
+        if (s < 0 || d < 0 || reserve(pieces.n + 1) != 0) return -1;
+
+        const struct ext_rec *es = &f->ext[s], *ed = &f->ext[d];
+        int64_t take = len;
+        if (take > es->logical + es->len - src) take = es->logical + es->len - src;
+        if (take > ed->logical + ed->len - dst) take = ed->logical + ed->len - dst;
+
+        pieces.srcs[pieces.n] = es->physical + (src - es->logical);
+        pieces.dsts[pieces.n] = ed->physical + (dst - ed->logical);
+        pieces.lens[pieces.n] = (uint32_t)take;
+        pieces.n++;
+        src += take;
+        dst += take;
+        len -= take;
+    }
+    return 0;
+}
+
+int64_t extents_translate(uint32_t handle, const int64_t *srcs, const int64_t *dsts,
+                          uint32_t count, uint32_t block_size, int64_t **out_srcs,
+                          int64_t **out_dsts, uint32_t **lens) {
+    pieces.n = 0;
+    int ok = 1;
+
+    pthread_rwlock_rdlock(&lock);
+    const struct ext_file *f = lookup(handle);
+    if (!f) ok = 0;
+    for (uint32_t i = 0; ok && i < count; i++)
+        ok = split(f, srcs[i], dsts[i], block_size) == 0;
+    pthread_rwlock_unlock(&lock);
+
+    if (!ok) {
+        atomic_fetch_add_explicit(&misses, 1, memory_order_relaxed);
+        return -1;
+    }
+    *out_srcs = pieces.srcs;
+    *out_dsts = pieces.dsts;
+    *lens = pieces.lens;
+    return (int64_t)pieces.n;
+}
+
+void extents_get_stats(struct extents_stats *out) {
+    memset(out, 0, sizeof(*out));
+    pthread_rwlock_rdlock(&lock);
+    for (int i = 0; i < EXTENTS_MAX_FILES; i++) {
+        if (files[i].handle == 0) continue;
+        out->files++;
+        out->extents += files[i].n;
+    }
+    pthread_rwlock_unlock(&lock);
+    out->registers = atomic_load_explicit(&registers, memory_order_relaxed);
+    out->refused = atomic_load_explicit(&refused, memory_order_relaxed);
+    out->misses = atomic_load_explicit(&misses, memory_order_relaxed);
+}
+
+void extents_reset_stats(void) {
+    atomic_store(&registers, 0);
+    atomic_store(&refused, 0);
+    atomic_store(&misses, 0);
+}
@@ -0,0 +1,50 @@
+#ifndef SERVER_EXTENTS_H
+#define SERVER_EXTENTS_H
+
+#include <stdint.h>
+
+/* Registered extent maps kept at once; a new one is refused until one is unregistered */
+#define EXTENTS_MAX_FILES 16
+
+/* One extent of a registered file, as the client read it with FIEMAP */
+struct ext_rec {
+    int64_t logical;
+    int64_t physical;
+    int64_t len;
+};
+
+struct extents_stats {
+    uint64_t files;         /* maps currently registered */
+    uint64_t extents;       /* extents held over all of them */
+    uint64_t registers;     /* REGISTER_EXTENTS chunks accepted */
+    uint64_t refused;       /* new maps refused: every slot in use */
+    uint64_t misses;        /* copies refused: unknown handle or unmapped range */
+};
+
+/*
+ * Add n extents (sorted by logical offset, not overlapping what the map
+ * already holds) to the map `handle`, or to a new map if handle is 0.
+ * Returns the map's handle, or 0 if the handle is unknown, the extents
+ * are out of order, or a new map finds all EXTENTS_MAX_FILES in use.
+ */
+uint32_t extents_register(uint32_t handle, const struct ext_rec *v, uint32_t n);
+
+/* Drop the map `handle`; returns 0, or -1 if the handle is unknown */
+int extents_unregister(uint32_t handle);
+
+/*
+ * Translate `count` copies of block_size bytes from logical srcs[i] to
+ * logical dsts[i] of file `handle` into device copies: piece k moves
+ * lens[k] bytes from PBA out_srcs[k] to PBA out_dsts[k], a copy crossing an
+ * extent boundary giving several pieces. The out arrays are thread-local
+ * and valid until the next call. Returns the number of pieces, or -1 if
+ * the handle is unknown or a range is not mapped.
+ */
+int64_t extents_translate(uint32_t handle, const int64_t *srcs, const int64_t *dsts,
+                          uint32_t count, uint32_t block_size, int64_t **out_srcs,
+                          int64_t **out_dsts, uint32_t **lens);
+
+void extents_get_stats(struct extents_stats *out);
+void extents_reset_stats(void);
+
+#endif
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include "server_native.h"
+#include "native_proto.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct native_conn {
+    int fd;
+    _Atomic int refs;           /* the poll loop's, plus one per batch not yet answered */
+    pthread_mutex_t wlock;      /* one reply written at a time */
+    uint8_t hdr[NATIVE_HDR_LEN];
+    uint32_t got;               /* bytes of the header, then of the body, read so far */
+    struct native_job *job;     /* receiving a body into job->body, or NULL */
+};
+
+struct native_job {
+    struct native_conn *c;
+    uint64_t id;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t len;
+    uint8_t *body;              /* NATIVE_MAX_BODY bytes, 64-byte aligned */
+    struct native_job *next;
+};
+
+/* Free buffers and batches waiting for a worker, under one lock */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    pthread_cond_t ready;
+    struct native_job *free;
+    struct native_job *head, *tail;
+} q = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        NULL, NULL, NULL };
+
+static native_batch_fn g_run;
+static int g_listen = -1;
+static int g_epoll = -1;
+
+static _Atomic uint64_t g_conns, g_batches, g_bad_frames, g_bytes_in;
+
+static struct native_job *job_take(void) {
+    pthread_mutex_lock(&q.lock);
+    while (!q.free) pthread_cond_wait(&q.freed, &q.lock);
+    struct native_job *j = q.free;
+    q.free = j->next;
+    pthread_mutex_unlock(&q.lock);
+    return j;
+}
+
+static void job_release(struct native_job *j) {
+    pthread_mutex_lock(&q.lock);
+    j->next = q.free;
+    q.free = j;
+    pthread_cond_signal(&q.freed);
+    pthread_mutex_unlock(&q.lock);
+}
+
+static void job_queue(struct native_job *j) {
+    pthread_mutex_lock(&q.lock);
+    j->next = NULL;
+    if (q.tail) q.tail->next = j;
+    else q.head = j;
+    q.tail = j;
+    pthread_cond_signal(&q.ready);
+    pthread_mutex_unlock(&q.lock);
+}
+
+static struct native_job *job_pop(void) {
+    pthread_mutex_lock(&q.lock);
+    while (!q.head) pthread_cond_wait(&q.ready, &q.lock);
+    struct native_job *j = q.head;
+    q.head = j->next;
+    if (!q.head) q.tail = NULL;
+    pthread_mutex_unlock(&q.lock);
+    return j;
+}
+
+static void conn_put(struct native_conn *c) {
+    if (atomic_fetch_sub(&c->refs, 1) != 1) return;
+    close(c->fd);
+    pthread_mutex_destroy(&c->wlock);
+    free(c);
+}
+
+/* Write all of buf on the non-blocking socket, waiting while it is full */
+static int send_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+        if (w > 0) {
+            buf += w;
+            len -= w;
+        } else if (w < 0 && errno == EAGAIN) {
+            struct pollfd p = { fd, POLLOUT, 0 };
+            poll(&p, 1, -1);
+        } else if (w < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *native_worker(void *arg) {
+    for (;;) {
+        struct native_job *j = job_pop();
+        struct native_conn *c = j->c;
+
+        int result = -1;
+        int64_t *srcs, *dsts;
+        uint32_t *lens, count, block_size;
+        if (j->type == NATIVE_COPY &&
+            native_copy_decode(j->body, j->len, j->flags, &srcs, &dsts, &lens, &count,
+                               &block_size) == 0) {
+            g_run(srcs, dsts, lens, count, block_size, &result);
+            atomic_fetch_add_explicit(&g_batches, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&g_bad_frames, 1, memory_order_relaxed);
+        }
+
+        uint8_t out[NATIVE_HDR_LEN + NATIVE_REPLY_LEN];
+        uint32_t len = htole32(NATIVE_REPLY_LEN), res = htole32((uint32_t)result);
+        uint16_t type = htole16(NATIVE_REPLY), flags = 0;
+        uint64_t id = htole64(j->id);
+        memcpy(out, &len, 4);
+        memcpy(out + 4, &type, 2);
+        memcpy(out + 6, &flags, 2);
+        memcpy(out + 8, &id, 8);
+        memcpy(out + NATIVE_HDR_LEN, &res, 4);
+        job_release(j);
+
+        pthread_mutex_lock(&c->wlock);
+        send_all(c->fd, out, sizeof(out));
+        pthread_mutex_unlock(&c->wlock);
+        conn_put(c);
+    }
+    return NULL;
+}
+
+/*
+ * Read whatever the socket has: header bytes into c->hdr, body bytes
+ * straight into a receive buffer. A complete frame goes to the workers.
+ * Returns -1 when the connection is done (EOF, error, bad header).
+ */
+static int conn_read(struct native_conn *c) {
+    for (;;) {
+        if (!c->job) {
+            ssize_t r = recv(c->fd, c->hdr + c->got, NATIVE_HDR_LEN - c->got, 0);
+            if (r < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+            if (r <= 0) return -1;
+            atomic_fetch_add_explicit(&g_bytes_in, r, memory_order_relaxed);
+            c->got += r;
+            if (c->got < NATIVE_HDR_LEN) continue;
+
+            uint32_t len;
+            uint16_t type, flags;
+            uint64_t id;
+            memcpy(&len, c->hdr, 4);
+            memcpy(&type, c->hdr + 4, 2);
+            memcpy(&flags, c->hdr + 6, 2);
+            memcpy(&id, c->hdr + 8, 8);
+            if (le32toh(len) > NATIVE_MAX_BODY) {
+                fprintf(stderr, "native: frame of %u bytes refused\n", le32toh(len));
+                atomic_fetch_add_explicit(&g_bad_frames, 1, memory_order_relaxed);
+                return -1;
+            }
+            c->job = job_take();
+            c->job->c = c;
+            c->job->len = le32toh(len);
+            c->job->type = le16toh(type);
+            c->job->flags = le16toh(flags);
+            c->job->id = le64toh(id);
+            c->got = 0;
+        }
+
+        struct native_job *j = c->job;
+        if (c->got < j->len) {
+            ssize_t r = recv(c->fd, j->body + c->got, j->len - c->got, 0);
+            if (r < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+            if (r <= 0) return -1;
+            atomic_fetch_add_explicit(&g_bytes_in, r, memory_order_relaxed);
+            c->got += r;
+            if (c->got < j->len) continue;
+        }
+
+        atomic_fetch_add(&c->refs, 1);
+        c->job = NULL;
+        c->got = 0;
+        job_queue(j);
+    }
+}
+
+static void conn_accept(void) {
+    for (;;) {
+        int fd = accept4(g_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct native_conn *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        atomic_init(&c->refs, 1);
+        pthread_mutex_init(&c->wlock, NULL);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            perror("epoll_ctl");
+            conn_put(c);
+            continue;
+        }
+        atomic_fetch_add_explicit(&g_conns, 1, memory_order_relaxed);
+    }
+}
+
+static void *native_loop(void *arg) {
+    struct epoll_event evs[64];
+    for (;;) {
+        int n = epoll_wait(g_epoll, evs, 64, -1);
+        for (int i = 0; i < n; i++) {
+            struct native_conn *c = evs[i].data.ptr;
+            if (!c) {
+                conn_accept();
+                continue;
+            }
+            if (conn_read(c) != 0) {
+                epoll_ctl(g_epoll, EPOLL_CTL_DEL, c->fd, NULL);
+                if (c->job) job_release(c->job);
+                c->job = NULL;
+                conn_put(c);
+            }
+        }
+    }
+    return NULL;
+}
+
+int native_start(uint16_t port, int workers, native_batch_fn run) {
+    g_run = run;
+    if (workers < 1) workers = 1;
+
+    int nbufs = workers * NATIVE_BUFS_PER_WORKER;
+    for (int i = 0; i < nbufs; i++) {
+        struct native_job *j = calloc(1, sizeof(*j));
+        if (!j || posix_memalign((void **)&j->body, 64, NATIVE_MAX_BODY) != 0) {
+            perror("native_start");
+            return -1;
+        }
+        j->next = q.free;
+        q.free = j;
+    }
+
+    g_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (g_listen < 0 ||
+        setsockopt(g_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(g_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(g_listen, 64) != 0) {
+        perror("native listen");
+        return -1;
+    }
+
+    g_epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (g_epoll < 0 || epoll_ctl(g_epoll, EPOLL_CTL_ADD, g_listen, &ev) != 0) {
+        perror("native epoll");
+        return -1;
+    }
+
+    pthread_t tid;
+    int ret = pthread_create(&tid, NULL, native_loop, NULL);
+    for (int i = 0; ret == 0 && i < workers; i++)
+        ret = pthread_create(&tid, NULL, native_worker, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void native_get_stats(struct native_stats *out) {
+    out->conns = atomic_load_explicit(&g_conns, memory_order_relaxed);
+    out->batches = atomic_load_explicit(&g_batches, memory_order_relaxed);
+    out->bad_frames = atomic_load_explicit(&g_bad_frames, memory_order_relaxed);
+    out->bytes_in = atomic_load_explicit(&g_bytes_in, memory_order_relaxed);
+}
+
+void native_reset_stats(void) {
+    atomic_store_explicit(&g_batches, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_bad_frames, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_bytes_in, 0, memory_order_relaxed);
+}
@@ -0,0 +1,33 @@
+#ifndef SERVER_NATIVE_H
+#define SERVER_NATIVE_H
+
+#include <stdint.h>
+
+/* Receive buffers per worker thread: one being run, one being read into */
+#define NATIVE_BUFS_PER_WORKER 2
+
+/* Runs one batch; same contract as run_batch in server_random.c */
+typedef void (*native_batch_fn)(const int64_t *srcs, const int64_t *dsts, const uint32_t *lens,
+                                uint32_t count, uint32_t block_size, int *result);
+
+struct native_stats {
+    uint64_t conns;         /* connections accepted */
+    uint64_t batches;       /* NATIVE_COPY frames run */
+    uint64_t bad_frames;    /* frames refused as malformed */
+    uint64_t bytes_in;      /* frame bytes received, headers included */
+};
+
+/*
+ * Serve the native transport (native_proto.h) on TCP `port` next to the
+ * RPC program. One epoll thread accepts connections and reads each frame
+ * straight into a receive buffer allocated at startup; `workers` threads
+ * run the batches through `run` and write the replies as they complete.
+ * When every buffer is taken, reading stops until a batch finishes.
+ * Returns 0 once the threads run, or -1.
+ */
+int native_start(uint16_t port, int workers, native_batch_fn run);
+
+void native_get_stats(struct native_stats *out);
+void native_reset_stats(void);
+
+#endif
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+#include "server_offload.h"
+#include "server_target.h"
+#include <errno.h>
+#include <linux/fs.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct offload_dev {
+    int is_file;                /* only regular files can offload */
+    int64_t clone_align;        /* FICLONERANGE granularity: filesystem block size */
+    _Atomic int no_clone;       /* filesystem refused a clone; stop trying */
+};
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+static struct offload_dev odevs[TARGET_MAX_DEVS];
+static _Atomic int no_copy_range = 0;   /* kernel without copy_file_range */
+
+int offload_init(void) {
+    int n = 0;
+    for (int i = 0; i < target_ndevs(); i++) {
+        struct stat st;
+        if (fstat(target_dev(i)->fd, &st) != 0) {
+            perror(target_dev(i)->path);
+            st.st_mode = 0;
+        }
+        odevs[i].is_file = S_ISREG(st.st_mode);
+        odevs[i].clone_align = odevs[i].is_file && st.st_blksize > 0 ? st.st_blksize : 4096;
+        atomic_store(&odevs[i].no_clone, 0);
+        n += odevs[i].is_file;
+    }
+    return n;
+}
+
+static int try_clone(const struct target_dev *s, const struct target_dev *d, int di,
+                     int64_t src, int64_t dst, uint64_t len) {
+    int64_t a = odevs[di].clone_align;
+    if (atomic_load_explicit(&odevs[di].no_clone, memory_order_relaxed)) return 0;
+    if (src % a != 0 || dst % a != 0 || len % a != 0) return 0;
+
+    struct file_clone_range r = {
+        .src_fd = s->fd,
+        .src_offset = (uint64_t)src,
+        .src_length = len,
+        .dest_offset = (uint64_t)dst,
+    };
+    if (ioctl(d->fd, FICLONERANGE, &r) == 0) return 1;
+
+    /* ext4 and friends: no reflink at all */
+    if (errno == EOPNOTSUPP || errno == ENOTTY)
+        atomic_store_explicit(&odevs[di].no_clone, 1, memory_order_relaxed);
+    return 0;
+}
+
+static int try_copy_range(const struct target_dev *s, const struct target_dev *d,
+                          int64_t src, int64_t dst, uint64_t len) {
+    if (atomic_load_explicit(&no_copy_range, memory_order_relaxed)) return 0;
+
+    off64_t in = src, out = dst;
+    while (len > 0) {
+        ssize_t n = copy_file_range(s->fd, &in, d->fd, &out, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n < 0 && errno == ENOSYS)
+                atomic_store_explicit(&no_copy_range, 1, memory_order_relaxed);
+            /* the caller redoes the whole range; the source is untouched */
+            return 0;
+        }
+        len -= (uint64_t)n;
+    }
+    return 1;
+}
+
+enum offload_path offload_copy(int64_t src, int64_t dst, uint64_t len) {
+    int64_t rs, rd;
+    uint64_t cs, cd;
+    int si = target_map(src, &rs, &cs), di = target_map(dst, &rd, &cd);
+    if (si < 0 || di < 0 || cs < len || cd < len) return OFFLOAD_NONE;
+    if (!odevs[si].is_file || !odevs[di].is_file) return OFFLOAD_NONE;
+
+    const struct target_dev *s = target_dev(si), *d = target_dev(di);
+
+    /* both calls refuse overlapping ranges of one file */
+    if (si == di && rs < rd + (int64_t)len && rd < rs + (int64_t)len) return OFFLOAD_NONE;
+
+    /* charged to the destination device as one write */
+    struct timespec t0, t1;
+    enum offload_path path = OFFLOAD_NONE;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    if (try_clone(s, d, di, rs, rd, len)) path = OFFLOAD_CLONE;
+    else if (try_copy_range(s, d, rs, rd, len)) path = OFFLOAD_COPY_RANGE;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    if (path != OFFLOAD_NONE) target_account(di, 1, ns_diff(t0, t1));
+    return path;
+}
@@ -0,0 +1,30 @@
+#ifndef SERVER_OFFLOAD_H
+#define SERVER_OFFLOAD_H
+
+#include <stdint.h>
+
+/* How offload_copy moved a range */
+enum offload_path {
+    OFFLOAD_NONE = 0,       /* not offloaded: the caller copies it itself */
+    OFFLOAD_CLONE,          /* FICLONERANGE: extents shared, no data moved */
+    OFFLOAD_COPY_RANGE,     /* copy_file_range: copied inside the kernel */
+};
+
+/*
+ * Copy-offload engine (-x) for targets that are regular files: a copy is
+ * done by the filesystem, without the data reaching user space. Call once
+ * after target_open(); returns how many target devices can offload.
+ */
+int offload_init(void);
+
+/*
+ * Copy len bytes from target offset src to dst, trying FICLONERANGE when
+ * the range is aligned to the filesystem block size, then copy_file_range.
+ * Ranges that are not contiguous on one device (target_contiguous) or that
+ * overlap are not offloaded. Returns the path taken, or OFFLOAD_NONE if
+ * neither applies (nothing was changed that a plain copy of the range would
+ * not overwrite).
+ */
+enum offload_path offload_copy(int64_t src, int64_t dst, uint64_t len);
+
+#endif
@@ -1,77 +1,194 @@
 #define _GNU_SOURCE
 #include "server_random.h"
+#include "batch_pack.h"
+#include "batch_plan.h"
+#include "batch_sched.h"
+#include "block_cache.h"
 #include "blockcopy_random.h"
+#include "buf_pool.h"
+#include "server_devq.h"
+#include "server_extents.h"
+#include "server_native.h"
+#include "server_offload.h"
+#include "server_shm.h"
+#include "server_target.h"
+#include "server_uring.h"
+#include "server_verify.h"
+#include "svc_pool.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <rpc/pmap_clnt.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 #include <time.h>
 #include <unistd.h>
 
-#define DEVICE_BLOCK_SIZE 512
-
 static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
     return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull + (uint64_t)(b.tv_nsec - a.tv_nsec);
 }
 
-static uint64_t g_read_ns = 0;
-static uint64_t g_write_ns = 0;
-static uint64_t g_other_ns = 0;
+/*
+ * Timing counters, sharded per thread so workers never share a cache line.
+ * A thread claims a shard on its first update; get_time_1_svc sums them.
+ */
+struct stat_shard {
+    _Atomic uint64_t read_ns;
+    _Atomic uint64_t write_ns;
+    _Atomic uint64_t other_ns;
+    _Atomic uint64_t copies;        /* block copies requested */
+    _Atomic uint64_t read_ios;      /* device reads issued for them */
+    _Atomic uint64_t write_ios;     /* device writes issued for them */
+    _Atomic uint64_t dep_edges;     /* ordering constraints between merged runs */
+    _Atomic uint64_t seek_bytes;    /* distance between consecutive I/Os, as issued */
+    _Atomic uint64_t seek_bytes_fifo; /* the same, had they been issued in batch order */
+    _Atomic uint64_t offload[3];    /* -x: copies per enum offload_path */
+} __attribute__((aligned(64)));
+
+static struct stat_shard g_shards[MAX_SHARDS];
+static _Atomic int g_nshards = 0;
+static __thread struct stat_shard *t_shard = NULL;
+
+static struct stat_shard *my_shard(void) {
+    if (!t_shard) {
+        int i = atomic_fetch_add(&g_nshards, 1);
+        t_shard = &g_shards[i % MAX_SHARDS];
+    }
+    return t_shard;
+}
+
+static void account(uint64_t read_ns, uint64_t write_ns, uint64_t other_ns) {
+    my_shard();
+    atomic_fetch_add_explicit(&t_shard->read_ns, read_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t_shard->write_ns, write_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t_shard->other_ns, other_ns, memory_order_relaxed);
+}
+
+static void account_ios(uint64_t copies, uint64_t read_ios, uint64_t write_ios,
+                        uint64_t dep_edges) {
+    struct stat_shard *sh = my_shard();
+    atomic_fetch_add_explicit(&sh->copies, copies, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->read_ios, read_ios, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->write_ios, write_ios, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->dep_edges, dep_edges, memory_order_relaxed);
+}
+
+static void account_seeks(uint64_t seek_bytes, uint64_t seek_bytes_fifo) {
+    struct stat_shard *sh = my_shard();
+    atomic_fetch_add_explicit(&sh->seek_bytes, seek_bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->seek_bytes_fifo, seek_bytes_fifo, memory_order_relaxed);
+}
+
+static void account_offload(const uint64_t copies[3]) {
+    struct stat_shard *sh = my_shard();
+    for (int i = 0; i < 3; i++)
+        atomic_fetch_add_explicit(&sh->offload[i], copies[i], memory_order_relaxed);
+}
+
+/* Largest merged I/O built from adjacent copies (-c); 0 until main() sets it */
+static uint32_t g_coalesce_bytes = 0;
+
+/* Issue order of ready runs (-o) and how far sorting may look ahead (-w) */
+static int g_sched_policy = ORDER_FIFO;
+static uint32_t g_sched_window = 0;
+
+/* -C: memory budget of the source block cache, 0 = off */
+static size_t cache_bytes = 0;
+
+/* -x: let the filesystem copy when the target is an image file */
+static int g_offload = 0;
+
+/* -V: check every batch against a serial replay (see server_verify.h) */
+static int g_verify = 0;
+
+/* -N: TCP port of the native transport, 0 = RPC only */
+static int g_native_port = 0;
+
+/* -r: fixed TCP port for RPC without the portmapper, 0 = registered with it */
+static int g_rpc_port = 0;
+
+/* -U: Unix socket of the same-host ring transport, NULL = off; -Y: its spin */
+static const char *g_shm_path = NULL;
+static long g_shm_spin_us = 0;
+
+/* Requests refused by target_check (out of range or misaligned PBAs) */
+static _Atomic uint64_t g_target_rejects = 0;
+
+/* One-way batches run and failed, barriers answered and time spent flushing */
+static _Atomic uint64_t g_async_batches = 0, g_async_failed = 0;
+static _Atomic uint64_t g_barriers = 0, g_barrier_sync_ns = 0;
+
+/* pread through the block cache (-C); a hit never touches the device */
+static ssize_t cached_pread(void *buf, size_t len, int64_t off) {
+    if (block_cache_read(off, len, buf)) return len;
+    uint64_t token = block_cache_fill_begin(off, len);
+    ssize_t r = target_pread(buf, len, off);
+    block_cache_fill_end(off, len, buf, r == (ssize_t)len, token);
+    return r;
+}
+
+/* pwrite that keeps cached copies of the written pages current */
+static ssize_t cached_pwrite(const void *buf, size_t len, int64_t off) {
+    ssize_t w = target_pwrite(buf, len, off);
+    block_cache_write(off, len, buf, w == (ssize_t)len);
+    return w;
+}
 
 /* Old single-block function - kept for backward compatibility */
-int *write_pba_1_svc(pba_write_params *params, struct svc_req *rqstp) {
-    static int result = 0;
+bool_t write_pba_1_svc(pba_write_params *params, int *result, struct svc_req *rqstp) {
     struct timespec t_total0, t_total1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total0);
 
-    static int fd = -1;
-    if (fd == -1) {
-        fd = open(DEVICE_PATH, O_RDWR | O_DIRECT);
-        if (fd < 0) {
-            perror("open");
-            result = -1;
-            return &result;
-        }
+    *result = 0;
+
+    if (target_check(params->pba_src, params->nbytes) != 0 ||
+        target_check(params->pba_dst, params->nbytes) != 0) {
+        fprintf(stderr, "write_pba: rejected %lld -> %lld (%d bytes)\n",
+                (long long)params->pba_src, (long long)params->pba_dst, params->nbytes);
+        atomic_fetch_add_explicit(&g_target_rejects, 1, memory_order_relaxed);
+        *result = -1;
+        return TRUE;
     }
 
-    void *buf;
-    if (posix_memalign(&buf, ALIGN, params->nbytes) != 0) {
-        perror("posix_memalign");
-        result = -1;
-        return &result;
+    void *buf = buf_pool_get(params->nbytes);
+    if (!buf) {
+        perror("buf_pool_get");
+        *result = -1;
+        return TRUE;
     }
 
     /* --- READ PHASE --- */
     struct timespec t_read0, t_read1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_read0);
-    ssize_t r = pread(fd, buf, params->nbytes, params->pba_src);
+    ssize_t r = cached_pread(buf, params->nbytes, params->pba_src);
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_read1);
     uint64_t read_ns = ns_diff(t_read0, t_read1);
 
     if (r != params->nbytes) {
         perror("pread");
-        free(buf);
-        result = -1;
-        return &result;
+        buf_pool_put(buf);
+        *result = -1;
+        return TRUE;
     }
 
     /* --- WRITE PHASE --- */
     struct timespec t_write0, t_write1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_write0);
-    ssize_t w = pwrite(fd, buf, params->nbytes, params->pba_dst);
+    ssize_t w = cached_pwrite(buf, params->nbytes, params->pba_dst);
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_write1);
     uint64_t write_ns = ns_diff(t_write0, t_write1);
 
     if (w != params->nbytes) {
         perror("pwrite");
-        free(buf);
-        result = -1;
-        return &result;
+        buf_pool_put(buf);
+        *result = -1;
+        return TRUE;
     }
 
-    free(buf);
+    buf_pool_put(buf);
 
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total1);
     uint64_t total_ns = ns_diff(t_total0, t_total1);
@@ -79,70 +196,219 @@ int *write_pba_1_svc(pba_write_params *params, struct svc_req *rqstp) {
                             ? (total_ns - read_ns - write_ns)
                             : 0;
 
-    /* Accumulate into global timing counters */
-    g_read_ns += read_ns;
-    g_write_ns += write_ns;
-    g_other_ns += other_ns;
+    /* Accumulate into this thread's timing shard */
+    account(read_ns, write_ns, other_ns);
+    account_ios(1, 1, 1, 0);
 
-    result = 0;
-    return &result;
+    return TRUE;
 }
 
-/* New batched function */
-int *write_pba_batch_1_svc(pba_batch_params *params, struct svc_req *rqstp) {
-    static int result = 0;
-    struct timespec t_total0, t_total1;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &t_total0);
+/* Pread every source of a group into buf, then pwrite every destination */
+static int copy_group(const struct batch_plan *plan, const struct plan_group *g,
+                      char *buf, uint64_t *read_ns, uint64_t *write_ns) {
+    /* --- READ PHASE --- */
+    for (uint32_t k = 0; k < g->nreads; k++) {
+        const struct plan_io *io = &plan->ios[g->read_first + k];
+        struct timespec t_read0, t_read1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_read0);
+        ssize_t r = cached_pread(buf + io->buf_off, io->len, io->off);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_read1);
+        *read_ns += ns_diff(t_read0, t_read1);
 
-    static int fd = -1;
-    if (fd == -1) {
-        fd = open(DEVICE_PATH, O_RDWR | O_DIRECT);
-        if (fd < 0) {
-            perror("open");
-            result = -1;
-            return &result;
+        if (r != (ssize_t)io->len) {
+            perror("pread");
+            return -1;
         }
     }
 
-    void *buf;
-    if (posix_memalign(&buf, ALIGN, params->block_size) != 0) {
-        perror("posix_memalign");
-        result = -1;
-        return &result;
+    /* --- WRITE PHASE --- */
+    for (uint32_t k = 0; k < g->nwrites; k++) {
+        const struct plan_io *io = &plan->ios[g->write_first + k];
+        struct timespec t_write0, t_write1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_write0);
+        ssize_t w = cached_pwrite(buf + io->buf_off, io->len, io->off);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_write1);
+        *write_ns += ns_diff(t_write0, t_write1);
+
+        if (w != (ssize_t)io->len) {
+            perror("pwrite");
+            return -1;
+        }
     }
+    return 0;
+}
 
-    uint64_t total_read_ns = 0;
-    uint64_t total_write_ns = 0;
+/*
+ * Copy one group through the offload engine. Runs of copies adjacent on
+ * both sides go to the filesystem as one range; a run it cannot take is
+ * read and written like copy_group. Runs are done in batch order, which
+ * matches the group's read-all-then-write-all semantics because no copy
+ * of a group reads what an earlier one writes (batch_plan.h).
+ */
+static int offload_group(const struct plan_group *g, const int64_t *srcs, const int64_t *dsts,
+                         const uint32_t *lens, uint32_t block_size,
+                         uint64_t *read_ns, uint64_t *write_ns, uint64_t copies[3]) {
+    uint32_t end = g->first + g->count;
+    for (uint32_t k = g->first, n; k < end; k += n) {
+        n = 1;
+        uint32_t len = lens ? lens[k] : block_size;
+        while (k + n < end) {
+            uint32_t next = lens ? lens[k + n] : block_size;
+            if (srcs[k + n] != srcs[k] + len || dsts[k + n] != dsts[k] + len ||
+                !target_contiguous(srcs[k], (uint64_t)len + next) ||
+                !target_contiguous(dsts[k], (uint64_t)len + next))
+                break;
+            len += next;
+            n++;
+        }
 
-    for (u_int32_t i = 0; i < params->count; i++) {
-        /* --- READ PHASE --- */
-        struct timespec t_read0, t_read1;
-        clock_gettime(CLOCK_MONOTONIC_RAW, &t_read0);
-        ssize_t r = pread(fd, buf, params->block_size, params->pba_srcs[i]);
-        clock_gettime(CLOCK_MONOTONIC_RAW, &t_read1);
-        total_read_ns += ns_diff(t_read0, t_read1);
+        /* an offloaded copy has no separate read; it counts as write time */
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+        enum offload_path path = offload_copy(srcs[k], dsts[k], len);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        if (path != OFFLOAD_NONE) {
+            block_cache_write(dsts[k], len, NULL, 0);
+            *write_ns += ns_diff(t0, t1);
+            copies[path] += n;
+            continue;
+        }
+
+        void *buf = buf_pool_get(len);
+        if (!buf) {
+            perror("buf_pool_get");
+            return -1;
+        }
 
-        if (r != (ssize_t)params->block_size) {
+        /* --- READ PHASE --- */
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+        ssize_t r = cached_pread(buf, len, srcs[k]);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        *read_ns += ns_diff(t0, t1);
+        if (r != (ssize_t)len) {
             perror("pread");
-            result = -1;
-            break;
+            buf_pool_put(buf);
+            return -1;
         }
 
         /* --- WRITE PHASE --- */
-        struct timespec t_write0, t_write1;
-        clock_gettime(CLOCK_MONOTONIC_RAW, &t_write0);
-        ssize_t w = pwrite(fd, buf, params->block_size, params->pba_dsts[i]);
-        clock_gettime(CLOCK_MONOTONIC_RAW, &t_write1);
-        total_write_ns += ns_diff(t_write0, t_write1);
-
-        if (w != (ssize_t)params->block_size) {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+        ssize_t w = cached_pwrite(buf, len, dsts[k]);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        *write_ns += ns_diff(t0, t1);
+        buf_pool_put(buf);
+        if (w != (ssize_t)len) {
             perror("pwrite");
-            result = -1;
+            return -1;
+        }
+        copies[OFFLOAD_NONE] += n;
+    }
+    return 0;
+}
+
+/*
+ * Run one batch of copies: copy i moves lens[i] bytes from srcs[i] to
+ * dsts[i], or block_size bytes when lens is NULL.
+ */
+static void run_batch(const int64_t *srcs, const int64_t *dsts, const uint32_t *lens,
+                      uint32_t count, uint32_t block_size, int *result) {
+    struct timespec t_total0, t_total1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t_total0);
+
+    *result = 0;
+
+    /* Refuse the whole batch before any I/O if one copy falls off the target or is misaligned */
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len = lens ? lens[i] : block_size;
+        if (target_check(srcs[i], len) != 0 || target_check(dsts[i], len) != 0) {
+            fprintf(stderr, "write_pba_batch: rejected copy %u: %lld -> %lld (%u bytes)\n", i,
+                    (long long)srcs[i], (long long)dsts[i], len);
+            atomic_fetch_add_explicit(&g_target_rejects, 1, memory_order_relaxed);
+            *result = -1;
+            return;
+        }
+    }
+
+    uint64_t total_read_ns = 0;
+    uint64_t total_write_ns = 0;
+
+    /* Merge runs of adjacent copies; the plan is reused by this thread */
+    static __thread struct batch_plan plan;
+    if (plan_batch(&plan, srcs, dsts, lens, count, block_size, g_coalesce_bytes) != 0) {
+        perror("plan_batch");
+        *result = -1;
+        return;
+    }
+
+    /* Order the runs; any order the graph allows keeps serial semantics */
+    static __thread struct batch_sched sched;
+    if (plan_deps(&plan) != 0 ||
+        batch_sched_start(&sched, &plan, g_sched_policy, g_sched_window) != 0) {
+        perror("batch_sched_start");
+        *result = -1;
+        return;
+    }
+
+    static __thread struct verify_state verify;
+    if (g_verify && verify_begin(&verify, srcs, dsts, lens, count, block_size) != 0) {
+        fprintf(stderr, "verify: cannot snapshot batch\n");
+        *result = -1;
+        return;
+    }
+
+    /* Offload engine (-x): groups one at a time, each copied by the filesystem */
+    uint64_t offload_copies[3] = {0, 0, 0};
+    if (g_offload) {
+        int64_t g_next;
+        while ((g_next = batch_sched_peek(&sched)) >= 0) {
+            batch_sched_issue(&sched, (uint32_t)g_next);
+            if (offload_group(&plan.groups[g_next], srcs, dsts, lens, block_size,
+                              &total_read_ns, &total_write_ns, offload_copies) != 0) {
+                *result = -1;
+                break;
+            }
+            batch_sched_done(&sched, (uint32_t)g_next);
+        }
+        goto done;
+    }
+
+    /* io_uring engine: independent groups of the batch in flight at once */
+    int rc = uring_copy_batch(&sched, &total_read_ns, &total_write_ns);
+    if (rc != -ENOSYS) {
+        *result = rc;
+        goto done;
+    }
+
+    /* Several devices and no io_uring: one blocking worker per device */
+    rc = devq_copy_batch(&sched, &total_read_ns, &total_write_ns);
+    if (rc != -ENOSYS) {
+        *result = rc;
+        goto done;
+    }
+
+    /* Fallback: blocking pread/pwrite, one group at a time */
+    int64_t next;
+    while ((next = batch_sched_peek(&sched)) >= 0) {
+        const struct plan_group *g = &plan.groups[next];
+        batch_sched_issue(&sched, (uint32_t)next);
+
+        void *buf = buf_pool_get(g->bytes);
+        if (!buf) {
+            perror("buf_pool_get");
+            *result = -1;
             break;
         }
+        int err = copy_group(&plan, g, buf, &total_read_ns, &total_write_ns);
+        buf_pool_put(buf);
+        if (err) {
+            *result = -1;
+            break;
+        }
+        batch_sched_done(&sched, (uint32_t)next);
     }
 
-    free(buf);
+done:
+    if (g_verify && verify_end(&verify) != 0) *result = -1;
 
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total1);
     uint64_t total_ns = ns_diff(t_total0, t_total1);
@@ -150,26 +416,735 @@ int *write_pba_batch_1_svc(pba_batch_params *params, struct svc_req *rqstp) {
                             ? (total_ns - total_read_ns - total_write_ns)
                             : 0;
 
-    /* Accumulate into global timing counters */
-    g_read_ns += total_read_ns;
-    g_write_ns += total_write_ns;
-    g_other_ns += other_ns;
+    /* Accumulate into this thread's timing shard */
+    account(total_read_ns, total_write_ns, other_ns);
+    account_ios(count, plan_reads(&plan), plan_writes(&plan), plan.nedges);
+    account_seeks(sched.seek_bytes, plan_seek_bytes(&plan));
+    if (g_offload) account_offload(offload_copies);
+}
 
-    return &result;
+/* New batched function */
+bool_t write_pba_batch_1_svc(pba_batch_params *params, int *result, struct svc_req *rqstp) {
+    /* count is not tied to the fixed-size arrays by XDR */
+    if (params->count > MAX_BATCH) {
+        *result = -1;
+        return TRUE;
+    }
+    run_batch(params->pba_srcs, params->pba_dsts, NULL, params->count, params->block_size,
+              result);
+    return TRUE;
+}
+
+/* Batch whose copies each carry their own length (extent-split copies) */
+bool_t write_pba_segs_1_svc(pba_seg_batch_params *params, int *result, struct svc_req *rqstp) {
+    if (params->count > MAX_BATCH) {
+        *result = -1;
+        return TRUE;
+    }
+    run_batch(params->pba_srcs, params->pba_dsts, params->lens, params->count, 0, result);
+    return TRUE;
 }
 
-get_server_ios *get_time_1_svc(void *argp, struct svc_req *rqstp) {
-    static get_server_ios out;
-    out.server_read_time = g_read_ns;
-    out.server_write_time = g_write_ns;
-    out.server_other_time = g_other_ns;
-    return &out;
+_Static_assert(sizeof(extent_rec) == sizeof(struct ext_rec), "extent_rec layout");
+
+/* Store a chunk of a client file's extent map; replies with its handle, 0 on error */
+bool_t register_extents_1_svc(extent_upload *params, u_int *result, struct svc_req *rqstp) {
+    *result = extents_register(params->handle,
+                               (const struct ext_rec *)params->extents.extents_val,
+                               params->extents.extents_len);
+    if (*result == 0)
+        fprintf(stderr, "register_extents: rejected %u extents for handle %u\n",
+                params->extents.extents_len, params->handle);
+    return TRUE;
+}
+
+bool_t unregister_extents_1_svc(u_int *handle, int *result, struct svc_req *rqstp) {
+    *result = extents_unregister(*handle);
+    return TRUE;
+}
+
+/* Batch by logical offset: translated here with the registered map, then run as device copies */
+bool_t write_logical_batch_1_svc(logical_batch_params *params, int *result,
+                                 struct svc_req *rqstp) {
+    *result = 0;
+    if (params->srcs.srcs_len != params->dsts.dsts_len) {
+        *result = -1;
+        return TRUE;
+    }
+
+    int64_t *srcs, *dsts;
+    uint32_t *lens;
+    int64_t n = extents_translate(params->handle, params->srcs.srcs_val, params->dsts.dsts_val,
+                                  params->srcs.srcs_len, params->block_size, &srcs, &dsts, &lens);
+    if (n < 0) {
+        fprintf(stderr, "write_logical_batch: cannot translate batch for handle %u\n",
+                params->handle);
+        *result = -1;
+        return TRUE;
+    }
+    run_batch(srcs, dsts, lens, (uint32_t)n, 0, result);
+    return TRUE;
+}
+
+bool_t get_time_1_svc(void *argp, get_server_ios *out, struct svc_req *rqstp) {
+    int n = atomic_load(&g_nshards);
+    if (n > MAX_SHARDS) n = MAX_SHARDS;
+
+    out->server_read_time = 0;
+    out->server_write_time = 0;
+    out->server_other_time = 0;
+    for (int i = 0; i < n; i++) {
+        out->server_read_time += atomic_load_explicit(&g_shards[i].read_ns, memory_order_relaxed);
+        out->server_write_time += atomic_load_explicit(&g_shards[i].write_ns, memory_order_relaxed);
+        out->server_other_time += atomic_load_explicit(&g_shards[i].other_ns, memory_order_relaxed);
+    }
+    return TRUE;
 }
 
-void *reset_time_1_svc(void *argp, struct svc_req *rqstp) {
-    static char dummy;
-    g_read_ns = g_write_ns = g_other_ns = 0;
+bool_t reset_time_1_svc(void *argp, void *result, struct svc_req *rqstp) {
+    for (int i = 0; i < MAX_SHARDS; i++) {
+        atomic_store_explicit(&g_shards[i].read_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].write_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].other_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].copies, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].read_ios, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].write_ios, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].dep_edges, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].seek_bytes, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].seek_bytes_fifo, 0, memory_order_relaxed);
+        for (int k = 0; k < 3; k++)
+            atomic_store_explicit(&g_shards[i].offload[k], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&g_target_rejects, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_async_batches, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_async_failed, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_barriers, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_barrier_sync_ns, 0, memory_order_relaxed);
+    target_reset_stats();
+    buf_pool_reset_stats();
+    block_cache_reset_stats();
+    verify_reset_stats();
+    extents_reset_stats();
+    native_reset_stats();
+    shm_reset_stats();
     fprintf(stdout, "server time reset complete.\n");
     fflush(stdout);
-    return (void *)&dummy;
-}
\ No newline at end of file
+    return TRUE;
+}
+
+/* Append one named counter; names are strdup'd so xdr_free can release them */
+static void stat_add(stat_list *out, const char *name, uint64_t value) {
+    stat_entry *e = realloc(out->stat_list_val, (out->stat_list_len + 1) * sizeof(*e));
+    if (!e) return;
+    out->stat_list_val = e;
+    e[out->stat_list_len].name = strdup(name);
+    e[out->stat_list_len].value = value;
+    out->stat_list_len++;
+}
+
+bool_t get_stats_1_svc(void *argp, stat_list *out, struct svc_req *rqstp) {
+    memset(out, 0, sizeof(*out));
+
+    struct buf_pool_stats bp;
+    buf_pool_get_stats(&bp);
+    stat_add(out, "buf_pool_hits", bp.hits);
+    stat_add(out, "buf_pool_misses", bp.misses);
+    stat_add(out, "buf_pool_peak_in_use", bp.peak);
+    stat_add(out, "buf_pool_in_use", bp.in_use);
+
+    int n = atomic_load(&g_nshards);
+    if (n > MAX_SHARDS) n = MAX_SHARDS;
+    uint64_t copies = 0, read_ios = 0, write_ios = 0, dep_edges = 0;
+    uint64_t seek_bytes = 0, seek_bytes_fifo = 0;
+    for (int i = 0; i < n; i++) {
+        copies += atomic_load_explicit(&g_shards[i].copies, memory_order_relaxed);
+        read_ios += atomic_load_explicit(&g_shards[i].read_ios, memory_order_relaxed);
+        write_ios += atomic_load_explicit(&g_shards[i].write_ios, memory_order_relaxed);
+        dep_edges += atomic_load_explicit(&g_shards[i].dep_edges, memory_order_relaxed);
+        seek_bytes += atomic_load_explicit(&g_shards[i].seek_bytes, memory_order_relaxed);
+        seek_bytes_fifo += atomic_load_explicit(&g_shards[i].seek_bytes_fifo, memory_order_relaxed);
+    }
+    stat_add(out, "copies", copies);
+    stat_add(out, "read_ios", read_ios);
+    stat_add(out, "write_ios", write_ios);
+    /* copies per device I/O, x100: 100 means nothing was merged */
+    stat_add(out, "merge_ratio_x100",
+             read_ios + write_ios ? 200 * copies / (read_ios + write_ios) : 0);
+    stat_add(out, "dep_edges", dep_edges);
+    stat_add(out, "seek_bytes", seek_bytes);
+    stat_add(out, "seek_bytes_fifo", seek_bytes_fifo);
+    /* mean distance between consecutive I/Os, issued vs batch order */
+    uint64_t ios = read_ios + write_ios;
+    stat_add(out, "seek_avg_kib", ios ? seek_bytes / ios / 1024 : 0);
+    stat_add(out, "seek_avg_kib_fifo", ios ? seek_bytes_fifo / ios / 1024 : 0);
+    stat_add(out, "target_rejects",
+             atomic_load_explicit(&g_target_rejects, memory_order_relaxed));
+    stat_add(out, "async_batches", atomic_load_explicit(&g_async_batches, memory_order_relaxed));
+    stat_add(out, "async_failed", atomic_load_explicit(&g_async_failed, memory_order_relaxed));
+    stat_add(out, "barriers", atomic_load_explicit(&g_barriers, memory_order_relaxed));
+    stat_add(out, "barrier_sync_ns",
+             atomic_load_explicit(&g_barrier_sync_ns, memory_order_relaxed));
+
+    /* per target device: I/O count and summed issue-to-completion time */
+    for (int i = 0; i < target_ndevs(); i++) {
+        struct target_dev_stats ds;
+        char name[32];
+        target_get_stats(i, &ds);
+        snprintf(name, sizeof(name), "dev%d_reads", i);
+        stat_add(out, name, ds.reads);
+        snprintf(name, sizeof(name), "dev%d_writes", i);
+        stat_add(out, name, ds.writes);
+        snprintf(name, sizeof(name), "dev%d_read_ns", i);
+        stat_add(out, name, ds.read_ns);
+        snprintf(name, sizeof(name), "dev%d_write_ns", i);
+        stat_add(out, name, ds.write_ns);
+    }
+
+    if (cache_bytes > 0) {
+        struct block_cache_stats cs;
+        block_cache_get_stats(&cs);
+        stat_add(out, "cache_hits", cs.hits);
+        stat_add(out, "cache_misses", cs.misses);
+        stat_add(out, "cache_evictions", cs.evictions);
+        stat_add(out, "cache_updates", cs.updates);
+        stat_add(out, "cache_stale_fills", cs.stale_fills);
+        stat_add(out, "cache_resident_pages", cs.resident);
+    }
+
+    if (g_offload) {
+        uint64_t off[3] = {0, 0, 0};
+        for (int i = 0; i < n; i++)
+            for (int k = 0; k < 3; k++)
+                off[k] += atomic_load_explicit(&g_shards[i].offload[k], memory_order_relaxed);
+        stat_add(out, "offload_clone", off[OFFLOAD_CLONE]);
+        stat_add(out, "offload_copy_range", off[OFFLOAD_COPY_RANGE]);
+        stat_add(out, "offload_fallback", off[OFFLOAD_NONE]);
+    }
+
+    if (g_verify) {
+        struct verify_stats vs;
+        verify_get_stats(&vs);
+        stat_add(out, "verify_batches", vs.batches);
+        stat_add(out, "verify_mismatches", vs.mismatches);
+    }
+
+    struct extents_stats es;
+    extents_get_stats(&es);
+    if (es.files > 0 || es.refused > 0) {
+        stat_add(out, "extent_files", es.files);
+        stat_add(out, "extent_map_extents", es.extents);
+        stat_add(out, "extent_registers", es.registers);
+        stat_add(out, "extent_refused", es.refused);
+        stat_add(out, "extent_misses", es.misses);
+    }
+
+    if (g_native_port) {
+        struct native_stats ns;
+        native_get_stats(&ns);
+        stat_add(out, "native_conns", ns.conns);
+        stat_add(out, "native_batches", ns.batches);
+        stat_add(out, "native_bad_frames", ns.bad_frames);
+        stat_add(out, "native_bytes_in", ns.bytes_in);
+    }
+
+    if (g_shm_path) {
+        struct shm_stats ss;
+        shm_get_stats(&ss);
+        stat_add(out, "shm_rings", ss.rings);
+        stat_add(out, "shm_batches", ss.batches);
+        stat_add(out, "shm_bad_entries", ss.bad_entries);
+        stat_add(out, "shm_wakeups", ss.wakeups);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Version 2: the same procedures with counted arrays. The batches go to the
+ * same run_batch, the rest to the version 1 handlers.
+ */
+bool_t write_pba_batch_2_svc(pba_batch2_params *params, int *result, struct svc_req *rqstp) {
+    if (params->pba_srcs.pba_srcs_len != params->pba_dsts.pba_dsts_len) {
+        *result = -1;
+        return TRUE;
+    }
+    run_batch(params->pba_srcs.pba_srcs_val, params->pba_dsts.pba_dsts_val, NULL,
+              params->pba_srcs.pba_srcs_len, params->block_size, result);
+    return TRUE;
+}
+
+bool_t write_pba_segs_2_svc(pba_seg_batch2_params *params, int *result, struct svc_req *rqstp) {
+    if (params->pba_srcs.pba_srcs_len != params->pba_dsts.pba_dsts_len ||
+        params->pba_srcs.pba_srcs_len != params->lens.lens_len) {
+        *result = -1;
+        return TRUE;
+    }
+    run_batch(params->pba_srcs.pba_srcs_val, params->pba_dsts.pba_dsts_val,
+              params->lens.lens_val, params->pba_srcs.pba_srcs_len, 0, result);
+    return TRUE;
+}
+
+/* Decoded copies of the WRITE_PBA_PACKED batch this thread is serving */
+static __thread struct {
+    int64_t *srcs;
+    int64_t *dsts;
+    uint32_t *lens;
+    uint32_t cap;
+} unpacked;
+
+static int unpacked_reserve(uint32_t n) {
+    if (n <= unpacked.cap) return 0;
+    int64_t *s = realloc(unpacked.srcs, n * sizeof(*s));
+    if (s) unpacked.srcs = s;
+    int64_t *d = realloc(unpacked.dsts, n * sizeof(*d));
+    if (d) unpacked.dsts = d;
+    uint32_t *l = realloc(unpacked.lens, n * sizeof(*l));
+    if (l) unpacked.lens = l;
+    if (!s || !d || !l) return -1;
+    unpacked.cap = n;
+    return 0;
+}
+
+/* Runs or delta-coded batch: expanded to plain arrays, then run like WRITE_PBA_BATCH */
+bool_t write_pba_packed_2_svc(pba_packed_params *params, int *result, struct svc_req *rqstp) {
+    const packed_batch *b = &params->batch;
+    uint32_t n = params->count;
+    int bad = n > MAX_BATCH2 || unpacked_reserve(n) != 0;
+    uint32_t *lens = params->block_size ? NULL : unpacked.lens;
+
+    if (!bad && b->enc == ENC_RUNS)
+        bad = lens != NULL ||
+              unpack_runs(b->packed_batch_u.runs.runs_val, b->packed_batch_u.runs.runs_len, n,
+                          unpacked.srcs, unpacked.dsts) != 0;
+    else if (!bad && b->enc == ENC_DELTA)
+        bad = unpack_deltas((const uint8_t *)b->packed_batch_u.deltas.bytes.bytes_val,
+                            b->packed_batch_u.deltas.bytes.bytes_len, n,
+                            b->packed_batch_u.deltas.shift, unpacked.srcs, unpacked.dsts,
+                            lens) != 0;
+    else
+        bad = 1;
+
+    if (bad) {
+        fprintf(stderr, "write_pba_packed: malformed batch of %u copies\n", n);
+        *result = -1;
+        return TRUE;
+    }
+    run_batch(unpacked.srcs, unpacked.dsts, lens, n, params->block_size, result);
+    return TRUE;
+}
+
+/*
+ * What BARRIER will report for each connection's one-way batches, by
+ * socket. A connection's requests are served one at a time and in order
+ * (svc_run, svc_pool), so no lock is needed. A later connection on the
+ * same socket is told apart by its transport handle, or by its seq
+ * starting over.
+ */
+struct async_stream {
+    const SVCXPRT *xprt;
+    uint64_t next_seq;
+    uint64_t batches;       /* run since the last barrier */
+    uint64_t failed_seq;    /* first of them that failed, if failed */
+    int failed;
+};
+
+static struct async_stream g_streams[FD_SETSIZE];
+
+static struct async_stream *async_stream(const SVCXPRT *xprt) {
+    if (xprt->xp_fd < 0 || xprt->xp_fd >= FD_SETSIZE) return NULL;
+    struct async_stream *s = &g_streams[xprt->xp_fd];
+    if (s->xprt != xprt) {
+        memset(s, 0, sizeof(*s));
+        s->xprt = xprt;
+    }
+    return s;
+}
+
+/* One-way batch: run like WRITE_PBA_BATCH/SEGS; the outcome waits for BARRIER */
+bool_t write_pba_async_2_svc(async_batch_params *params, void *result, struct svc_req *rqstp) {
+    struct async_stream *s = async_stream(rqstp->rq_xprt);
+    if (s && params->seq < s->next_seq) {
+        memset(s, 0, sizeof(*s));
+        s->xprt = rqstp->rq_xprt;
+    }
+
+    u_int n = params->pba_srcs.pba_srcs_len;
+    u_int nlens = params->lens.lens_len;
+    int res = -1;
+    if (n == params->pba_dsts.pba_dsts_len && (nlens == 0 || nlens == n))
+        run_batch(params->pba_srcs.pba_srcs_val, params->pba_dsts.pba_dsts_val,
+                  nlens ? params->lens.lens_val : NULL, n, params->block_size, &res);
+    atomic_fetch_add_explicit(&g_async_batches, 1, memory_order_relaxed);
+    if (res != 0) atomic_fetch_add_explicit(&g_async_failed, 1, memory_order_relaxed);
+
+    if (!s) {
+        fprintf(stderr, "write_pba_async: socket %d out of range, outcome lost\n",
+                rqstp->rq_xprt->xp_fd);
+        return FALSE;
+    }
+    if (res != 0 && !s->failed) {
+        s->failed = 1;
+        s->failed_seq = params->seq;
+    }
+    s->batches++;
+    s->next_seq = params->seq + 1;
+    return FALSE;   /* one-way: no reply */
+}
+
+/*
+ * Every one-way batch sent before this call on the connection has run;
+ * flush the devices so they are durable, then report and start over.
+ */
+bool_t barrier_2_svc(void *argp, barrier_reply *out, struct svc_req *rqstp) {
+    struct async_stream *s = async_stream(rqstp->rq_xprt);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    int synced = target_sync() == 0;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    atomic_fetch_add_explicit(&g_barrier_sync_ns, ns_diff(t0, t1), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_barriers, 1, memory_order_relaxed);
+
+    out->result = 0;
+    out->batches = s ? s->batches : 0;
+    out->failed_seq = 0;
+    if (!s || !synced) {
+        out->result = -1;
+        out->failed_seq = ~0ull;
+    }
+    if (s && s->failed) {
+        out->result = -1;
+        out->failed_seq = s->failed_seq;
+    }
+    if (s) {
+        s->batches = 0;
+        s->failed = 0;
+    }
+    return TRUE;
+}
+
+bool_t write_logical_batch_2_svc(logical_batch2_params *params, int *result,
+                                 struct svc_req *rqstp) {
+    logical_batch_params p1;
+    p1.handle = params->handle;
+    p1.srcs.srcs_len = params->srcs.srcs_len;
+    p1.srcs.srcs_val = params->srcs.srcs_val;
+    p1.dsts.dsts_len = params->dsts.dsts_len;
+    p1.dsts.dsts_val = params->dsts.dsts_val;
+    p1.block_size = params->block_size;
+    return write_logical_batch_1_svc(&p1, result, rqstp);
+}
+
+bool_t write_pba_2_svc(pba_write_params *params, int *result, struct svc_req *rqstp) {
+    return write_pba_1_svc(params, result, rqstp);
+}
+
+bool_t register_extents_2_svc(extent_upload *params, u_int *result, struct svc_req *rqstp) {
+    return register_extents_1_svc(params, result, rqstp);
+}
+
+bool_t unregister_extents_2_svc(u_int *handle, int *result, struct svc_req *rqstp) {
+    return unregister_extents_1_svc(handle, result, rqstp);
+}
+
+bool_t get_time_2_svc(void *argp, get_server_ios *out, struct svc_req *rqstp) {
+    return get_time_1_svc(argp, out, rqstp);
+}
+
+bool_t reset_time_2_svc(void *argp, void *result, struct svc_req *rqstp) {
+    return reset_time_1_svc(argp, result, rqstp);
+}
+
+bool_t get_stats_2_svc(void *argp, stat_list *out, struct svc_req *rqstp) {
+    return get_stats_1_svc(argp, out, rqstp);
+}
+
+int blockcopy_prog_1_freeresult(SVCXPRT *transp, xdrproc_t xdr_result, caddr_t result) {
+    xdr_free(xdr_result, result);
+    return 1;
+}
+
+int blockcopy_prog_2_freeresult(SVCXPRT *transp, xdrproc_t xdr_result, caddr_t result) {
+    xdr_free(xdr_result, result);
+    return 1;
+}
+
+/* Dispatchers generated by rpcgen -m (blockcopy_random_svc.c) */
+extern void blockcopy_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
+extern void blockcopy_prog_2(struct svc_req *rqstp, SVCXPRT *transp);
+
+/* Register both versions over UDP and TCP on ports the portmapper hands out */
+static SVCXPRT *serve_portmapper(void) {
+    pmap_unset(BLOCKCOPY_PROG, BLOCKCOPY_VERS);
+    pmap_unset(BLOCKCOPY_PROG, BLOCKCOPY_VERS2);
+
+    SVCXPRT *udp = svcudp_create(RPC_ANYSOCK);
+    if (udp == NULL) {
+        fprintf(stderr, "cannot create udp service.\n");
+        exit(1);
+    }
+    if (!svc_register(udp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, IPPROTO_UDP)) {
+        fprintf(stderr, "unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS, udp).\n");
+        exit(1);
+    }
+    if (!svc_register(udp, BLOCKCOPY_PROG, BLOCKCOPY_VERS2, blockcopy_prog_2, IPPROTO_UDP)) {
+        fprintf(stderr, "unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS2, udp).\n");
+        exit(1);
+    }
+
+    SVCXPRT *tcp = svctcp_create(RPC_ANYSOCK, 0, 0);
+    if (tcp == NULL) {
+        fprintf(stderr, "cannot create tcp service.\n");
+        exit(1);
+    }
+    if (!svc_register(tcp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, IPPROTO_TCP)) {
+        fprintf(stderr, "unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS, tcp).\n");
+        exit(1);
+    }
+    if (!svc_register(tcp, BLOCKCOPY_PROG, BLOCKCOPY_VERS2, blockcopy_prog_2, IPPROTO_TCP)) {
+        fprintf(stderr, "unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS2, tcp).\n");
+        exit(1);
+    }
+    return tcp;
+}
+
+/*
+ * -r: listen on a fixed TCP port and register with protocol 0, so the
+ * portmapper is never contacted and clients skip the lookup as well.
+ */
+static SVCXPRT *serve_fixed_port(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (sock < 0 || setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 64) != 0) {
+        perror("rpc listen");
+        exit(1);
+    }
+
+    SVCXPRT *tcp = svctcp_create(sock, 0, 0);
+    if (tcp == NULL) {
+        fprintf(stderr, "cannot create tcp service.\n");
+        exit(1);
+    }
+    if (!svc_register(tcp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, 0) ||
+        !svc_register(tcp, BLOCKCOPY_PROG, BLOCKCOPY_VERS2, blockcopy_prog_2, 0)) {
+        fprintf(stderr, "unable to register BLOCKCOPY_PROG on port %d.\n", port);
+        exit(1);
+    }
+    fprintf(stdout, "rpc on tcp port %d\n", port);
+    fflush(stdout);
+    return tcp;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "Options:\n"
+        "  -d path            Copy target: block device, image file or directory of images;\n"
+        "                     repeat to concatenate several (default: %s)\n"
+        "  -S bytes           Stripe the PBA space across the -d targets in units of this size\n"
+        "                     (default: 0 = concatenate)\n"
+        "  -t threads         Worker threads serving connections (default: 0 = single-threaded svc_run)\n"
+        "  -p buffers         Buffers in the I/O buffer pool (default: %d)\n"
+        "  -m bytes           Largest block size served from the pool (default: %d)\n"
+        "  -L                 mlock the buffer pool\n"
+        "  -c bytes           Merge adjacent copies into I/Os of up to this size\n"
+        "                     (default: pool block size, 0 = no merging)\n"
+        "  -o order           Issue order of independent copies: fifo or sorted\n"
+        "                     (elevator by device offset; default: fifo)\n"
+        "  -w runs            With -o sorted, only reorder among the oldest N pending runs\n"
+        "                     (default: 0 = whole batch)\n"
+        "  -C MiB             Cache hot source blocks in up to this much memory (default: off)\n"
+        "  -x                 Copy-offload engine for image targets (reflink, copy_file_range)\n"
+        "  -V                 Verify every batch against a serial replay (slow)\n"
+        "  -r port            Serve RPC on this fixed TCP port and leave the portmapper out;\n"
+        "                     clients then connect to host:port\n"
+        "  -N port            Also serve the native binary transport on this TCP port\n"
+        "  -U path            Also serve same-host clients over shared-memory rings,\n"
+        "                     attached through this Unix socket\n"
+        "  -Y usec            With -U, poll an idle ring this long before sleeping (default: 0)\n",
+        prog, DEVICE_PATH, BUF_POOL_DEFAULT_COUNT, BUF_POOL_DEFAULT_SIZE);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 0;
+    long pool_count = BUF_POOL_DEFAULT_COUNT;
+    long pool_size = BUF_POOL_DEFAULT_SIZE;
+    int pool_lock = 0;
+    long coalesce = -1;
+    int ntargets = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:S:t:p:m:Lc:o:w:C:xVr:N:U:Y:")) != -1) {
+        switch (opt) {
+        case 'd':
+            if (target_add(optarg) != 0) return 1;
+            ntargets++;
+            break;
+        case 'S': {
+            long long unit = strtoll(optarg, NULL, 10);
+            if (unit < 0) {
+                fprintf(stderr, "Stripe unit must not be negative.\n");
+                return 1;
+            }
+            target_set_stripe((uint64_t)unit);
+            break;
+        }
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 0) {
+                fprintf(stderr, "Thread count must not be negative.\n");
+                return 1;
+            }
+            break;
+        case 'p':
+            pool_count = strtol(optarg, NULL, 10);
+            if (pool_count < 0) {
+                fprintf(stderr, "Pool size must not be negative.\n");
+                return 1;
+            }
+            break;
+        case 'm':
+            pool_size = strtol(optarg, NULL, 10);
+            if (pool_size <= 0) {
+                fprintf(stderr, "Pool block size must be positive.\n");
+                return 1;
+            }
+            break;
+        case 'L':
+            pool_lock = 1;
+            break;
+        case 'c':
+            coalesce = strtol(optarg, NULL, 10);
+            if (coalesce < 0) {
+                fprintf(stderr, "Merge size must not be negative.\n");
+                return 1;
+            }
+            break;
+        case 'o':
+            if (strcmp(optarg, "fifo") == 0) {
+                g_sched_policy = ORDER_FIFO;
+            } else if (strcmp(optarg, "sorted") == 0) {
+                g_sched_policy = ORDER_SORTED;
+            } else {
+                fprintf(stderr, "Order must be fifo or sorted.\n");
+                return 1;
+            }
+            break;
+        case 'w': {
+            long w = strtol(optarg, NULL, 10);
+            if (w < 0) {
+                fprintf(stderr, "Window must not be negative.\n");
+                return 1;
+            }
+            g_sched_window = (uint32_t)w;
+            break;
+        }
+        case 'C': {
+            long mib = strtol(optarg, NULL, 10);
+            if (mib < 0) {
+                fprintf(stderr, "Cache size must not be negative.\n");
+                return 1;
+            }
+            cache_bytes = (size_t)mib << 20;
+            break;
+        }
+        case 'x':
+            g_offload = 1;
+            break;
+        case 'V':
+            g_verify = 1;
+            break;
+        case 'r':
+            g_rpc_port = atoi(optarg);
+            if (g_rpc_port <= 0 || g_rpc_port > 65535) {
+                fprintf(stderr, "Port must be between 1 and 65535.\n");
+                return 1;
+            }
+            break;
+        case 'N':
+            g_native_port = atoi(optarg);
+            if (g_native_port <= 0 || g_native_port > 65535) {
+                fprintf(stderr, "Port must be between 1 and 65535.\n");
+                return 1;
+            }
+            break;
+        case 'U':
+            g_shm_path = optarg;
+            break;
+        case 'Y':
+            g_shm_spin_us = strtol(optarg, NULL, 10);
+            if (g_shm_spin_us < 0) {
+                fprintf(stderr, "Spin time must not be negative.\n");
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (ntargets == 0 && target_add(DEVICE_PATH) != 0) return 1;
+    if (target_open() != 0) {
+        fprintf(stderr, "cannot open copy target.\n");
+        exit(1);
+    }
+    if (target_ndevs() > 1 && devq_start() != 0) {
+        fprintf(stderr, "cannot start device workers.\n");
+        exit(1);
+    }
+    if (g_offload) {
+        int nfiles = offload_init();
+        fprintf(stdout, "copy offload: %d of %d target devices are files\n", nfiles, target_ndevs());
+        fflush(stdout);
+    }
+
+    if (buf_pool_init(pool_count, pool_size, pool_lock) != 0) {
+        fprintf(stderr, "cannot set up buffer pool.\n");
+        exit(1);
+    }
+
+    if (block_cache_init(cache_bytes) != 0) {
+        fprintf(stderr, "cannot set up block cache.\n");
+        exit(1);
+    }
+
+    g_coalesce_bytes = (uint32_t)(coalesce >= 0 ? coalesce : pool_size);
+
+    if (g_native_port) {
+        if (native_start((uint16_t)g_native_port, threads, run_batch) != 0) {
+            fprintf(stderr, "cannot start native transport.\n");
+            exit(1);
+        }
+        fprintf(stdout, "native transport on port %d\n", g_native_port);
+        fflush(stdout);
+    }
+
+    if (g_shm_path) {
+        if (shm_start(g_shm_path, threads, g_shm_spin_us, run_batch) != 0) {
+            fprintf(stderr, "cannot start shared-memory transport.\n");
+            exit(1);
+        }
+        fprintf(stdout, "shared-memory transport on %s\n", g_shm_path);
+        fflush(stdout);
+    }
+
+    SVCXPRT *tcp = g_rpc_port ? serve_fixed_port(g_rpc_port) : serve_portmapper();
+
+    if (threads > 0) {
+        fprintf(stdout, "serving with %d worker threads\n", threads);
+        fflush(stdout);
+        svc_pool_run(threads, tcp);
+    } else {
+        svc_run();
+    }
+    fprintf(stderr, "svc_run returned\n");
+    exit(1);
+    /* NOTREACHED */
+}
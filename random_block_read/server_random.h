@@ -2,6 +2,7 @@
 #define SERVER_RANDOM_H
 
 #define ALIGN 4096
-#define DEVICE_PATH "/dev/nvme0n1"
+#define DEVICE_PATH "/dev/nvme0n1"   /* copy target when no -d is given */
+#define MAX_SHARDS 64   /* per-thread timing shards */
 
 #endif
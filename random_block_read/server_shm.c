@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+#include "server_shm.h"
+#include "native_proto.h"
+#include "shm_ring.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_RINGS_PER_WORKER 16
+#define SHM_ATTACH_TIMEOUT_SEC 1
+
+/* One attached client: its socket, the mapping and the two eventfds */
+struct shm_conn {
+    int sock;
+    int sq_efd;             /* client -> server doorbell */
+    int cq_efd;             /* server -> client doorbell */
+    void *base;
+    size_t size;
+    uint32_t entries;       /* validated copies of the header fields */
+    uint32_t slot_bytes;
+    uint32_t sq_head;       /* the server's ring indexes */
+    uint32_t cq_tail;
+    struct shm_conn *next;  /* on a worker's inbox until it adopts the ring */
+};
+
+/*
+ * A ring worker: serves up to SHM_RINGS_PER_WORKER rings, one submission
+ * per ring per pass. New rings arrive on the inbox with a wake on wake_efd.
+ */
+struct shm_worker {
+    pthread_mutex_t lock;
+    struct shm_conn *inbox;
+    int nrings;             /* adopted or in the inbox; under lock */
+    int wake_efd;
+    struct shm_conn *rings[SHM_RINGS_PER_WORKER];
+    int n;                  /* rings adopted; only the worker touches rings/n */
+    uint8_t *body;          /* private copy of the submission being run */
+};
+
+static native_batch_fn g_run;
+static uint64_t g_spin_ns;
+static int g_listen = -1;
+static struct shm_worker *g_workers;
+static int g_nworkers;
+
+static _Atomic uint64_t g_rings, g_batches, g_bad_entries, g_wakeups;
+
+static inline uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+static void conn_free(struct shm_conn *c) {
+    if (c->base) munmap(c->base, c->size);
+    if (c->sq_efd >= 0) close(c->sq_efd);
+    if (c->cq_efd >= 0) close(c->cq_efd);
+    close(c->sock);
+    free(c);
+}
+
+/*
+ * Run one submission and post the completion. The body is copied out of
+ * the slot first: the client can still write the slot, and nothing it
+ * writes after the checks may reach the copy engine.
+ */
+static void ring_run(struct shm_worker *w, struct shm_conn *c, const struct shm_sqe *e,
+                     struct shm_cqe *cqe) {
+    int result = -1;
+    int64_t *srcs, *dsts;
+    uint32_t *lens, count, block_size;
+    if (e->slot < c->entries && e->len <= c->slot_bytes) {
+        memcpy(w->body, shm_slot(c->base, c->entries, c->slot_bytes, e->slot), e->len);
+        if (native_copy_decode(w->body, e->len, (uint16_t)e->flags, &srcs, &dsts, &lens,
+                               &count, &block_size) == 0) {
+            g_run(srcs, dsts, lens, count, block_size, &result);
+            atomic_fetch_add_explicit(&g_batches, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&g_bad_entries, 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_fetch_add_explicit(&g_bad_entries, 1, memory_order_relaxed);
+    }
+    cqe->id = e->id;
+    cqe->slot = e->slot;
+    cqe->result = result;
+}
+
+static inline int ring_pending(struct shm_conn *c) {
+    struct shm_ring_hdr *h = c->base;
+    return atomic_load_explicit(&h->sq_tail, memory_order_acquire) != c->sq_head;
+}
+
+/* Run the oldest submission on c, if any; 1 if one ran */
+static int ring_step(struct shm_worker *w, struct shm_conn *c) {
+    if (!ring_pending(c)) return 0;
+    struct shm_ring_hdr *h = c->base;
+    uint32_t mask = c->entries - 1;
+    struct shm_sqe e = shm_sq(c->base)[c->sq_head & mask];
+    ring_run(w, c, &e, &shm_cq(c->base, c->entries)[c->cq_tail & mask]);
+    c->sq_head++;
+    c->cq_tail++;
+    atomic_store_explicit(&h->sq_head, c->sq_head, memory_order_release);
+    atomic_store_explicit(&h->cq_tail, c->cq_tail, memory_order_release);
+
+    /* pairs with the fence the client runs after raising client_sleeping */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&h->client_sleeping, memory_order_relaxed)) {
+        uint64_t one = 1;
+        if (write(c->cq_efd, &one, sizeof(one)) == sizeof(one))
+            atomic_fetch_add_explicit(&g_wakeups, 1, memory_order_relaxed);
+    }
+    return 1;
+}
+
+static void worker_adopt(struct shm_worker *w) {
+    pthread_mutex_lock(&w->lock);
+    while (w->inbox) {
+        struct shm_conn *c = w->inbox;
+        w->inbox = c->next;
+        struct shm_ring_hdr *h = c->base;
+        c->sq_head = atomic_load(&h->sq_head);
+        c->cq_tail = atomic_load(&h->cq_tail);
+        w->rings[w->n++] = c;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void worker_drop(struct shm_worker *w, int k) {
+    conn_free(w->rings[k]);
+    w->rings[k] = w->rings[--w->n];
+    pthread_mutex_lock(&w->lock);
+    w->nrings--;
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Sleep until a ring has work, a ring's client leaves, or a ring arrives */
+static void worker_sleep(struct shm_worker *w) {
+    for (int k = 0; k < w->n; k++)
+        atomic_store(&((struct shm_ring_hdr *)w->rings[k]->base)->server_sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int busy = 0;
+    for (int k = 0; k < w->n && !busy; k++) busy = ring_pending(w->rings[k]);
+    struct pollfd p[1 + 2 * SHM_RINGS_PER_WORKER];
+    int np = 0;
+    if (!busy) {
+        p[np++] = (struct pollfd){ w->wake_efd, POLLIN, 0 };
+        for (int k = 0; k < w->n; k++) {
+            p[np++] = (struct pollfd){ w->rings[k]->sq_efd, POLLIN, 0 };
+            p[np++] = (struct pollfd){ w->rings[k]->sock, POLLIN, 0 };
+        }
+        if (poll(p, np, -1) < 0) np = 0;
+    }
+
+    for (int k = 0; k < w->n; k++)
+        atomic_store(&((struct shm_ring_hdr *)w->rings[k]->base)->server_sleeping, 0);
+    uint64_t v;
+    if (np > 0 && (p[0].revents & POLLIN) && read(w->wake_efd, &v, sizeof(v)) < 0)
+        perror("shm wake");
+    /* back to front: dropping ring k moves the last ring, already handled, into k */
+    for (int k = w->n - 1; np > 0 && k >= 0; k--) {
+        if ((p[1 + 2 * k].revents & POLLIN) && read(w->rings[k]->sq_efd, &v, sizeof(v)) < 0 &&
+            errno != EAGAIN)
+            p[2 + 2 * k].revents |= POLLERR;
+        /* the client never writes the socket after attaching: this is its exit */
+        if (p[2 + 2 * k].revents) worker_drop(w, k);
+    }
+}
+
+static void *ring_worker(void *arg) {
+    struct shm_worker *w = arg;
+    for (;;) {
+        worker_adopt(w);
+        int ran = 0;
+        for (int k = 0; k < w->n; k++) ran += ring_step(w, w->rings[k]);
+        if (ran) continue;
+
+        /* -Y: spin a while before paying for a sleep and a wakeup */
+        if (g_spin_ns && w->n > 0) {
+            uint64_t deadline = now_ns() + g_spin_ns;
+            int busy = 0;
+            while (!busy && now_ns() < deadline) {
+                for (int k = 0; k < w->n && !busy; k++) busy = ring_pending(w->rings[k]);
+                if (!busy) shm_cpu_relax();
+            }
+            if (busy) continue;
+        }
+        worker_sleep(w);
+    }
+    return NULL;
+}
+
+/* The worker with the fewest rings takes c; -1 when every worker is full */
+static int assign_ring(struct shm_conn *c) {
+    struct shm_worker *best = NULL;
+    int best_n = SHM_RINGS_PER_WORKER;
+    for (int i = 0; i < g_nworkers; i++) {
+        struct shm_worker *w = &g_workers[i];
+        pthread_mutex_lock(&w->lock);
+        int n = w->nrings;
+        pthread_mutex_unlock(&w->lock);
+        if (n < best_n) {
+            best = w;
+            best_n = n;
+        }
+    }
+    if (!best) return -1;
+    pthread_mutex_lock(&best->lock);
+    int full = best->nrings >= SHM_RINGS_PER_WORKER;
+    if (!full) {
+        best->nrings++;
+        c->next = best->inbox;
+        best->inbox = c;
+    }
+    pthread_mutex_unlock(&best->lock);
+    if (full) return -1;
+    uint64_t one = 1;
+    if (write(best->wake_efd, &one, sizeof(one)) != sizeof(one)) perror("shm wake");
+    return 0;
+}
+
+/* The memfd and both eventfds, sent by the client with SCM_RIGHTS */
+static int recv_fds(int sock, int fds[3]) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) return -1;
+    size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cm), (n < 3 ? n : 3) * sizeof(int));
+    if (n == 3) return 0;
+    for (size_t i = 0; i < n && i < 3; i++) close(fds[i]);
+    return -1;
+}
+
+/* Map the client's memfd after checking its header against its size */
+static int conn_attach(struct shm_conn *c, int memfd) {
+    struct stat st;
+    if (fstat(memfd, &st) != 0 || (size_t)st.st_size < SHM_PAGE) return -1;
+    struct shm_ring_hdr hdr;
+    if (pread(memfd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) return -1;
+    if (hdr.magic != SHM_MAGIC || hdr.version != SHM_VERSION || hdr.entries == 0 ||
+        hdr.entries > SHM_MAX_ENTRIES || (hdr.entries & (hdr.entries - 1)) ||
+        hdr.slot_bytes == 0 || hdr.slot_bytes % SHM_PAGE ||
+        hdr.slot_bytes > NATIVE_MAX_BODY + SHM_PAGE ||
+        (size_t)st.st_size != shm_ring_size(hdr.entries, hdr.slot_bytes))
+        return -1;
+    c->entries = hdr.entries;
+    c->slot_bytes = hdr.slot_bytes;
+    c->size = st.st_size;
+    c->base = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (c->base == MAP_FAILED) {
+        c->base = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void *accept_thread(void *arg) {
+    /* a client that connects and sends nothing must not hold up the next */
+    struct timeval tv = { SHM_ATTACH_TIMEOUT_SEC, 0 };
+    for (;;) {
+        int sock = accept4(g_listen, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno != EINTR) perror("shm accept");
+            continue;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        struct shm_conn *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(sock);
+            continue;
+        }
+        c->sock = sock;
+        c->sq_efd = c->cq_efd = -1;
+
+        int fds[3];
+        char ok = 1;
+        if (recv_fds(sock, fds) == 0) {
+            c->sq_efd = fds[1];
+            c->cq_efd = fds[2];
+            ok = conn_attach(c, fds[0]) == 0;
+            close(fds[0]);
+        } else {
+            ok = 0;
+        }
+        /* status byte: 0 attached, 1 refused; the worker owns the ring after the send */
+        char status = ok ? 0 : 1;
+        if (send(sock, &status, 1, MSG_NOSIGNAL) != 1 || !ok || assign_ring(c) != 0) {
+            if (ok) fprintf(stderr, "shm: no worker free for another ring\n");
+            conn_free(c);
+            continue;
+        }
+        atomic_fetch_add_explicit(&g_rings, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+int shm_start(const char *path, int workers, long spin_us, native_batch_fn run) {
+    g_run = run;
+    g_spin_ns = spin_us > 0 ? (uint64_t)spin_us * 1000 : 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "shm: socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    g_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_listen < 0 || bind(g_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(g_listen, 16) != 0) {
+        perror("shm listen");
+        return -1;
+    }
+
+    g_nworkers = workers < 1 ? 1 : workers;
+    g_workers = calloc(g_nworkers, sizeof(*g_workers));
+    if (!g_workers) return -1;
+    for (int i = 0; i < g_nworkers; i++) {
+        struct shm_worker *w = &g_workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        w->wake_efd = eventfd(0, EFD_CLOEXEC);
+        w->body = malloc(NATIVE_MAX_BODY + SHM_PAGE);
+        if (w->wake_efd < 0 || !w->body) {
+            perror("shm worker");
+            return -1;
+        }
+    }
+
+    pthread_t tid;
+    int ret = pthread_create(&tid, NULL, accept_thread, NULL);
+    for (int i = 0; ret == 0 && i < g_nworkers; i++)
+        ret = pthread_create(&tid, NULL, ring_worker, &g_workers[i]);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void shm_get_stats(struct shm_stats *out) {
+    out->rings = atomic_load_explicit(&g_rings, memory_order_relaxed);
+    out->batches = atomic_load_explicit(&g_batches, memory_order_relaxed);
+    out->bad_entries = atomic_load_explicit(&g_bad_entries, memory_order_relaxed);
+    out->wakeups = atomic_load_explicit(&g_wakeups, memory_order_relaxed);
+}
+
+void shm_reset_stats(void) {
+    atomic_store_explicit(&g_batches, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_bad_entries, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_wakeups, 0, memory_order_relaxed);
+}
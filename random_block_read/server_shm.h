@@ -0,0 +1,28 @@
+#ifndef SERVER_SHM_H
+#define SERVER_SHM_H
+
+#include <stdint.h>
+#include "server_native.h"
+
+struct shm_stats {
+    uint64_t rings;         /* rings attached */
+    uint64_t batches;       /* submissions run */
+    uint64_t bad_entries;   /* submissions refused as malformed */
+    uint64_t wakeups;       /* completion eventfd writes to a sleeping client */
+};
+
+/*
+ * Serve the same-host ring transport (shm_ring.h) on the Unix socket
+ * `path`. A fixed pool of `workers` threads (at least one) shares the
+ * attached rings, up to 16 each; a worker takes one submission at a time
+ * off each of its rings, copies it out of the slot, runs it through `run`
+ * and posts the completion. With nothing to do it spins for spin_us
+ * microseconds before sleeping on its rings' eventfds. Returns 0 once the
+ * socket listens, or -1.
+ */
+int shm_start(const char *path, int workers, long spin_us, native_batch_fn run);
+
+void shm_get_stats(struct shm_stats *out);
+void shm_reset_stats(void);
+
+#endif
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+#include "server_target.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct target_dev devs[TARGET_MAX_DEVS];
+static int ndevs = 0;
+static int64_t total_size = 0;
+static uint64_t stripe_unit = 0;    /* 0: devices concatenated */
+
+struct dev_counters {
+    _Atomic uint64_t reads;
+    _Atomic uint64_t writes;
+    _Atomic uint64_t read_ns;
+    _Atomic uint64_t write_ns;
+} __attribute__((aligned(64)));
+
+static struct dev_counters counters[TARGET_MAX_DEVS];
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+static int add_one(const char *path) {
+    if (ndevs == TARGET_MAX_DEVS) {
+        fprintf(stderr, "target: more than %d devices\n", TARGET_MAX_DEVS);
+        return -1;
+    }
+    devs[ndevs].path = strdup(path);
+    devs[ndevs].fd = -1;
+    if (!devs[ndevs].path) return -1;
+    ndevs++;
+    return 0;
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int add_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return -1;
+    }
+
+    char *names[TARGET_MAX_DEVS];
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) continue;
+        if (n == TARGET_MAX_DEVS) {
+            fprintf(stderr, "target: more than %d images in %s\n", TARGET_MAX_DEVS, dir);
+            break;
+        }
+        names[n++] = strdup(path);
+    }
+    closedir(d);
+
+    if (n == 0) {
+        fprintf(stderr, "target: no images in %s\n", dir);
+        return -1;
+    }
+    qsort(names, n, sizeof(*names), cmp_name);
+
+    int rc = 0;
+    for (int i = 0; i < n; i++) {
+        if (rc == 0 && add_one(names[i]) != 0) rc = -1;
+        free(names[i]);
+    }
+    return rc;
+}
+
+int target_add(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) return add_dir(path);
+    return add_one(path);
+}
+
+/* Logical block size O_DIRECT I/O on fd must be aligned to */
+static uint32_t logical_block_size(int fd, const struct stat *st) {
+    if (S_ISBLK(st->st_mode)) {
+        int lbs = 0;
+        if (ioctl(fd, BLKSSZGET, &lbs) == 0 && lbs > 0) return (uint32_t)lbs;
+        return 512;
+    }
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align > 0)
+        return stx.stx_dio_offset_align;
+#endif
+    return 512;
+}
+
+static int open_one(struct target_dev *d) {
+    d->direct = 1;
+    d->fd = open(d->path, O_RDWR | O_DIRECT);
+    if (d->fd < 0 && errno == EINVAL) {
+        /* e.g. tmpfs images: fine for functional runs, not for timing */
+        d->direct = 0;
+        d->fd = open(d->path, O_RDWR);
+    }
+    if (d->fd < 0) {
+        perror(d->path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(d->fd, &st) != 0) {
+        perror(d->path);
+        return -1;
+    }
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t bytes = 0;
+        if (ioctl(d->fd, BLKGETSIZE64, &bytes) != 0) {
+            perror("BLKGETSIZE64");
+            return -1;
+        }
+        d->size = (int64_t)bytes;
+    } else if (S_ISREG(st.st_mode)) {
+        d->size = st.st_size;
+    } else {
+        fprintf(stderr, "target: %s is neither a block device nor a regular file\n", d->path);
+        return -1;
+    }
+    d->lbs = d->direct ? logical_block_size(d->fd, &st) : 1;
+
+    if (d->size <= 0) {
+        fprintf(stderr, "target: %s is empty\n", d->path);
+        return -1;
+    }
+    return 0;
+}
+
+void target_set_stripe(uint64_t bytes) {
+    stripe_unit = bytes;
+}
+
+int target_open(void) {
+    if (ndevs == 0) {
+        fprintf(stderr, "target: nothing to open\n");
+        return -1;
+    }
+
+    for (int i = 0; i < ndevs; i++)
+        if (open_one(&devs[i]) != 0) return -1;
+
+    total_size = 0;
+    if (stripe_unit > 0) {
+        /* every device contributes the same number of whole units */
+        int64_t min = devs[0].size;
+        for (int i = 0; i < ndevs; i++) {
+            if (stripe_unit % devs[i].lbs != 0) {
+                fprintf(stderr, "target: stripe unit %llu is not a multiple of %s's block size %u\n",
+                        (unsigned long long)stripe_unit, devs[i].path, devs[i].lbs);
+                return -1;
+            }
+            if (devs[i].size < min) min = devs[i].size;
+        }
+        int64_t used = min / (int64_t)stripe_unit * (int64_t)stripe_unit;
+        if (used == 0) {
+            fprintf(stderr, "target: stripe unit %llu is larger than a device\n",
+                    (unsigned long long)stripe_unit);
+            return -1;
+        }
+        for (int i = 0; i < ndevs; i++) {
+            devs[i].start = 0;
+            devs[i].size = used;
+        }
+        total_size = used * ndevs;
+    } else {
+        for (int i = 0; i < ndevs; i++) {
+            devs[i].start = total_size;
+            total_size += devs[i].size;
+        }
+    }
+
+    for (int i = 0; i < ndevs; i++)
+        fprintf(stdout, "target %d: %s, %lld bytes, block %u%s\n", i, devs[i].path,
+                (long long)devs[i].size, devs[i].lbs, devs[i].direct ? "" : " (buffered)");
+    if (stripe_unit > 0)
+        fprintf(stdout, "target: %lld bytes striped over %d devices in %llu-byte units\n",
+                (long long)total_size, ndevs, (unsigned long long)stripe_unit);
+    else
+        fprintf(stdout, "target: %lld bytes on %d device(s)\n", (long long)total_size, ndevs);
+    fflush(stdout);
+    return 0;
+}
+
+int target_ndevs(void) {
+    return ndevs;
+}
+
+const struct target_dev *target_dev(int i) {
+    return &devs[i];
+}
+
+int64_t target_size(void) {
+    return total_size;
+}
+
+int target_map(int64_t off, int64_t *dev_off, uint64_t *contig) {
+    if (off < 0 || off >= total_size) return -1;
+
+    int i;
+    if (stripe_unit > 0) {
+        uint64_t unit = (uint64_t)off / stripe_unit;
+        uint64_t within = (uint64_t)off % stripe_unit;
+        i = (int)(unit % (uint64_t)ndevs);
+        *dev_off = (int64_t)((unit / (uint64_t)ndevs) * stripe_unit + within);
+        if (contig) *contig = stripe_unit - within;
+        return i;
+    }
+
+    i = 0;
+    if (ndevs > 1) {
+        int lo = 0, hi = ndevs;
+        while (hi - lo > 1) {
+            int mid = (lo + hi) / 2;
+            if (devs[mid].start <= off) lo = mid;
+            else hi = mid;
+        }
+        i = lo;
+    }
+    *dev_off = off - devs[i].start;
+    if (contig) *contig = (uint64_t)(devs[i].size - *dev_off);
+    return i;
+}
+
+int target_contiguous(int64_t off, uint64_t len) {
+    int64_t rel;
+    uint64_t contig;
+    return target_map(off, &rel, &contig) >= 0 && contig >= len;
+}
+
+int target_check(int64_t off, uint64_t len) {
+    if (off < 0 || off >= total_size || len == 0 || len > (uint64_t)(total_size - off))
+        return -1;
+    while (len > 0) {
+        int64_t rel;
+        uint64_t contig;
+        int i = target_map(off, &rel, &contig);
+        uint64_t n = len < contig ? len : contig;
+        if (rel % devs[i].lbs != 0 || n % devs[i].lbs != 0) return -1;
+        off += (int64_t)n;
+        len -= n;
+    }
+    return 0;
+}
+
+static ssize_t target_io(void *buf, size_t len, int64_t off, int is_write) {
+    size_t done = 0;
+    while (done < len) {
+        int64_t rel;
+        uint64_t contig;
+        int i = target_map(off + (int64_t)done, &rel, &contig);
+        if (i < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        size_t n = len - done;
+        if (n > contig) n = (size_t)contig;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+        ssize_t r = is_write ? pwrite(devs[i].fd, (char *)buf + done, n, rel)
+                             : pread(devs[i].fd, (char *)buf + done, n, rel);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        target_account(i, is_write, ns_diff(t0, t1));
+        if (r < 0) return -1;
+        done += (size_t)r;
+        if ((size_t)r < n) break;
+    }
+    return (ssize_t)done;
+}
+
+ssize_t target_pread(void *buf, size_t len, int64_t off) {
+    return target_io(buf, len, off, 0);
+}
+
+ssize_t target_pwrite(const void *buf, size_t len, int64_t off) {
+    return target_io((void *)buf, len, off, 1);
+}
+
+int target_sync(void) {
+    int rc = 0;
+    for (int i = 0; i < ndevs; i++) {
+        if (fdatasync(devs[i].fd) != 0) {
+            fprintf(stderr, "fdatasync %s: %s\n", devs[i].path, strerror(errno));
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+void target_account(int dev, int is_write, uint64_t ns) {
+    struct dev_counters *c = &counters[dev];
+    if (is_write) {
+        atomic_fetch_add_explicit(&c->writes, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->write_ns, ns, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&c->reads, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->read_ns, ns, memory_order_relaxed);
+    }
+}
+
+void target_get_stats(int dev, struct target_dev_stats *out) {
+    const struct dev_counters *c = &counters[dev];
+    out->reads = atomic_load_explicit(&c->reads, memory_order_relaxed);
+    out->writes = atomic_load_explicit(&c->writes, memory_order_relaxed);
+    out->read_ns = atomic_load_explicit(&c->read_ns, memory_order_relaxed);
+    out->write_ns = atomic_load_explicit(&c->write_ns, memory_order_relaxed);
+}
+
+void target_reset_stats(void) {
+    for (int i = 0; i < TARGET_MAX_DEVS; i++) {
+        atomic_store_explicit(&counters[i].reads, 0, memory_order_relaxed);
+        atomic_store_explicit(&counters[i].writes, 0, memory_order_relaxed);
+        atomic_store_explicit(&counters[i].read_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&counters[i].write_ns, 0, memory_order_relaxed);
+    }
+}
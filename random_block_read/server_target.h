@@ -0,0 +1,76 @@
+#ifndef SERVER_TARGET_H
+#define SERVER_TARGET_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TARGET_MAX_DEVS 64
+
+/*
+ * The copy target: one or more block devices or image files forming one
+ * PBA space. By default they are laid end to end in the order given, so
+ * PBA p is byte p - start of the device holding it. With a stripe unit
+ * (-S), PBAs are dealt out round robin in units of that many bytes.
+ * Everything is opened once, at startup.
+ */
+struct target_dev {
+    char *path;
+    int fd;
+    int64_t start;      /* first target PBA on this device (concatenated only) */
+    int64_t size;       /* bytes used: the device, or a whole number of stripe units */
+    uint32_t lbs;       /* logical block size: O_DIRECT alignment */
+    int direct;         /* opened with O_DIRECT */
+};
+
+/* Per-device I/O counters; ns is summed issue-to-completion time */
+struct target_dev_stats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_ns;
+    uint64_t write_ns;
+};
+
+/* Queue a block device, an image file, or a directory of images (sorted by name) */
+int target_add(const char *path);
+
+/* Stripe across the devices in units of `bytes` (0: concatenate); call before target_open */
+void target_set_stripe(uint64_t bytes);
+
+/* Open everything queued, read sizes and block sizes; prints one line per device */
+int target_open(void);
+
+int target_ndevs(void);
+const struct target_dev *target_dev(int i);
+int64_t target_size(void);
+
+/*
+ * Device holding target offset off, or -1 past the end. *dev_off is set to
+ * the offset on that device and, if contig is not NULL, *contig to the bytes
+ * that follow contiguously on it.
+ */
+int target_map(int64_t off, int64_t *dev_off, uint64_t *contig);
+
+/* 1 if [off, off + len) maps to one contiguous range of one device */
+int target_contiguous(int64_t off, uint64_t len);
+
+/*
+ * 0 if [off, off + len) lies inside the target and each of its device
+ * pieces is aligned to that device's logical block size, otherwise -1
+ * (nothing may be issued for it). A range crossing devices or stripe
+ * units is fine: batch_plan cuts it into one I/O per piece.
+ */
+int target_check(int64_t off, uint64_t len);
+
+/* pread/pwrite at a target offset; ranges may span devices */
+ssize_t target_pread(void *buf, size_t len, int64_t off);
+ssize_t target_pwrite(const void *buf, size_t len, int64_t off);
+
+/* Flush every device's written data to stable storage; 0, or -1 if one failed */
+int target_sync(void);
+
+/* Charge one I/O to device dev (target_pread/pwrite do this themselves) */
+void target_account(int dev, int is_write, uint64_t ns);
+void target_get_stats(int dev, struct target_dev_stats *out);
+void target_reset_stats(void);
+
+#endif
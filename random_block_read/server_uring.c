@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include "server_uring.h"
+#include "block_cache.h"
+#include "server_random.h"
+#include "server_target.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+
+/*
+ * Every planned group is queued as one chain of READ_FIXED SQEs followed
+ * by WRITE_FIXED SQEs on the same registered buffer, all linked with
+ * IOSQE_IO_LINK, so the kernel starts the writes as soon as the reads
+ * land. Up to URING_QD groups run at once.
+ *
+ * Groups are issued in dependency order (plan_deps): a group becomes ready
+ * once every earlier group it overlaps has completed, so independent
+ * groups overtake a blocked one and the bytes still match serial order.
+ * Among the ready groups, batch_sched picks the next one by policy.
+ *
+ * Every target device is registered as a fixed file, indexed like
+ * target_dev(), so an I/O goes to its device at offset off - start.
+ * batch_plan never merges I/Os across devices.
+ *
+ * user_data = io << 1 | is_write   (io indexes plan->ios)
+ */
+#define TAG(io, is_write) (((uint64_t)(io) << 1) | (is_write))
+#define TAG_IO(tag) ((uint32_t)((tag) >> 1))
+#define TAG_IS_WRITE(tag) ((int)((tag) & 1))
+
+#define RING_ENTRIES (2 * URING_QD)
+
+static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
+    return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull + (uint64_t)(b.tv_nsec - a.tv_nsec);
+}
+
+struct uring_slot {
+    const struct plan_group *g;
+    uint32_t pending;       /* CQEs still to come; slot is busy while > 0 */
+    struct timespec mark;   /* submission, then the last completion: links run one at a time */
+};
+
+/* One ring per thread, so server workers never share submission queues */
+static __thread struct io_uring ring;
+static __thread int ring_state = 0;          /* 0: not tried, 1: ready, -1: unusable */
+static __thread int ring_files = 0;          /* target devices registered as fixed files */
+static __thread struct iovec ring_bufs[URING_QD];
+static __thread size_t ring_buf_size = 0;
+
+static void free_bufs(void) {
+    for (int i = 0; i < URING_QD; i++) {
+        free(ring_bufs[i].iov_base);
+        ring_bufs[i].iov_base = NULL;
+        ring_bufs[i].iov_len = 0;
+    }
+    ring_buf_size = 0;
+}
+
+/* (Re)register URING_QD buffers of at least buf_size bytes */
+static int setup_bufs(size_t buf_size) {
+    if (ring_buf_size >= buf_size) return 0;
+
+    if (ring_buf_size > 0) io_uring_unregister_buffers(&ring);
+    free_bufs();
+
+    for (int i = 0; i < URING_QD; i++) {
+        if (posix_memalign(&ring_bufs[i].iov_base, ALIGN, buf_size) != 0) {
+            perror("posix_memalign");
+            free_bufs();
+            return -1;
+        }
+        ring_bufs[i].iov_len = buf_size;
+    }
+
+    int ret = io_uring_register_buffers(&ring, ring_bufs, URING_QD);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_register_buffers: %s\n", strerror(-ret));
+        free_bufs();
+        return -1;
+    }
+    ring_buf_size = buf_size;
+    return 0;
+}
+
+static int setup_ring(size_t buf_size) {
+    if (ring_state == -1) return -1;
+
+    if (ring_state == 0) {
+        int ret = io_uring_queue_init(RING_ENTRIES, &ring, 0);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_queue_init: %s, using pread/pwrite\n", strerror(-ret));
+            ring_state = -1;
+            return -1;
+        }
+        ring_state = 1;
+    }
+
+    /* the target is opened once at startup, so this runs once per thread */
+    if (!ring_files) {
+        int fds[TARGET_MAX_DEVS];
+        int n = target_ndevs();
+        for (int i = 0; i < n; i++) fds[i] = target_dev(i)->fd;
+        int ret = io_uring_register_files(&ring, fds, n);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_register_files: %s, using pread/pwrite\n",
+                    strerror(-ret));
+            io_uring_queue_exit(&ring);
+            ring_state = -1;
+            return -1;
+        }
+        ring_files = 1;
+    }
+
+    return setup_bufs(buf_size);
+}
+
+/* plan->ios index -> slot (buffer owner) and block cache fill token */
+static __thread uint16_t *io_slot = NULL;
+static __thread uint64_t *io_token = NULL;
+static __thread uint32_t io_cap = 0;
+
+/*
+ * Give up on the ring with I/Os of busy slots still in flight: their cache
+ * pages are released unfilled or dropped, and the thread falls back for
+ * good. The buffers stay allocated, as the kernel may still be using them.
+ */
+static void abandon_ring(const struct batch_plan *plan, const struct uring_slot *slots) {
+    for (int s = 0; s < URING_QD; s++) {
+        const struct plan_group *g = slots[s].g;
+        if (!g || slots[s].pending == 0) continue;
+        for (uint32_t k = 0; k < g->nreads; k++) {
+            const struct plan_io *io = &plan->ios[g->read_first + k];
+            block_cache_fill_end(io->off, io->len, NULL, 0, io_token[g->read_first + k]);
+        }
+        for (uint32_t k = 0; k < g->nwrites; k++) {
+            const struct plan_io *io = &plan->ios[g->write_first + k];
+            block_cache_write(io->off, io->len, NULL, 0);
+        }
+    }
+    fprintf(stderr, "uring: ring abandoned, using pread/pwrite\n");
+    io_uring_queue_exit(&ring);
+    ring_state = -1;
+}
+
+static uint32_t max_group_bytes(const struct batch_plan *plan) {
+    uint32_t max = 0;
+    for (uint32_t i = 0; i < plan->ngroups; i++)
+        if (plan->groups[i].bytes > max) max = plan->groups[i].bytes;
+    return max;
+}
+
+static uint32_t max_group_ios(const struct batch_plan *plan) {
+    uint32_t max = 0;
+    for (uint32_t i = 0; i < plan->ngroups; i++)
+        if (plan->groups[i].nreads + plan->groups[i].nwrites > max)
+            max = plan->groups[i].nreads + plan->groups[i].nwrites;
+    return max;
+}
+
+int uring_copy_batch(struct batch_sched *sched,
+                     uint64_t *read_ns, uint64_t *write_ns) {
+    const struct batch_plan *plan = sched->plan;
+    /* a copy cut into more pieces than the ring holds goes to the other engines */
+    if (max_group_ios(plan) > RING_ENTRIES) return -ENOSYS;
+    if (setup_ring(max_group_bytes(plan)) != 0) return -ENOSYS;
+
+    struct uring_slot slots[URING_QD];
+    int free_slots[URING_QD];
+    int nfree = URING_QD;
+    for (int i = 0; i < URING_QD; i++) {
+        slots[i].g = NULL;
+        slots[i].pending = 0;
+        free_slots[i] = URING_QD - 1 - i;
+    }
+
+    if (io_cap < plan->nios) {
+        uint16_t *p = realloc(io_slot, plan->nios * sizeof(*p));
+        if (p) io_slot = p;
+        uint64_t *t = realloc(io_token, plan->nios * sizeof(*t));
+        if (t) io_token = t;
+        if (!p || !t) return -ENOSYS;
+        io_cap = plan->nios;
+    }
+
+    uint32_t done = 0;
+    int inflight = 0;
+    int result = 0;
+    int wait_failed = 0;
+
+    while (done < plan->ngroups) {
+        /* --- SUBMIT: queue ready groups while slots and SQ space last --- */
+        unsigned queued = 0;
+        struct timespec t_submit;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_submit);
+        int64_t next;
+        while (result == 0 && nfree > 0 && (next = batch_sched_peek(sched)) >= 0) {
+            const struct plan_group *g = &plan->groups[next];
+            unsigned nsqe = g->nreads + g->nwrites;
+            if (queued + nsqe > RING_ENTRIES) {
+                if (queued == 0) {
+                    fprintf(stderr, "uring: group of %u I/Os exceeds the ring\n", nsqe);
+                    result = -1;    /* reap what is in flight, then fail */
+                }
+                break;
+            }
+            batch_sched_issue(sched, (uint32_t)next);
+
+            int s = free_slots[--nfree];
+            char *buf = ring_bufs[s].iov_base;
+
+            /* reads the block cache can serve are copied now and never issued */
+            unsigned nissue = 0;
+            for (uint32_t k = 0; k < nsqe; k++) {
+                uint32_t idx = (k < g->nreads) ? g->read_first + k
+                                               : g->write_first + (k - g->nreads);
+                const struct plan_io *io = &plan->ios[idx];
+                int is_write = k >= g->nreads;
+                if (!is_write) {
+                    if (block_cache_read(io->off, io->len, buf + io->buf_off)) continue;
+                    io_token[idx] = block_cache_fill_begin(io->off, io->len);
+                }
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                int64_t rel;
+                int dev = target_map(io->off, &rel, NULL);
+
+                if (is_write)
+                    io_uring_prep_write_fixed(sqe, dev, buf + io->buf_off, io->len, rel, s);
+                else
+                    io_uring_prep_read_fixed(sqe, dev, buf + io->buf_off, io->len, rel, s);
+                sqe->flags |= IOSQE_FIXED_FILE;
+                if (k + 1 < nsqe) sqe->flags |= IOSQE_IO_LINK;
+                sqe->user_data = TAG(idx, is_write);
+                io_slot[idx] = (uint16_t)s;
+                nissue++;
+            }
+
+            slots[s].g = g;
+            slots[s].pending = nissue;
+            slots[s].mark = t_submit;
+            inflight++;
+            queued += nissue;
+        }
+
+        if (queued > 0) {
+            int ret;
+            while ((ret = io_uring_submit(&ring)) == -EINTR) {}
+            if (ret < 0) {
+                /* the SQEs stay queued and would go out with the next batch */
+                fprintf(stderr, "io_uring_submit: %s\n", strerror(-ret));
+                abandon_ring(plan, slots);
+                return -1;
+            }
+        }
+        if (inflight == 0) break;
+
+        /* --- REAP: time blocked here is charged to the phase that woke us --- */
+        struct io_uring_cqe *cqe;
+        struct timespec t_wait0, t_wait1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_wait0);
+        int ret;
+        while ((ret = io_uring_wait_cqe(&ring, &cqe)) == -EINTR) {}
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_wait1);
+        if (ret < 0) {
+            /* keep reaping so no CQE is left for the next batch; give up on a second failure */
+            fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+            if (wait_failed++) {
+                abandon_ring(plan, slots);
+                return -1;
+            }
+            result = -1;
+            continue;
+        }
+
+        if (TAG_IS_WRITE(cqe->user_data))
+            *write_ns += ns_diff(t_wait0, t_wait1);
+        else
+            *read_ns += ns_diff(t_wait0, t_wait1);
+
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            uint32_t idx = TAG_IO(cqe->user_data);
+            const struct plan_io *io = &plan->ios[idx];
+            int s = io_slot[idx];
+            seen++;
+
+            /* per-device time: from the previous link's completion to this one */
+            int64_t rel;
+            target_account(target_map(io->off, &rel, NULL), TAG_IS_WRITE(cqe->user_data),
+                           ns_diff(slots[s].mark, t_wait1));
+            slots[s].mark = t_wait1;
+
+            int ok = cqe->res == (int)io->len;
+            char *data = (char *)ring_bufs[s].iov_base + io->buf_off;
+            if (TAG_IS_WRITE(cqe->user_data))
+                block_cache_write(io->off, io->len, data, ok);
+            else
+                block_cache_fill_end(io->off, io->len, data, ok, io_token[idx]);
+
+            /* -ECANCELED: an earlier link of the chain already failed */
+            if (!ok && cqe->res != -ECANCELED) {
+                fprintf(stderr, "uring %s at %lld: %s\n",
+                        TAG_IS_WRITE(cqe->user_data) ? "write" : "read", (long long)io->off,
+                        cqe->res < 0 ? strerror(-cqe->res) : "short transfer");
+                result = -1;
+            }
+
+            /* last completion of the chain frees the slot and releases successors */
+            if (--slots[s].pending == 0) {
+                batch_sched_done(sched, (uint32_t)(slots[s].g - plan->groups));
+                free_slots[nfree++] = s;
+                inflight--;
+                done++;
+            }
+        }
+        io_uring_cq_advance(&ring, seen);
+    }
+
+    return result;
+}
+
+#else /* !HAVE_LIBURING */
+
+int uring_copy_batch(struct batch_sched *sched,
+                     uint64_t *read_ns, uint64_t *write_ns) {
+    return -ENOSYS;
+}
+
+#endif /* HAVE_LIBURING */
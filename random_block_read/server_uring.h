@@ -0,0 +1,22 @@
+#ifndef SERVER_URING_H
+#define SERVER_URING_H
+
+#include "batch_sched.h"
+#include <stdint.h>
+
+/* Max planned groups in flight per batch (each group = one linked SQE chain) */
+#ifndef URING_QD
+#define URING_QD 64
+#endif
+
+/*
+ * Run one planned WRITE_PBA_BATCH (see batch_plan.h) through io_uring,
+ * issuing ready groups concurrently in the order `sched` picks.
+ * Returns 0 on success, -1 if any copy failed, and -ENOSYS when the engine
+ * is not compiled in or the ring could not be set up (caller falls back
+ * to the pread/pwrite loop).
+ */
+int uring_copy_batch(struct batch_sched *sched,
+                     uint64_t *read_ns, uint64_t *write_ns);
+
+#endif
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include "server_verify.h"
+#include "server_random.h"
+#include "server_target.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static _Atomic uint64_t g_batches = 0;
+static _Atomic uint64_t g_mismatches = 0;
+
+struct range {
+    int64_t off;
+    int64_t end;
+};
+
+static int cmp_range(const void *a, const void *b) {
+    const struct range *x = a, *y = b;
+    return (x->off > y->off) - (x->off < y->off);
+}
+
+static int reserve(struct verify_state *v, uint32_t n, uint64_t bytes) {
+    if (v->ext_cap < n) {
+        int64_t *o = realloc(v->ext_off, n * sizeof(*o));
+        if (o) v->ext_off = o;
+        uint32_t *l = realloc(v->ext_len, n * sizeof(*l));
+        if (l) v->ext_len = l;
+        uint64_t *p = realloc(v->ext_pos, n * sizeof(*p));
+        if (p) v->ext_pos = p;
+        if (!o || !l || !p) return -1;
+        v->ext_cap = n;
+    }
+    if (v->shadow_cap < bytes) {
+        free(v->shadow);
+        free(v->check);
+        v->shadow = v->check = NULL;
+        v->shadow_cap = 0;
+        if (posix_memalign((void **)&v->shadow, ALIGN, bytes) != 0) return -1;
+        if (posix_memalign((void **)&v->check, ALIGN, bytes) != 0) return -1;
+        v->shadow_cap = bytes;
+    }
+    return 0;
+}
+
+/* Shadow address of device offset off (which lies inside a touched extent) */
+static char *at(const struct verify_state *v, int64_t off) {
+    uint32_t lo = 0, hi = v->next;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (v->ext_off[mid] <= off) lo = mid;
+        else hi = mid;
+    }
+    return v->shadow + v->ext_pos[lo] + (off - v->ext_off[lo]);
+}
+
+static int read_all(char *buf, uint32_t len, int64_t off) {
+    ssize_t r = target_pread(buf, len, off);
+    if (r != (ssize_t)len) {
+        perror("verify pread");
+        return -1;
+    }
+    return 0;
+}
+
+int verify_begin(struct verify_state *v, const int64_t *srcs, const int64_t *dsts,
+                 const uint32_t *lens, uint32_t count, uint32_t block_size) {
+    v->next = 0;
+    if (count == 0) return 0;
+
+    struct range *r = malloc(2 * (size_t)count * sizeof(*r));
+    if (!r) return -1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len = lens ? lens[i] : block_size;
+        r[2 * i].off = srcs[i];
+        r[2 * i].end = srcs[i] + len;
+        r[2 * i + 1].off = dsts[i];
+        r[2 * i + 1].end = dsts[i] + len;
+    }
+    qsort(r, 2 * (size_t)count, sizeof(*r), cmp_range);
+
+    /* merge overlapping or touching ranges into extents */
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < 2 * count; i++) {
+        if (n > 0 && r[i].off <= r[n - 1].end) {
+            if (r[i].end > r[n - 1].end) r[n - 1].end = r[i].end;
+            continue;
+        }
+        r[n++] = r[i];
+    }
+
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < n; i++) bytes += r[i].end - r[i].off;
+    if (reserve(v, n, bytes) != 0) {
+        free(r);
+        return -1;
+    }
+
+    uint64_t pos = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        v->ext_off[i] = r[i].off;
+        v->ext_len[i] = (uint32_t)(r[i].end - r[i].off);
+        v->ext_pos[i] = pos;
+        pos += v->ext_len[i];
+    }
+    v->next = n;
+    free(r);
+
+    for (uint32_t i = 0; i < n; i++)
+        if (read_all(v->shadow + v->ext_pos[i], v->ext_len[i], v->ext_off[i]) != 0) {
+            v->next = 0;
+            return -1;
+        }
+
+    /* the serial semantics, applied to the snapshot */
+    for (uint32_t i = 0; i < count; i++)
+        memmove(at(v, dsts[i]), at(v, srcs[i]), lens ? lens[i] : block_size);
+    return 0;
+}
+
+int verify_end(struct verify_state *v) {
+    if (v->next == 0) return 0;
+
+    int result = 0;
+    for (uint32_t i = 0; i < v->next && result == 0; i++) {
+        char *want = v->shadow + v->ext_pos[i];
+        char *got = v->check + v->ext_pos[i];
+        if (read_all(got, v->ext_len[i], v->ext_off[i]) != 0) return -1;
+        if (memcmp(want, got, v->ext_len[i]) == 0) continue;
+
+        uint32_t k = 0;
+        while (want[k] == got[k]) k++;
+        fprintf(stderr, "verify: batch differs from serial order at byte %lld\n",
+                (long long)(v->ext_off[i] + k));
+        result = 1;
+    }
+
+    atomic_fetch_add_explicit(&g_batches, 1, memory_order_relaxed);
+    if (result) atomic_fetch_add_explicit(&g_mismatches, 1, memory_order_relaxed);
+    return result;
+}
+
+void verify_get_stats(struct verify_stats *out) {
+    out->batches = atomic_load_explicit(&g_batches, memory_order_relaxed);
+    out->mismatches = atomic_load_explicit(&g_mismatches, memory_order_relaxed);
+}
+
+void verify_reset_stats(void) {
+    atomic_store_explicit(&g_batches, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_mismatches, 0, memory_order_relaxed);
+}
@@ -0,0 +1,42 @@
+#ifndef SERVER_VERIFY_H
+#define SERVER_VERIFY_H
+
+#include <stdint.h>
+
+/*
+ * Verification mode (-V): before a batch runs, snapshot every byte range
+ * it touches and replay the copies one by one on the snapshot; after it
+ * ran, read the ranges back and compare. Any difference means the batch
+ * did not match serial pread/pwrite semantics. Only meaningful while no
+ * other client writes to the same blocks.
+ */
+struct verify_state {
+    int64_t *ext_off;       /* merged touched extents, sorted by offset */
+    uint32_t *ext_len;
+    uint64_t *ext_pos;      /* extent start in shadow */
+    uint32_t next;
+    uint32_t ext_cap;
+    char *shadow;           /* expected contents after the batch */
+    char *check;            /* device contents read back */
+    uint64_t shadow_cap;
+};
+
+struct verify_stats {
+    uint64_t batches;       /* batches checked */
+    uint64_t mismatches;    /* batches whose result differed from serial */
+};
+
+/*
+ * Snapshot and replay; copy i is lens[i] bytes, or block_size if lens is
+ * NULL. Returns 0, or -1 if the snapshot could not be taken.
+ */
+int verify_begin(struct verify_state *v, const int64_t *srcs, const int64_t *dsts,
+                 const uint32_t *lens, uint32_t count, uint32_t block_size);
+
+/* Compare the device with the replay; returns 0 if identical, 1 if not, -1 on error */
+int verify_end(struct verify_state *v);
+
+void verify_get_stats(struct verify_stats *out);
+void verify_reset_stats(void);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Same-host transport (-U): a memfd the client creates and passes to the
+ * server over a Unix socket, together with two eventfds. It holds a
+ * submission ring (client -> server), a completion ring (server -> client)
+ * and one data slot per ring entry. A batch is a NATIVE_COPY body
+ * (native_proto.h) written into a free slot; its SQE names the slot, its
+ * CQE returns the slot and the result. Each ring has one producer and one
+ * consumer process. A side that finds its ring empty may spin for a while
+ * (-Y), then sets its sleeping flag and waits on its eventfd; the other
+ * side writes the eventfd only when it sees that flag after publishing.
+ *
+ *   page 0       struct shm_ring_hdr
+ *   page 1...    struct shm_sqe sq[entries], struct shm_cqe cq[entries]
+ *   then         entries slots of slot_bytes each, page aligned
+ */
+
+#define SHM_MAGIC 0x48534342u   /* "BCSH" */
+#define SHM_VERSION 1
+#define SHM_MAX_ENTRIES 64
+#define SHM_PAGE 4096
+
+struct shm_sqe {
+    uint64_t id;
+    uint32_t slot;
+    uint32_t len;       /* body bytes in the slot */
+    uint32_t flags;     /* NATIVE_LENS */
+    uint32_t pad;
+};
+
+struct shm_cqe {
+    uint64_t id;
+    uint32_t slot;
+    int32_t result;
+};
+
+struct shm_ring_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entries;           /* power of two, at most SHM_MAX_ENTRIES */
+    uint32_t slot_bytes;        /* multiple of SHM_PAGE */
+
+    /* written by the client */
+    _Atomic uint32_t sq_tail __attribute__((aligned(64)));
+    _Atomic uint32_t cq_head;
+    _Atomic uint32_t client_sleeping;
+
+    /* written by the server */
+    _Atomic uint32_t sq_head __attribute__((aligned(64)));
+    _Atomic uint32_t cq_tail;
+    _Atomic uint32_t server_sleeping;
+};
+
+static inline size_t shm_slots_off(uint32_t entries) {
+    size_t rings = entries * (sizeof(struct shm_sqe) + sizeof(struct shm_cqe));
+    return SHM_PAGE + (rings + SHM_PAGE - 1) / SHM_PAGE * SHM_PAGE;
+}
+
+static inline size_t shm_ring_size(uint32_t entries, uint32_t slot_bytes) {
+    return shm_slots_off(entries) + (size_t)entries * slot_bytes;
+}
+
+/*
+ * Ring addresses from the mapping's base. They take entries and slot_bytes
+ * from the caller, not from the header the other process can write.
+ */
+static inline struct shm_sqe *shm_sq(void *base) {
+    return (struct shm_sqe *)((uint8_t *)base + SHM_PAGE);
+}
+
+static inline struct shm_cqe *shm_cq(void *base, uint32_t entries) {
+    return (struct shm_cqe *)(shm_sq(base) + entries);
+}
+
+static inline uint8_t *shm_slot(void *base, uint32_t entries, uint32_t slot_bytes, uint32_t k) {
+    return (uint8_t *)base + shm_slots_off(entries) + (size_t)k * slot_bytes;
+}
+
+/* Busy-wait hint for the -Y spin loops */
+static inline void shm_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#endif
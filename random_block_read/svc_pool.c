@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "svc_pool.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+ * Worker handoff queue. The poll loop pushes fds of connections with a
+ * pending request; workers pop them and run svc_getreq_common() on that
+ * fd alone. libtirpc guards its transport table with its own lock, so a
+ * worker may tear down a closed connection while the poll loop accepts.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int *fds;
+    int cap;
+    int head;
+    int len;
+} q = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0 };
+
+static _Atomic char *busy;      /* busy[fd]: owned by a worker, not polled */
+static int nbusy;
+static int wake_fd = -1;        /* eventfd: a worker released a connection */
+
+static void queue_push(int fd) {
+    pthread_mutex_lock(&q.lock);
+    q.fds[(q.head + q.len) % q.cap] = fd;
+    q.len++;
+    pthread_cond_signal(&q.cond);
+    pthread_mutex_unlock(&q.lock);
+}
+
+static int queue_pop(void) {
+    pthread_mutex_lock(&q.lock);
+    while (q.len == 0) pthread_cond_wait(&q.cond, &q.lock);
+    int fd = q.fds[q.head];
+    q.head = (q.head + 1) % q.cap;
+    q.len--;
+    pthread_mutex_unlock(&q.lock);
+    return fd;
+}
+
+static void *worker_main(void *arg) {
+    for (;;) {
+        int fd = queue_pop();
+
+        /* decode -> handler -> reply, for every request already buffered */
+        svc_getreq_common(fd);
+
+        atomic_store_explicit(&busy[fd], 0, memory_order_release);
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) perror("write eventfd");
+    }
+    return NULL;
+}
+
+void svc_pool_run(int nthreads, const SVCXPRT *listener) {
+    nbusy = getdtablesize();
+    busy = calloc(nbusy, sizeof(*busy));
+    q.cap = nbusy;
+    q.fds = calloc(q.cap, sizeof(int));
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!busy || !q.fds || wake_fd < 0) {
+        perror("svc_pool_run");
+        exit(1);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_t tid;
+        int ret = pthread_create(&tid, NULL, worker_main, NULL);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+
+    struct pollfd *pfds = NULL;
+    int pfds_cap = 0;
+
+    for (;;) {
+        /* snapshot of idle transports + the wakeup eventfd */
+        int max = svc_max_pollfd;
+        if (max + 1 > pfds_cap) {
+            pfds_cap = max + 1;
+            pfds = realloc(pfds, pfds_cap * sizeof(*pfds));
+            if (!pfds) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        int n = 0;
+        pfds[n].fd = wake_fd;
+        pfds[n].events = POLLIN;
+        n++;
+        for (int i = 0; i < max; i++) {
+            int fd = svc_pollfd[i].fd;
+            if (fd < 0 || fd >= nbusy) continue;
+            if (atomic_load_explicit(&busy[fd], memory_order_acquire)) continue;
+            pfds[n].fd = fd;
+            pfds[n].events = POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND;
+            n++;
+        }
+
+        if (poll(pfds, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit(1);
+        }
+
+        if (pfds[0].revents) {
+            uint64_t cnt;
+            if (read(wake_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) perror("read eventfd");
+        }
+
+        for (int i = 1; i < n; i++) {
+            if (!pfds[i].revents || (pfds[i].revents & POLLNVAL)) continue;
+            int fd = pfds[i].fd;
+
+            if (listener && fd == listener->xp_sock) {
+                /* rendezvous: accept and register inline */
+                svc_getreq_common(fd);
+                continue;
+            }
+            atomic_store_explicit(&busy[fd], 1, memory_order_relaxed);
+            queue_push(fd);
+        }
+    }
+}
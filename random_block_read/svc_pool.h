@@ -0,0 +1,17 @@
+#ifndef SVC_POOL_H
+#define SVC_POOL_H
+
+#include <rpc/rpc.h>
+
+/*
+ * Replacement for svc_run() that serves connections on a pool of worker
+ * threads. The calling thread polls every registered transport and
+ * accepts new connections on `listener`; a connection with a pending
+ * request is handed to a worker, which decodes, runs and replies to its
+ * calls, and is not polled again until that worker is done with it.
+ * Requests on one connection stay in order, different connections run in
+ * parallel. Never returns.
+ */
+void svc_pool_run(int nthreads, const SVCXPRT *listener);
+
+#endif
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+set -Eeuo pipefail
+
+# ============================================================================
+# Connection Setup Cost for Short Random Block Copy Jobs
+# Runs many short client jobs and prints the mean connect time and the mean
+# total time per job: through the portmapper or, with RPC_PORT set, direct
+# to the server's fixed port (server_random -r <port>), and with AGENT_SOCK
+# set also on sessions borrowed from a running agent_random. A server with
+# -r is not registered with the portmapper: compare the two over two runs.
+# ============================================================================
+
+# ----- Configuration -----
+server_host="${1:-eternity2}"
+test_file="${2:-/mnt/nvme1/1gb.txt}"
+rpc_port="${RPC_PORT:-}"
+agent_sock="${AGENT_SOCK:-}"
+jobs=20
+iterations=100
+batch_size=100
+block_num=1
+seed=12345
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+CLIENT_BIN="$(dirname "$SCRIPT_DIR")/client_random"
+
+if [[ ! -x "$CLIENT_BIN" ]]; then
+  echo "ERROR: Client binary not found: $CLIENT_BIN"
+  echo "Please run 'make all' first"
+  exit 1
+fi
+
+# "<mean first connect us> <mean total ms>" over $jobs runs
+startup() {
+  local host="$1"
+  shift
+  for ((j = 0; j < jobs; j++)); do
+    sudo "$CLIENT_BIN" "$host" "$test_file" \
+      -n "$iterations" -B "$batch_size" -b "$block_num" -s $((seed + j)) "$@"
+  done | awk '
+    /Connect:/ { c += $4; n++ }
+    /Total Elapsed time:/ { t += $4 * 1000 }
+    END { if (n) printf "%.1f %.3f\n", c / n, t / n }'
+}
+
+echo "=== Connection setup, $jobs jobs of $iterations copies ==="
+echo "Server: $server_host${rpc_port:+, rpc port: $rpc_port}${agent_sock:+, agent: $agent_sock}"
+echo ""
+printf "%12s | %18s %15s\n" "mode" "first connect us" "job total ms"
+if [[ -n "$rpc_port" ]]; then
+  read -r conn total < <(startup "$server_host:$rpc_port")
+  printf "%12s | %18s %15s\n" "direct" "$conn" "$total"
+else
+  read -r conn total < <(startup "$server_host")
+  printf "%12s | %18s %15s\n" "portmapper" "$conn" "$total"
+fi
+if [[ -n "$agent_sock" ]]; then
+  read -r conn total < <(startup "$server_host" -a "$agent_sock")
+  printf "%12s | %18s %15s\n" "agent" "$conn" "$total"
+fi
@@ -0,0 +1,57 @@
+#!/usr/bin/env bash
+set -Eeuo pipefail
+
+# ============================================================================
+# Transport Comparison for Random Block Copy
+# Runs the same workload over Sun RPC and over the native transport (-N) and
+# prints the per-batch and per-copy overhead of each side by side.
+# The server must run with the native transport on: server_random -N <port>
+# With SHM_SOCK set (client on the server's host, server_random -U <path>)
+# the shared-memory ring transport gets a column as well.
+# ============================================================================
+
+# ----- Configuration -----
+server_host="${1:-eternity2}"
+test_file="${2:-/mnt/nvme1/1gb.txt}"
+native_port="${NATIVE_PORT:-7070}"
+shm_sock="${SHM_SOCK:-}"
+iterations=10000
+batch_sizes=(1 10 100 1000)
+block_num=1
+seed=12345
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+CLIENT_BIN="$(dirname "$SCRIPT_DIR")/client_random"
+
+if [[ ! -x "$CLIENT_BIN" ]]; then
+  echo "ERROR: Client binary not found: $CLIENT_BIN"
+  echo "Please run 'make all' first"
+  exit 1
+fi
+
+# "<us per batch> <us per copy>" from the client's Transport line
+overhead() {
+  sudo "$CLIENT_BIN" "$server_host" "$test_file" \
+    -n "$iterations" -b "$block_num" -s "$seed" "$@" |
+    sed -n 's/.*Transport: [a-z]*, \([0-9.-]*\) us per batch over server time (\([0-9.-]*\) us per copy).*/\1 \2/p'
+}
+
+echo "=== Transport overhead (round trip minus server time) ==="
+echo "Server: $server_host, native port: $native_port${shm_sock:+, shm socket: $shm_sock}"
+echo ""
+printf "%8s | %15s %15s | %15s %15s" "batch" "rpc us/batch" "rpc us/copy" \
+  "native us/batch" "native us/copy"
+if [[ -n "$shm_sock" ]]; then
+  printf " | %15s %15s" "shm us/batch" "shm us/copy"
+fi
+printf "\n"
+for b in "${batch_sizes[@]}"; do
+  read -r rpc_batch rpc_copy < <(overhead -B "$b")
+  read -r nat_batch nat_copy < <(overhead -B "$b" -N "$native_port")
+  printf "%8d | %15s %15s | %15s %15s" "$b" "$rpc_batch" "$rpc_copy" "$nat_batch" "$nat_copy"
+  if [[ -n "$shm_sock" ]]; then
+    read -r shm_batch shm_copy < <(overhead -B "$b" -U "$shm_sock")
+    printf " | %15s %15s" "$shm_batch" "$shm_copy"
+  fi
+  printf "\n"
+done
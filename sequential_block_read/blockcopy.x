@@ -12,10 +12,18 @@ struct get_server_ios {
     unsigned hyper server_other_time;
 };
 
+/* Named server counters (buffer pool, ...) returned by GET_STATS */
+struct stat_entry {
+    string name<64>;
+    unsigned hyper value;
+};
+typedef stat_entry stat_list<>;
+
 program BLOCKCOPY_PROG {
     version BLOCKCOPY_VERS {
         int WRITE_PBA(pba_write_params) = 1;
         get_server_ios GET_TIME(void) = 2;
         void RESET_TIME(void) = 3;
+        stat_list GET_STATS(void) = 5;
     } = 1;
 } = 0x34567890;
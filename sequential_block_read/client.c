@@ -1,13 +1,10 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
-#include <linux/fiemap.h>
-#include <linux/fs.h>
 #include <rpc/rpc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -15,11 +12,7 @@
 
 #include "blockcopy.h"
 #include "client.h"
-
-typedef struct {
-    uint64_t pba;
-    size_t len;
-} pba_seg;
+#include "extent_map.h"
 
 static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
     return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull
@@ -30,72 +23,59 @@ static inline double get_elapsed(uint64_t ns) {
     return (double) ns / 1e9;
 }
 
-/* helper to get physical block address from logical offset */
-static int get_pba(int fd, off_t logical, size_t length, pba_seg **out, size_t* out_cnt, uint64_t* fiemap_ns) {
-    struct timespec t_before, t_after;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &t_before);
-
-    size_t size = sizeof(struct fiemap) + EXTENTS_MAX * sizeof(struct fiemap_extent);
-    struct fiemap *fiemap = (struct fiemap*)calloc(1, size);
-    if(!fiemap) return -1;
-
-    fiemap->fm_start = logical;
-    fiemap->fm_length = length;
-    fiemap->fm_extent_count = EXTENTS_MAX;
-
-    int result = 0;
-
-    if (ioctl(fd, FS_IOC_FIEMAP, fiemap) < 0) {
-        perror("ioctl fiemap");
-        result = -1;
-        goto exit;
-    }
-    if (fiemap->fm_mapped_extents > EXTENTS_MAX) {
-        fprintf(stderr, "More mapped extentes needed: mapped %ld, but need %u\n", (long)EXTENTS_MAX, fiemap->fm_mapped_extents);
-        result = -1;
-        goto exit;
-    }
-    if (fiemap->fm_mapped_extents == 0) {
-        fprintf(stderr, "no extents mapped at logical %ld\n", (long)logical);
-        result = -1;
-        goto exit;
-    }
-
-    pba_seg *vec = calloc(fiemap->fm_mapped_extents, sizeof(pba_seg));
-    size_t n = 0;
-    if(!vec) {
-        result = -1;
-        goto exit;
+/*
+ * Split a copy of len bytes from logical src to logical dst into pieces that
+ * each lie inside one extent on both sides: piece k moves lens[k] bytes from
+ * PBA srcs[k] to PBA dsts[k]. Returns the number of pieces (1 unless the copy
+ * straddles an extent boundary), or -1 if a range is unmapped or needs more
+ * than SEGS_MAX pieces. On a miss the map is re-read if the file changed,
+ * or else just the two ranges are.
+ */
+static int split_copy(struct extent_map *map, off_t src, off_t dst, size_t len,
+                      uint64_t *srcs, uint64_t *dsts, uint32_t *lens) {
+    static struct extent_seg s[SEGS_MAX], d[SEGS_MAX];
+    int ns = extent_map_segments(map, src, len, s, SEGS_MAX);
+    int nd = ns < 0 ? -1 : extent_map_segments(map, dst, len, d, SEGS_MAX);
+    if (nd < 0) {
+        int r = extent_map_refresh(map);
+        if (r < 0) return -1;
+        if (r == 0 && (extent_map_remap(map, src, len) != 0 ||
+                       extent_map_remap(map, dst, len) != 0))
+            return -1;
+        ns = extent_map_segments(map, src, len, s, SEGS_MAX);
+        nd = ns < 0 ? -1 : extent_map_segments(map, dst, len, d, SEGS_MAX);
+        if (nd < 0) return -1;
     }
 
-    for(size_t i = 0; i < fiemap->fm_mapped_extents; ++i) {
-        struct fiemap_extent *e = &fiemap->fm_extents[i];
-
-        vec[n].pba = e->fe_physical + (logical - e->fe_logical);
-        vec[n].len = length;
+    /* cut at the union of both sides' segment boundaries */
+    int n = 0, i = 0, j = 0;
+    uint64_t s_off = 0, d_off = 0;
+    while (i < ns) {
+        if (n == SEGS_MAX) return -1;
+        uint64_t take = s[i].len - s_off;
+        if (take > d[j].len - d_off) take = d[j].len - d_off;
+        srcs[n] = s[i].physical + s_off;
+        dsts[n] = d[j].physical + d_off;
+        lens[n] = (uint32_t)take;
         n++;
+        s_off += take;
+        d_off += take;
+        if (s_off == s[i].len) i++, s_off = 0;
+        if (d_off == d[j].len) j++, d_off = 0;
     }
-
-    if (n == 0) { free(vec); result = -1; goto exit; }
-    *out = vec, *out_cnt = n;
-
-exit:
-    free(fiemap);
-
-    clock_gettime(CLOCK_MONOTONIC_RAW, &t_after);
-    *fiemap_ns = (uint64_t)ns_diff(t_before, t_after);
-    return result;
+    return n;
 }
 
 static void usage(const char *prog) {
     fprintf(stderr,
-        "Usage: %s <server_eternity> <file_path> [-b block_size] [-n iterations] [-s seed] [-l] [-t]\n"
+        "Usage: %s <server_eternity> <file_path> [-b block_size] [-n iterations] [-s seed] [-l] [-t] [-i index_file]\n"
         "Options:\n"
         "  -b block_number # of block number. Block is 4096B. (default: 1)\n"
         "  -n iterations   Number of random copies (default: 1000000)\n"
         "  -s seed         Seed Number (default: -1)\n"
         "  -l log          Show Log (default: false)\n"
-        "  -t test         Print result as csv form\n",
+        "  -t test         Print result as csv form\n"
+        "  -i index_file   Keep the file's extent map in index_file across runs\n",
         prog);
 }
 
@@ -120,9 +100,10 @@ int main(int argc, char *argv[]) {
     long seed = time(NULL);
     int log = 0;
     int csv = 0;
+    const char *index_path = NULL;
 
     int opt;
-    while ((opt = getopt(argc, argv, "b:n:s:lt")) != -1) {
+    while ((opt = getopt(argc, argv, "b:n:s:lti:")) != -1) {
         switch (opt) {
         case 'b': {
             int block_num = strtoul(optarg, NULL, 10);
@@ -148,6 +129,9 @@ int main(int argc, char *argv[]) {
         case 't':
             csv = 1;
             break;
+        case 'i':
+            index_path = optarg;
+            break;
         default:
             usage(argv[0]);
             return 1;
@@ -174,8 +158,8 @@ int main(int argc, char *argv[]) {
     }
 
     {
-        void *res = reset_time_1(NULL, clnt);
-        if (res == NULL) {
+        char res;
+        if (reset_time_1(NULL, &res, clnt) != RPC_SUCCESS) {
             fprintf(stderr, "RPC reset server time failed\n");
             clnt_destroy(clnt);
             exit(1);
@@ -197,6 +181,14 @@ int main(int argc, char *argv[]) {
     }
     off_t filesize = st.st_size;
 
+    // Whole-file extent map: FIEMAP once here (or none with a valid -i index)
+    struct extent_map map;
+    memset(&map, 0, sizeof(map));
+    if (extent_map_open(&map, fd, index_path) != 0) {
+        fprintf(stderr, "cannot read the extent map of %s\n", path);
+        exit(1);
+    }
+
     // aligned memory allocation in buf
     /*void *buf;
     if (posix_memalign(&buf, ALIGN, block_size) != 0) {
@@ -208,8 +200,14 @@ int main(int argc, char *argv[]) {
 
     /************ Prepare Stage End ************/
 
+    // Copies requested, copies the server ran, and how many of those were split
+    long executed = 0, split_copies = 0, skipped = 0;
+    uint64_t piece_srcs[SEGS_MAX], piece_dsts[SEGS_MAX];
+    uint32_t piece_lens[SEGS_MAX];
+
     // Test Start
-    for (long i = 0; i < iterations; i++) {
+    long i;
+    for (i = 0; i < iterations; i++) {
         if(log) {
             if(i % 1000 == 0) {
                 struct timespec now_ts;
@@ -222,6 +220,21 @@ int main(int argc, char *argv[]) {
             }
         }
 
+        // Re-read the extent map if the file changed, else spot-check part of it
+        if (i % EXTENT_REFRESH_INTERVAL == 0) {
+            struct timespec t_map0, t_map1;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_map0);
+            int refreshed = extent_map_refresh(&map);
+            if (refreshed == 0 && extent_map_check(&map, EXTENT_CHECK_SPANS) < 0) refreshed = -1;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_map1);
+            g_fiemap_ns += ns_diff(t_map0, t_map1);
+            if (refreshed < 0) {
+                fprintf(stderr, "cannot re-read the extent map\n");
+                break;
+            }
+            if (refreshed > 0) filesize = map.st.st_size;
+        }
+
         off_t max_blocks = filesize / block_size;
         off_t src_blk = rand() % max_blocks;
         off_t dst_blk = rand() % max_blocks;
@@ -232,63 +245,54 @@ int main(int argc, char *argv[]) {
         off_t src_logical = src_blk * block_size;
         off_t dst_logical = dst_blk * block_size;
 
-        pba_seg* src_pba;
-        pba_seg* dst_pba;
-        size_t src_pba_cnt, dst_pba_cnt;
-
-        /************ Fiemap0 ************/
-        uint64_t fiemap_ns0, fiemap_ns1;
-        if (get_pba(fd, src_logical, block_size, &src_pba, &src_pba_cnt, &fiemap_ns0) != 0)
+        /************ Fiemap ************/
+        struct timespec t_map0, t_map1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_map0);
+        int n = split_copy(&map, src_logical, dst_logical, block_size,
+                           piece_srcs, piece_dsts, piece_lens);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t_map1);
+        g_fiemap_ns += ns_diff(t_map0, t_map1);
+        /************ Fiemap End ************/
+
+        if (n < 0) {
+            skipped++;
             continue;
-        /************ Fiemap0 End ************/
-
-        /************ Fiemap1 ************/
-        if (get_pba(fd, dst_logical, block_size, &dst_pba, &dst_pba_cnt, &fiemap_ns1) != 0)
-            continue;
-        /************ Fiemap1 End ************/
-        
-        if(src_pba_cnt != dst_pba_cnt) {
-            fprintf(stderr, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
-            fprintf(stderr, "Number of extents are not same. src_pba_cnt: %lu, dst_pba_cnt: %lu\n", src_pba_cnt, dst_pba_cnt);
-            for(int j = 0; j < src_pba_cnt; ++j) {
-                fprintf(stderr, "src_pba[%d]: %lu, len: %lu\n", j, src_pba[j].pba, src_pba[j].len);
-            }
-            for(int j = 0; j < dst_pba_cnt; ++j) {
-                fprintf(stderr, "dst_pba[%d]: %lu, len: %lu\n", j, dst_pba[j].pba, dst_pba[j].len);
-            }
-            fprintf(stderr, "\n");
         }
 
-        pba_write_params params;
-        params.pba_src = src_pba[0].pba;
-        params.pba_dst = dst_pba[0].pba;
-        params.nbytes = src_pba[0].len;
-
-        struct timespec t_rpc0, t_rpc1;
-
         /************ RPC ************/
 
-        clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc0);
-        int *res = write_pba_1(&params, clnt);
-        clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc1);
-
-        /************ RPC End ************/
+        // A copy straddling an extent boundary is one WRITE_PBA per piece
+        int ok = 1;
+        for (int k = 0; k < n && ok; k++) {
+            pba_write_params params;
+            params.pba_src = piece_srcs[k];
+            params.pba_dst = piece_dsts[k];
+            params.nbytes = piece_lens[k];
+
+            struct timespec t_rpc0, t_rpc1;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc0);
+            int res = -1;
+            enum clnt_stat rpc_st = write_pba_1(&params, &res, clnt);
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t_rpc1);
+
+            if (rpc_st != RPC_SUCCESS || res == -1) {
+                fprintf(stderr, "RPC write failed at PBA %lu to %lu\n",
+                        (unsigned long)piece_srcs[k], (unsigned long)piece_dsts[k]);
+                ok = 0;
+                break;
+            }
 
-        free(src_pba); free(dst_pba);
+            uint64_t rpc_total_ns = ns_diff(t_rpc0, t_rpc1);
+            // atomic_fetch_add_explicit(&g_rpc_total_ns, rpc_total_ns, memory_order_relaxed);
 
-        if (res == NULL || *res == -1) {
-            fprintf(stderr, "RPC write failed at PBA %lu to %lu\n", (unsigned long)src_pba[0].pba, dst_pba[0].pba);
-            break;
+            g_rpc_total_ns += rpc_total_ns;
         }
-        
 
-        uint64_t rpc_total_ns = ns_diff(t_rpc0, t_rpc1);
-        // atomic_fetch_add_explicit(&g_fiemap_ns, fiemap_ns0, memory_order_relaxed);
-        // atomic_fetch_add_explicit(&g_fiemap_ns, fiemap_ns1, memory_order_relaxed);
-        // atomic_fetch_add_explicit(&g_rpc_total_ns, rpc_total_ns, memory_order_relaxed);
+        /************ RPC End ************/
 
-        g_fiemap_ns += fiemap_ns0 + fiemap_ns1;
-        g_rpc_total_ns += rpc_total_ns;
+        if (!ok) break;
+        executed++;
+        if (n > 1) split_copies++;
     }
 
     if(log) {
@@ -307,6 +311,8 @@ int main(int argc, char *argv[]) {
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_end0);
 
     //free(buf);
+    size_t map_extents = map.n;
+    extent_map_free(&map);
     close(fd);
 
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total1);
@@ -317,12 +323,19 @@ int main(int argc, char *argv[]) {
 /************ Time Check End ************/
     
     // Get server time
-    get_server_ios *res = get_time_1(NULL, clnt);
-    if (res == NULL) {
+    get_server_ios time_out;
+    get_server_ios *res = &time_out;
+    if (get_time_1(NULL, res, clnt) != RPC_SUCCESS) {
         fprintf(stderr, "RPC get server time failed\n");
         clnt_destroy(clnt);
         exit(1);
     }
+
+    // Named server counters; older servers do not implement GET_STATS
+    stat_list server_stats;
+    memset(&server_stats, 0, sizeof(server_stats));
+    if (get_stats_1(NULL, &server_stats, clnt) != RPC_SUCCESS)
+        memset(&server_stats, 0, sizeof(server_stats));
     clnt_destroy(clnt);
     uint64_t server_read_ns = res->server_read_time;
     uint64_t server_write_ns = res->server_write_time;
@@ -342,7 +355,8 @@ int main(int argc, char *argv[]) {
     }
 
     // Calculate statistics
-    long long total_bytes = (long long)iterations * block_size;
+    // Only copies the server ran count towards throughput
+    long long total_bytes = (long long)executed * block_size;
     double throughput_mbps = (total_bytes / (1024.0 * 1024.0)) / get_elapsed(total_ns);
 
     if(csv) {
@@ -350,7 +364,7 @@ int main(int argc, char *argv[]) {
         printf("%lu,%ld,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", 
             block_size/ALIGN, 
             iterations, 
-            block_size/ALIGN * iterations, 
+            block_size/ALIGN * executed, 
             (double)filesize / (1024.0 * 1024.0 * 1024.0),
             get_elapsed(server_read_ns),
             get_elapsed(server_write_ns),
@@ -366,7 +380,9 @@ int main(int argc, char *argv[]) {
     }
     printf("\n\n");
     printf("------------ RPC Test Results ------------\n");
-    printf("Iterations attempted: %ld\n", iterations);
+    printf("Iterations attempted: %ld\n", i);
+    printf("Copies executed: %ld (%ld split at extent boundaries, %ld skipped)\n",
+           executed, split_copies, skipped);
     printf("Block size: %zu bytes\n", block_size);
     printf("Seed: %ld\n", seed);
     printf("Log on: %s\n", log ? "true" : "false");
@@ -376,8 +392,19 @@ int main(int argc, char *argv[]) {
     printf("  Write Elapsed time: %.3f seconds\n", get_elapsed(server_write_ns));
     printf("  Other Elapsed time: %.3f seconds\n", get_elapsed(server_other_ns));
     printf("\n");
+    if (server_stats.stat_list_len > 0) {
+        printf("Server Stats: \n");
+        for (u_int k = 0; k < server_stats.stat_list_len; k++)
+            printf("  %s: %llu\n", server_stats.stat_list_val[k].name,
+                   (unsigned long long)server_stats.stat_list_val[k].value);
+        printf("\n");
+    }
     printf("Client Main Result: \n");
     printf("  Fiemap Elapsed time: %.3f seconds\n", get_elapsed(fiemap_ns));
+    printf("  Extent map: %zu extents, %llu loads%s\n", map_extents,
+           (unsigned long long)map.loads, map.index_hit ? " (index reused)" : "");
+    printf("  Extent checks: %llu windows, %llu ranges re-mapped\n",
+           (unsigned long long)map.checks, (unsigned long long)map.remaps);
     printf("  RPC Elapsed time: %.3f seconds\n", get_elapsed(rpc_ns));
     printf("  I/O Elapsed time: %.3f seconds\n", get_elapsed(io_ns));
     printf("\n");
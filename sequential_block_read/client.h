@@ -5,5 +5,8 @@
 #define DEFAULT_ITERS 1000000
 #define ALIGN 4096
 #define EXTENTS_MAX 1
+#define EXTENT_REFRESH_INTERVAL 1000 /* copies between extent map freshness checks */
+#define EXTENT_CHECK_SPANS 1 /* extent map windows spot-checked at each of them */
+#define SEGS_MAX 1024 /* pieces one copy may be split into at extent boundaries */
 
 #endif
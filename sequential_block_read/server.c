@@ -1,8 +1,13 @@
 #define _GNU_SOURCE
 #include "server.h"
 #include "blockcopy.h"
+#include "buf_pool.h"
+#include "server_target.h"
+#include "svc_pool.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <rpc/pmap_clnt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,46 +15,59 @@
 #include <time.h>
 #include <stdatomic.h>
 
-#define DEVICE_BLOCK_SIZE 512
-
 static inline uint64_t ns_diff(struct timespec a, struct timespec b) {
     return (uint64_t)(b.tv_sec - a.tv_sec) * 1000000000ull
          + (uint64_t)(b.tv_nsec - a.tv_nsec);
 }
  
-// static _Atomic uint64_t g_read_ns  = 0;
-// static _Atomic uint64_t g_write_ns = 0;
-// static _Atomic uint64_t g_other_ns = 0;
+/*
+ * Timing counters, one shard per thread so workers never share a cache
+ * line; get_time_1_svc merges them.
+ */
+struct stat_shard {
+    _Atomic uint64_t read_ns;
+    _Atomic uint64_t write_ns;
+    _Atomic uint64_t other_ns;
+} __attribute__((aligned(64)));
+
+static struct stat_shard g_shards[MAX_SHARDS];
+static _Atomic int g_nshards = 0;
+static __thread struct stat_shard *t_shard = NULL;
+
+static struct stat_shard *my_shard(void) {
+    if (!t_shard) {
+        int i = atomic_fetch_add(&g_nshards, 1);
+        t_shard = &g_shards[i % MAX_SHARDS];
+    }
+    return t_shard;
+}
 
-static uint64_t g_read_ns = 0;
-static uint64_t g_write_ns = 0;
-static uint64_t g_other_ns = 0;
+/* Requests refused by target_check (out of range or misaligned PBAs) */
+static _Atomic uint64_t g_target_rejects = 0;
 
-int *write_pba_1_svc(pba_write_params *params, struct svc_req *rqstp) {
+bool_t write_pba_1_svc(pba_write_params *params, int *result, struct svc_req *rqstp) {
     
 /************ Time Check Start ************/
 
     struct timespec t_total0, t_total1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_total0);
 
-    static int result = 0;
+    *result = 0;
     
-    static int fd = -1;
-    if (fd == -1) {
-        fd = open(DEVICE_PATH, O_RDWR | O_DIRECT);
-
-        if (fd < 0) {
-            perror("open device");
-            result = -1;
-            return &result;
-        }
+    if (target_check(params->pba_src, params->nbytes) != 0 ||
+        target_check(params->pba_dst, params->nbytes) != 0) {
+        fprintf(stderr, "write_pba: rejected %lld -> %lld (%d bytes)\n",
+                (long long)params->pba_src, (long long)params->pba_dst, params->nbytes);
+        atomic_fetch_add_explicit(&g_target_rejects, 1, memory_order_relaxed);
+        *result = -1;
+        return TRUE;
     }
 
-    void *buf;
-    if (posix_memalign(&buf, ALIGN, params->nbytes) != 0) {
-        fprintf(stderr, "posix_memalign failed\n");
-        result = -1;
-        return &result;
+    void *buf = buf_pool_get(params->nbytes);
+    if (!buf) {
+        fprintf(stderr, "buf_pool_get failed\n");
+        *result = -1;
+        return TRUE;
     }
 
     /************ Read ************/
@@ -57,17 +75,17 @@ int *write_pba_1_svc(pba_write_params *params, struct svc_req *rqstp) {
     struct timespec t_read0, t_read1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_read0);
 
-    ssize_t r = pread(fd, buf, params->nbytes, params->pba_src);
+    ssize_t r = target_pread(buf, params->nbytes, params->pba_src);
     if (r == -1) { 
         perror("pread");
-        result = -1;
-        free(buf);
+        *result = -1;
+        buf_pool_put(buf);
         goto exit;
     }
     if ((size_t)r != (size_t)params->nbytes) {
         fprintf(stderr, "read only segments of nbytes: %lu expected, but only %lu\n", (size_t)params->nbytes, (size_t)r);
-        result = -1;
-        free(buf);
+        *result = -1;
+        buf_pool_put(buf);
         goto exit;
     }
 
@@ -80,23 +98,23 @@ int *write_pba_1_svc(pba_write_params *params, struct svc_req *rqstp) {
     struct timespec t_write0, t_write1;
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_write0);
 
-    ssize_t w = pwrite(fd, (char*)buf, r, params->pba_dst);
+    ssize_t w = target_pwrite((char*)buf, r, params->pba_dst);
 
     if(w == -1) {
         perror("pwrite");
-        result = -1;
-        free(buf);
+        *result = -1;
+        buf_pool_put(buf);
         goto exit;
     }
     if (w < params->nbytes) {
         fprintf(stderr, "written only segments of nbytes: %lu expected, but only %lu\n", (size_t)params->nbytes, (size_t)w);
-        result = -1;
-        free(buf);
+        *result = -1;
+        buf_pool_put(buf);
         goto exit;
     }
 
     clock_gettime(CLOCK_MONOTONIC_RAW, &t_write1);
-    free(buf);
+    buf_pool_put(buf);
 
     /************ Write End ************/
 
@@ -106,39 +124,171 @@ int *write_pba_1_svc(pba_write_params *params, struct svc_req *rqstp) {
     uint64_t other_ns = (total_ns > read_ns + write_ns)
                                   ? (total_ns - read_ns - write_ns) : 0;
 
-    // atomic_fetch_add_explicit(&g_read_ns, read_ns, memory_order_relaxed);
-    // atomic_fetch_add_explicit(&g_write_ns, write_ns, memory_order_relaxed);
-    // atomic_fetch_add_explicit(&g_other_ns, other_ns, memory_order_relaxed);
-
-    g_read_ns += read_ns;
-    g_write_ns += write_ns;
-    g_other_ns += other_ns;
+    struct stat_shard *sh = my_shard();
+    atomic_fetch_add_explicit(&sh->read_ns, read_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->write_ns, write_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->other_ns, other_ns, memory_order_relaxed);
 
     t_total1 = t_write1;
 /************ Time Check End ************/
 
 exit:
-    return &result;
+    return TRUE;
 }
 
-get_server_ios *get_time_1_svc(void *argp, struct svc_req *rqstp) {
-    static get_server_ios out;
-    // out.server_read_time = atomic_load_explicit(&g_read_ns, memory_order_relaxed);
-    // out.server_write_time = atomic_load_explicit(&g_write_ns, memory_order_relaxed);
-    // out.server_other_time = atomic_load_explicit(&g_other_ns, memory_order_relaxed);
+bool_t get_time_1_svc(void *argp, get_server_ios *out, struct svc_req *rqstp) {
+    int n = atomic_load(&g_nshards);
+    if (n > MAX_SHARDS) n = MAX_SHARDS;
 
-    out.server_read_time = g_read_ns;
-    out.server_write_time = g_write_ns;
-    out.server_other_time = g_other_ns;
+    out->server_read_time = 0;
+    out->server_write_time = 0;
+    out->server_other_time = 0;
+    for (int i = 0; i < n; i++) {
+        out->server_read_time += atomic_load_explicit(&g_shards[i].read_ns, memory_order_relaxed);
+        out->server_write_time += atomic_load_explicit(&g_shards[i].write_ns, memory_order_relaxed);
+        out->server_other_time += atomic_load_explicit(&g_shards[i].other_ns, memory_order_relaxed);
+    }
 
-    return &out;
+    return TRUE;
 }
 
-void *reset_time_1_svc(void *argp, struct svc_req *rqstp) {
-    static char dummy;
-    g_read_ns = g_write_ns = g_other_ns = 0;
+bool_t reset_time_1_svc(void *argp, void *result, struct svc_req *rqstp) {
+    for (int i = 0; i < MAX_SHARDS; i++) {
+        atomic_store_explicit(&g_shards[i].read_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].write_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&g_shards[i].other_ns, 0, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&g_target_rejects, 0, memory_order_relaxed);
+    target_reset_stats();
+    buf_pool_reset_stats();
 
     fprintf(stdout, "server time reset complete.\n");
     fflush(stdout);
-    return (void *)&dummy;
-}
\ No newline at end of file
+    return TRUE;
+}
+
+static void stat_add(stat_list *out, const char *name, uint64_t value) {
+    stat_entry *e = realloc(out->stat_list_val, (out->stat_list_len + 1) * sizeof(*e));
+    if (!e) return;
+    out->stat_list_val = e;
+    e[out->stat_list_len].name = strdup(name);
+    e[out->stat_list_len].value = value;
+    out->stat_list_len++;
+}
+
+bool_t get_stats_1_svc(void *argp, stat_list *out, struct svc_req *rqstp) {
+    memset(out, 0, sizeof(*out));
+
+    struct buf_pool_stats bp;
+    buf_pool_get_stats(&bp);
+    stat_add(out, "buf_pool_hits", bp.hits);
+    stat_add(out, "buf_pool_misses", bp.misses);
+    stat_add(out, "buf_pool_peak_in_use", bp.peak);
+    stat_add(out, "buf_pool_in_use", bp.in_use);
+    stat_add(out, "target_rejects",
+             atomic_load_explicit(&g_target_rejects, memory_order_relaxed));
+
+    /* per target device: I/O count and summed pread/pwrite time */
+    for (int i = 0; i < target_ndevs(); i++) {
+        struct target_dev_stats ds;
+        char name[32];
+        target_get_stats(i, &ds);
+        snprintf(name, sizeof(name), "dev%d_reads", i);
+        stat_add(out, name, ds.reads);
+        snprintf(name, sizeof(name), "dev%d_writes", i);
+        stat_add(out, name, ds.writes);
+        snprintf(name, sizeof(name), "dev%d_read_ns", i);
+        stat_add(out, name, ds.read_ns);
+        snprintf(name, sizeof(name), "dev%d_write_ns", i);
+        stat_add(out, name, ds.write_ns);
+    }
+
+    return TRUE;
+}
+
+int blockcopy_prog_1_freeresult(SVCXPRT *transp, xdrproc_t xdr_result, caddr_t result) {
+    xdr_free(xdr_result, result);
+    return 1;
+}
+
+/* Dispatcher generated by rpcgen -m (blockcopy_svc.c) */
+extern void blockcopy_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
+
+int main(int argc, char *argv[]) {
+    int threads = 0;
+    long pool_count = BUF_POOL_DEFAULT_COUNT;
+    long pool_size = BUF_POOL_DEFAULT_SIZE;
+    int pool_lock = 0;
+    int ntargets = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:S:t:p:m:L")) != -1) {
+        switch (opt) {
+        case 'd':
+            if (target_add(optarg) != 0) return 1;
+            ntargets++;
+            break;
+        case 'S':
+            target_set_stripe(strtoull(optarg, NULL, 10));
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'p':
+            pool_count = strtol(optarg, NULL, 10);
+            break;
+        case 'm':
+            pool_size = strtol(optarg, NULL, 10);
+            break;
+        case 'L':
+            pool_lock = 1;
+            break;
+        default:
+            fprintf(stderr,
+                "Usage: %s [-d path]... [-S bytes] [-t threads] [-p buffers] [-m bytes] [-L]\n"
+                "  -d path         Copy target: block device, image file or directory of images;\n"
+                "                  repeat to concatenate several (default: %s)\n"
+                "  -S bytes        Stripe the PBA space across the -d targets in units of this size\n"
+                "  -t threads      Worker threads serving connections (default: 0 = svc_run)\n"
+                "  -p buffers      Buffers in the I/O buffer pool (default: %d)\n"
+                "  -m bytes        Largest block size served from the pool (default: %d)\n"
+                "  -L              mlock the buffer pool\n",
+                argv[0], DEVICE_PATH, BUF_POOL_DEFAULT_COUNT, BUF_POOL_DEFAULT_SIZE);
+            return 1;
+        }
+    }
+
+    if (ntargets == 0 && target_add(DEVICE_PATH) != 0) return 1;
+    if (target_open() != 0) {
+        fprintf(stderr, "cannot open copy target.\n");
+        exit(1);
+    }
+
+    if (pool_count < 0 || pool_size <= 0 || buf_pool_init(pool_count, pool_size, pool_lock) != 0) {
+        fprintf(stderr, "cannot set up buffer pool.\n");
+        exit(1);
+    }
+
+    pmap_unset(BLOCKCOPY_PROG, BLOCKCOPY_VERS);
+
+    SVCXPRT *udp = svcudp_create(RPC_ANYSOCK);
+    if (udp == NULL || !svc_register(udp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, IPPROTO_UDP)) {
+        fprintf(stderr, "unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS, udp).\n");
+        exit(1);
+    }
+
+    SVCXPRT *tcp = svctcp_create(RPC_ANYSOCK, 0, 0);
+    if (tcp == NULL || !svc_register(tcp, BLOCKCOPY_PROG, BLOCKCOPY_VERS, blockcopy_prog_1, IPPROTO_TCP)) {
+        fprintf(stderr, "unable to register (BLOCKCOPY_PROG, BLOCKCOPY_VERS, tcp).\n");
+        exit(1);
+    }
+
+    if (threads > 0)
+        svc_pool_run(threads, tcp);
+    else
+        svc_run();
+
+    fprintf(stderr, "svc_run returned\n");
+    exit(1);
+}
@@ -31,6 +31,9 @@ mnt="/mnt/nvme1"
 a="$mnt/a.txt"
 b="$mnt/b.txt"
 
+# client extent index: 레이아웃이 바뀔 때만 다시 만든다
+EXTENT_INDEX="${EXTENT_INDEX:-$LOG_DIR/a.txt.extents}"
+
 # ----- 필요 명령/바이너리 점검 -----
 # testing 폴더에서 실행되어야 함!
 need_cmds=(sudo cp sync)
@@ -89,8 +92,8 @@ while [ "$i" -le "$MAX_ITERATIONS" ]; do
                 echo "----- START $case_id -----"
 
                 # (2) client: a.txt
-                echo "[client] sudo $HOME_DIR/client eternity2 $a -n $it -b $bn -s $seed"
-                sudo "$HOME_DIR"/client eternity2 "$a" -n "$it" -b "$bn" -s "$seed" -t \
+                echo "[client] sudo $HOME_DIR/client eternity2 $a -n $it -b $bn -s $seed -i $EXTENT_INDEX"
+                sudo "$HOME_DIR"/client eternity2 "$a" -n "$it" -b "$bn" -s "$seed" -i "$EXTENT_INDEX" -t \
                     > >(stdbuf -oL tee -a "$RPC_LOG_FILE" >/dev/null) \
                     2> >(stdbuf -eL tee -a "$RPC_LOG_FILE" >&2)
                 flush_caches